@@ -76,6 +76,7 @@ struct CmdOptions
     int restartTimes;
     int downlimit;
     int uplimit;
+    bool databaseStatistics;
 };
 
 // we can't use csync_set_userdata because the SyncEngine sets it already.
@@ -188,6 +189,7 @@ void help()
     std::cout << "  -h                     Sync hidden files,do not ignore them" << std::endl;
     std::cout << "  --version, -v          Display version and exit" << std::endl;
     std::cout << "  --logdebug             More verbose logging" << std::endl;
+    std::cout << "  --dbstats              Print statistics of the sync database when done" << std::endl;
     std::cout << "" << std::endl;
     exit(0);
 }
@@ -268,6 +270,8 @@ void parseOptions(const QStringList &app_args, CmdOptions *options)
         } else if (option == "--logdebug") {
             Logger::instance()->setLogFile("-");
             Logger::instance()->setLogDebug(true);
+        } else if (option == "--dbstats") {
+            options->databaseStatistics = true;
         } else {
             help();
         }
@@ -324,6 +328,7 @@ int main(int argc, char **argv)
     options.restartTimes = 3;
     options.uplimit = 0;
     options.downlimit = 0;
+    options.databaseStatistics = false;
 
     parseOptions(app.arguments(), &options);
 
@@ -548,5 +553,9 @@ restart_sync:
         qWarning() << "Another sync is needed, but not done because restart count is exceeded" << restartCount;
     }
 
+    if (options.databaseStatistics) {
+        std::cout << qPrintable(db.statisticsReport());
+    }
+
     return resultCode;
 }
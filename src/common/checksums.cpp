@@ -18,10 +18,19 @@
 #include "config.h"
 #include "filesystembase.h"
 #include "common/checksums.h"
+#include "common/syncjournaldb.h"
+#include "csync.h"
+#include "vio/csync_vio_local.h"
 
 #include <QLoggingCategory>
 #include <qtconcurrentrun.h>
 
+#include <ctime>
+
+#ifdef ZLIB_FOUND
+#include <zlib.h>
+#endif
+
 /** \file checksums.cpp
  *
  * \brief Computing and validating file checksums
@@ -169,6 +178,11 @@ QByteArray ComputeChecksum::checksumType() const
     return _checksumType;
 }
 
+void ComputeChecksum::setJournal(SyncJournalDb *journal)
+{
+    _journal = journal;
+}
+
 void ComputeChecksum::start(const QString &filePath)
 {
     qCInfo(lcChecksums) << "Computing" << checksumType() << "checksum of" << filePath << "in a thread";
@@ -177,7 +191,7 @@ void ComputeChecksum::start(const QString &filePath)
     connect(&_watcher, &QFutureWatcherBase::finished,
         this, &ComputeChecksum::slotCalculationDone,
         Qt::UniqueConnection);
-    _watcher.setFuture(QtConcurrent::run(ComputeChecksum::computeNow, filePath, checksumType()));
+    _watcher.setFuture(QtConcurrent::run(ComputeChecksum::computeNowCached, filePath, checksumType(), _journal));
 }
 
 QByteArray ComputeChecksum::computeNow(const QString &filePath, const QByteArray &checksumType)
@@ -204,6 +218,38 @@ QByteArray ComputeChecksum::computeNow(const QString &filePath, const QByteArray
     return QByteArray();
 }
 
+QByteArray ComputeChecksum::computeNowCached(const QString &filePath, const QByteArray &checksumType, SyncJournalDb *journal)
+{
+    csync_file_stat_t before;
+    if (!journal || checksumType.isEmpty() || !checksumComputationEnabled()
+        || csync_vio_local_stat(filePath.toUtf8().constData(), &before) != 0 || before.inode == 0) {
+        return computeNow(filePath, checksumType);
+    }
+
+    QByteArray checksum = journal->getCachedChecksum(before.inode, before.modtime, before.size, checksumType);
+    if (!checksum.isEmpty()) {
+        qCInfo(lcChecksums) << "Using the cached" << checksumType << "checksum of" << filePath;
+        return checksum;
+    }
+
+    const time_t hashStart = time(nullptr);
+    checksum = computeNow(filePath, checksumType);
+    if (checksum.isEmpty()) {
+        return checksum;
+    }
+
+    // A change while the file was read, or shortly after, may not have
+    // changed the modtime, which only has a resolution of seconds (two on
+    // FAT). Don't cache the checksum then.
+    csync_file_stat_t after;
+    if (before.modtime + 2 < hashStart
+        && csync_vio_local_stat(filePath.toUtf8().constData(), &after) == 0
+        && after.inode == before.inode && after.modtime == before.modtime && after.size == before.size) {
+        journal->setCachedChecksum(before.inode, before.modtime, before.size, checksumType, checksum);
+    }
+    return checksum;
+}
+
 void ComputeChecksum::slotCalculationDone()
 {
     QByteArray checksum = _watcher.future().result();
@@ -215,6 +261,61 @@ void ComputeChecksum::slotCalculationDone()
 }
 
 
+ChecksumCalculator::ChecksumCalculator(const QByteArray &checksumType)
+    : _checksumType(checksumType)
+{
+    if (!checksumComputationEnabled()) {
+        return;
+    }
+    if (checksumType == checkSumMD5C) {
+        _cryptoHash.reset(new QCryptographicHash(QCryptographicHash::Md5));
+    } else if (checksumType == checkSumSHA1C) {
+        _cryptoHash.reset(new QCryptographicHash(QCryptographicHash::Sha1));
+    }
+#ifdef ZLIB_FOUND
+    else if (checksumType == checkSumAdlerC) {
+        _adler = true;
+        _adlerValue = adler32(0L, Z_NULL, 0);
+    }
+#endif
+    else if (!checksumType.isEmpty()) {
+        qCWarning(lcChecksums) << "Unknown checksum type:" << checksumType;
+    }
+}
+
+bool ChecksumCalculator::isValid() const
+{
+    return _cryptoHash || _adler;
+}
+
+void ChecksumCalculator::addData(const char *data, qint64 length)
+{
+    // The hash functions take the length as int
+    while (length > 0) {
+        const int size = int(qMin<qint64>(length, 1 << 30));
+        if (_cryptoHash) {
+            _cryptoHash->addData(data, size);
+        }
+#ifdef ZLIB_FOUND
+        else if (_adler) {
+            _adlerValue = adler32(_adlerValue, reinterpret_cast<const Bytef *>(data), size);
+        }
+#endif
+        data += size;
+        length -= size;
+    }
+}
+
+QByteArray ChecksumCalculator::result()
+{
+    if (_cryptoHash) {
+        return _cryptoHash->result().toHex();
+    } else if (_adler) {
+        return QByteArray::number(qulonglong(_adlerValue), 16);
+    }
+    return QByteArray();
+}
+
 ValidateChecksumHeader::ValidateChecksumHeader(QObject *parent)
     : QObject(parent)
 {
@@ -234,6 +335,12 @@ void ValidateChecksumHeader::start(const QString &filePath, const QByteArray &ch
         return;
     }
 
+    const QByteArray computedChecksum = _computedChecksums.value(_expectedChecksumType);
+    if (!computedChecksum.isEmpty()) {
+        slotChecksumCalculated(_expectedChecksumType, computedChecksum);
+        return;
+    }
+
     auto calculator = new ComputeChecksum(this);
     calculator->setChecksumType(_expectedChecksumType);
     connect(calculator, &ComputeChecksum::done,
@@ -255,18 +362,20 @@ void ValidateChecksumHeader::slotChecksumCalculated(const QByteArray &checksumTy
     emit validated(checksumType, checksum);
 }
 
-CSyncChecksumHook::CSyncChecksumHook()
+CSyncChecksumHook::CSyncChecksumHook(SyncJournalDb *journal)
+    : _journal(journal)
 {
 }
 
-QByteArray CSyncChecksumHook::hook(const QByteArray &path, const QByteArray &otherChecksumHeader, void * /*this_obj*/)
+QByteArray CSyncChecksumHook::hook(const QByteArray &path, const QByteArray &otherChecksumHeader, void *this_obj)
 {
     QByteArray type = parseChecksumHeaderType(QByteArray(otherChecksumHeader));
     if (type.isEmpty())
         return NULL;
 
     qCInfo(lcChecksums) << "Computing" << type << "checksum of" << path << "in the csync hook";
-    QByteArray checksum = ComputeChecksum::computeNow(QString::fromUtf8(path), type);
+    auto journal = this_obj ? static_cast<CSyncChecksumHook *>(this_obj)->_journal : nullptr;
+    QByteArray checksum = ComputeChecksum::computeNowCached(QString::fromUtf8(path), type, journal);
     if (checksum.isNull()) {
         qCWarning(lcChecksums) << "Failed to compute checksum" << type << "for" << path;
         return NULL;
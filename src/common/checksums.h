@@ -22,7 +22,11 @@
 
 #include <QObject>
 #include <QByteArray>
+#include <QMap>
 #include <QFutureWatcher>
+#include <QCryptographicHash>
+
+#include <memory>
 
 namespace OCC {
 
@@ -79,6 +83,12 @@ public:
 
     QByteArray checksumType() const;
 
+    /**
+     * Sets the journal whose checksum cache is used, see computeNowCached().
+     * The default is none.
+     */
+    void setJournal(SyncJournalDb *journal);
+
     /**
      * Computes the checksum for the given file path.
      *
@@ -91,6 +101,13 @@ public:
      */
     static QByteArray computeNow(const QString &filePath, const QByteArray &checksumType);
 
+    /**
+     * Like computeNow(), but looks the checksum of the file up in the
+     * checksum cache of the journal first, and stores the computed checksum
+     * there. Without a journal this is computeNow().
+     */
+    static QByteArray computeNowCached(const QString &filePath, const QByteArray &checksumType, SyncJournalDb *journal);
+
 signals:
     void done(const QByteArray &checksumType, const QByteArray &checksum);
 
@@ -99,11 +116,42 @@ private slots:
 
 private:
     QByteArray _checksumType;
+    SyncJournalDb *_journal = nullptr;
 
     // watcher for the checksum calculation thread
     QFutureWatcher<QByteArray> _watcher;
 };
 
+/**
+ * Computes a checksum from data that is passed in pieces, for example while
+ * it is transferred.
+ *
+ * The result is the same as ComputeChecksum::computeNow() on a file with
+ * the concatenated data.
+ * \ingroup libsync
+ */
+class OCSYNC_EXPORT ChecksumCalculator
+{
+public:
+    explicit ChecksumCalculator(const QByteArray &checksumType);
+
+    QByteArray checksumType() const { return _checksumType; }
+
+    /// False if the type is empty or unknown, the result is empty then
+    bool isValid() const;
+
+    void addData(const char *data, qint64 length);
+
+    /// The checksum of the data added so far, no data may be added afterwards
+    QByteArray result();
+
+private:
+    QByteArray _checksumType;
+    std::unique_ptr<QCryptographicHash> _cryptoHash;
+    bool _adler = false;
+    unsigned long _adlerValue = 0;
+};
+
 /**
  * Checks whether a file's checksum matches the expected value.
  * @ingroup libsync
@@ -123,6 +171,13 @@ public:
      */
     void start(const QString &filePath, const QByteArray &checksumHeader);
 
+    /**
+     * Checksums of the file by type that are known already, for example
+     * because they were computed while the file was downloaded. If the
+     * expected type is among them start() does not read the file.
+     */
+    void setComputedChecksums(const QMap<QByteArray, QByteArray> &checksums) { _computedChecksums = checksums; }
+
 signals:
     void validated(const QByteArray &checksumType, const QByteArray &checksum);
     void validationFailed(const QString &errMsg);
@@ -133,6 +188,7 @@ private slots:
 private:
     QByteArray _expectedChecksumType;
     QByteArray _expectedChecksum;
+    QMap<QByteArray, QByteArray> _computedChecksums;
 };
 
 /**
@@ -143,7 +199,8 @@ class OCSYNC_EXPORT CSyncChecksumHook : public QObject
 {
     Q_OBJECT
 public:
-    explicit CSyncChecksumHook();
+    /// The checksum cache of the journal is used if it is set, see ComputeChecksum::computeNowCached().
+    explicit CSyncChecksumHook(SyncJournalDb *journal = nullptr);
 
     /**
      * Returns the checksum value for \a path that is comparable to \a otherChecksum.
@@ -153,5 +210,8 @@ public:
      * The return value will be owned by csync.
      */
     static QByteArray hook(const QByteArray &path, const QByteArray &otherChecksumHeader, void *this_obj);
+
+private:
+    SyncJournalDb *_journal;
 };
 }
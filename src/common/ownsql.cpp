@@ -17,20 +17,33 @@
  */
 
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QLoggingCategory>
 #include <QString>
 #include <QFile>
 #include <QFileInfo>
 #include <QDir>
+#include <QRegularExpression>
 
 #include "ownsql.h"
 #include "common/utility.h"
 #include "common/asserts.h"
 #include <sqlite3.h>
 
+#include <algorithm>
+#include <atomic>
+
 #define SQLITE_SLEEP_TIME_USEC 100000
 #define SQLITE_REPEAT_COUNT 20
 
+// Number of statements kept by SqlDatabase::cachedQuery()
+#define SQLITE_QUERY_CACHE_SIZE 64
+
+// Statements with a different sql text that have the statistics of their
+// own, the others are accounted together. Generated value lists are
+// collapsed, see statisticsKey().
+#define SQLITE_STATISTICS_SIZE 500
+
 #define SQLITE_DO(A)                                         \
     if (1) {                                                 \
         _errId = (A);                                        \
@@ -43,6 +56,14 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcSql, "sync.database.sql", QtInfoMsg)
 
+struct SqlDatabase::StatementCounters
+{
+    std::atomic<quint64> executions{ 0 };
+    std::atomic<quint64> rows{ 0 };
+    std::atomic<qint64> totalNsecs{ 0 };
+    std::atomic<qint64> maxNsecs{ 0 };
+};
+
 SqlDatabase::SqlDatabase()
     : _db(0)
     , _errId(0)
@@ -161,7 +182,7 @@ bool SqlDatabase::openOrCreateReadWrite(const QString &filename)
     return true;
 }
 
-bool SqlDatabase::openReadOnly(const QString &filename)
+bool SqlDatabase::openReadOnly(const QString &filename, bool quickCheck)
 {
     if (isOpen()) {
         return true;
@@ -171,7 +192,7 @@ bool SqlDatabase::openReadOnly(const QString &filename)
         return false;
     }
 
-    if (checkDb() != CheckDbResult::Ok) {
+    if (quickCheck && checkDb() != CheckDbResult::Ok) {
         qCWarning(lcSql) << "Consistency check failed in readonly mode, giving up" << filename;
         close();
         return false;
@@ -190,6 +211,7 @@ QString SqlDatabase::error() const
 void SqlDatabase::close()
 {
     if (_db) {
+        clearQueryCache();
         foreach (auto q, _queries) {
             q->finish();
         }
@@ -200,6 +222,147 @@ void SqlDatabase::close()
     }
 }
 
+SqlQuery *SqlDatabase::cachedQuery(const QByteArray &sql)
+{
+    if (!_db) {
+        return nullptr;
+    }
+
+    auto it = _queryCache.find(sql);
+    if (it != _queryCache.end()) {
+        it->lastUse = ++_queryCacheUses;
+        it->query->reset_and_clear_bindings();
+        return it->query;
+    }
+
+    if (_queryCache.size() >= SQLITE_QUERY_CACHE_SIZE) {
+        evictCachedQuery();
+    }
+
+    auto query = new SqlQuery(*this);
+    if (query->prepare(sql, /*allow_failure=*/true) != SQLITE_OK) {
+        _errId = query->errorId();
+        _error = query->error();
+        delete query;
+        return nullptr;
+    }
+    _queryCache.insert(sql, CachedQuery{ query, ++_queryCacheUses });
+    return query;
+}
+
+void SqlDatabase::evictCachedQuery()
+{
+    // Statements that are still being stepped through are in use
+    auto oldest = _queryCache.end();
+    for (auto it = _queryCache.begin(); it != _queryCache.end(); ++it) {
+        if (sqlite3_stmt_busy(it->query->_stmt))
+            continue;
+        if (oldest == _queryCache.end() || it->lastUse < oldest->lastUse)
+            oldest = it;
+    }
+    if (oldest == _queryCache.end()) {
+        return;
+    }
+    delete oldest->query;
+    _queryCache.erase(oldest);
+}
+
+void SqlDatabase::resetCachedQueries()
+{
+    for (const auto &entry : _queryCache) {
+        entry.query->reset_and_clear_bindings();
+    }
+}
+
+void SqlDatabase::clearQueryCache()
+{
+    for (const auto &entry : _queryCache) {
+        delete entry.query;
+    }
+    _queryCache.clear();
+}
+
+/* The statement with generated lists of values collapsed, so that statements
+ * that only differ in the number of values share their statistics:
+ * "IN (1, 2, 3)" becomes "IN (...)", and the rows of a multi-row VALUES
+ * after the first one become ", ...". */
+static QByteArray statisticsKey(const QByteArray &sql)
+{
+    static const QRegularExpression inList(
+        QStringLiteral("\\bIN\\s*\\((?!\\s*SELECT\\b)[^()]*\\)"),
+        QRegularExpression::CaseInsensitiveOption);
+    static const QRegularExpression valueRows(
+        QStringLiteral("(\\bVALUES\\s*\\([^()]*\\))(\\s*,\\s*\\([^()]*\\))+"),
+        QRegularExpression::CaseInsensitiveOption);
+
+    if (!sql.contains('(')) {
+        return sql;
+    }
+    QString key = QString::fromUtf8(sql);
+    key.replace(inList, QStringLiteral("IN (...)"));
+    key.replace(valueRows, QStringLiteral("\\1, ..."));
+    return key.toUtf8();
+}
+
+QSharedPointer<SqlDatabase::StatementCounters> SqlDatabase::countersFor(const QByteArray &sql)
+{
+    auto key = statisticsKey(sql);
+    QMutexLocker locker(&_statisticsMutex);
+    auto it = _statistics.find(key);
+    if (it == _statistics.end()) {
+        if (_statistics.size() >= SQLITE_STATISTICS_SIZE)
+            key = QByteArrayLiteral("(other statements)");
+        it = _statistics.find(key);
+        if (it == _statistics.end())
+            it = _statistics.insert(key, QSharedPointer<StatementCounters>::create());
+    }
+    return *it;
+}
+
+QVector<SqlQueryStatistics> SqlDatabase::statistics() const
+{
+    QVector<SqlQueryStatistics> result;
+    {
+        QMutexLocker locker(&_statisticsMutex);
+        for (auto it = _statistics.begin(); it != _statistics.end(); ++it) {
+            SqlQueryStatistics stats;
+            stats.sql = it.key();
+            stats.executions = it.value()->executions;
+            stats.rows = it.value()->rows;
+            stats.totalNsecs = it.value()->totalNsecs;
+            stats.maxNsecs = it.value()->maxNsecs;
+            if (stats.executions)
+                result.append(stats);
+        }
+    }
+    std::sort(result.begin(), result.end(), [](const SqlQueryStatistics &a, const SqlQueryStatistics &b) {
+        return a.totalNsecs > b.totalNsecs;
+    });
+    return result;
+}
+
+void SqlDatabase::resetStatistics()
+{
+    QMutexLocker locker(&_statisticsMutex);
+    // The prepared queries keep their counters
+    for (const auto &counters : _statistics) {
+        counters->executions = 0;
+        counters->rows = 0;
+        counters->totalNsecs = 0;
+        counters->maxNsecs = 0;
+    }
+}
+
+qint64 SqlDatabase::slowQueryThresholdMsecs()
+{
+    static qint64 threshold = [] {
+        bool ok = false;
+        qint64 env = qgetenv("OWNCLOUD_SQL_SLOW_QUERY_MS").toLongLong(&ok);
+        return ok ? env : 200;
+    }();
+    return threshold;
+}
+
 bool SqlDatabase::transaction()
 {
     if (!_db) {
@@ -270,6 +433,7 @@ int SqlQuery::prepare(const QByteArray &sql, bool allow_failure)
         } else {
             ASSERT(_stmt);
             _sqldb->_queries.insert(this);
+            _counters = _sqldb->countersFor(_sql);
         }
     }
     return _errId;
@@ -308,7 +472,7 @@ bool SqlQuery::exec()
     if (!isSelect() && !isPragma()) {
         int rc, n = 0;
         do {
-            rc = sqlite3_step(_stmt);
+            rc = step();
             if (rc == SQLITE_LOCKED) {
                 rc = sqlite3_reset(_stmt); /* This will also return SQLITE_LOCKED */
                 n++;
@@ -340,10 +504,53 @@ bool SqlQuery::exec()
 
 bool SqlQuery::next()
 {
-    SQLITE_DO(sqlite3_step(_stmt));
+    SQLITE_DO(step());
     return _errId == SQLITE_ROW;
 }
 
+int SqlQuery::step()
+{
+    if (!_executing) {
+        _executing = true;
+        _executionNsecs = 0;
+        if (_counters)
+            ++_counters->executions;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    int rc = sqlite3_step(_stmt);
+    _executionNsecs += timer.nsecsElapsed();
+
+    if (rc == SQLITE_ROW) {
+        if (_counters)
+            ++_counters->rows;
+    } else if (rc != SQLITE_BUSY && rc != SQLITE_LOCKED) {
+        // Busy statements are retried, see exec()
+        endExecution();
+    }
+    return rc;
+}
+
+void SqlQuery::endExecution()
+{
+    if (!_executing)
+        return;
+    _executing = false;
+
+    if (_counters) {
+        _counters->totalNsecs += _executionNsecs;
+        qint64 max = _counters->maxNsecs;
+        while (_executionNsecs > max && !_counters->maxNsecs.compare_exchange_weak(max, _executionNsecs)) {
+        }
+    }
+
+    const qint64 thresholdMsecs = SqlDatabase::slowQueryThresholdMsecs();
+    if (thresholdMsecs > 0 && _executionNsecs >= thresholdMsecs * 1000000) {
+        qCInfo(lcSql) << "Slow statement took" << _executionNsecs / 1000000 << "ms:" << _sql;
+    }
+}
+
 void SqlQuery::bindValue(int pos, const QVariant &value)
 {
     qCDebug(lcSql) << "SQL bind" << pos << value;
@@ -411,6 +618,65 @@ void SqlQuery::bindValue(int pos, const QVariant &value)
     ASSERT(res == SQLITE_OK);
 }
 
+void SqlQuery::bindValue(int pos, const QByteArray &value)
+{
+    if (!_stmt) {
+        ASSERT(false);
+        return;
+    }
+
+    if (_boundByteArrays.size() < static_cast<size_t>(pos))
+        _boundByteArrays.resize(pos);
+    // Shares the data with value, it can't change while it is bound
+    _boundByteArrays[pos - 1] = value;
+    const QByteArray &bound = _boundByteArrays[pos - 1];
+    checkBindResult(pos, sqlite3_bind_text(_stmt, pos, bound.constData(), bound.size(), SQLITE_STATIC));
+}
+
+void SqlQuery::bindValue(int pos, const QString &value)
+{
+    if (!_stmt) {
+        ASSERT(false);
+        return;
+    }
+
+    if (value.isNull()) {
+        checkBindResult(pos, sqlite3_bind_null(_stmt, pos));
+        return;
+    }
+    if (_boundStrings.size() < static_cast<size_t>(pos))
+        _boundStrings.resize(pos);
+    _boundStrings[pos - 1] = value;
+    const QString &bound = _boundStrings[pos - 1];
+    checkBindResult(pos, sqlite3_bind_text16(_stmt, pos, bound.utf16(), bound.size() * sizeof(QChar), SQLITE_STATIC));
+}
+
+void SqlQuery::bindInt64(int pos, qint64 value)
+{
+    if (!_stmt) {
+        ASSERT(false);
+        return;
+    }
+    checkBindResult(pos, sqlite3_bind_int64(_stmt, pos, value));
+}
+
+void SqlQuery::checkBindResult(int pos, int res)
+{
+    if (res != SQLITE_OK) {
+        qCWarning(lcSql) << "ERROR binding SQL value at" << pos << "error:" << res;
+    }
+    ASSERT(res == SQLITE_OK);
+}
+
+void SqlQuery::clearBoundStrings()
+{
+    // Keeps the capacity, the same parameters are bound again
+    for (auto &ba : _boundByteArrays)
+        ba.clear();
+    for (auto &str : _boundStrings)
+        str.clear();
+}
+
 bool SqlQuery::nullValue(int index)
 {
     return sqlite3_column_type(_stmt, index) == SQLITE_NULL;
@@ -418,7 +684,9 @@ bool SqlQuery::nullValue(int index)
 
 QString SqlQuery::stringValue(int index)
 {
-    return QString::fromUtf16(static_cast<const ushort *>(sqlite3_column_text16(_stmt, index)));
+    auto data = static_cast<const QChar *>(sqlite3_column_text16(_stmt, index));
+    // bytes16 must be called after text16, see the sqlite docs
+    return QString(data, sqlite3_column_bytes16(_stmt, index) / static_cast<int>(sizeof(QChar)));
 }
 
 int SqlQuery::intValue(int index)
@@ -437,6 +705,12 @@ QByteArray SqlQuery::baValue(int index)
         sqlite3_column_bytes(_stmt, index));
 }
 
+QByteArray SqlQuery::baValueView(int index)
+{
+    return QByteArray::fromRawData(static_cast<const char *>(sqlite3_column_blob(_stmt, index)),
+        sqlite3_column_bytes(_stmt, index));
+}
+
 QString SqlQuery::error() const
 {
     return _error;
@@ -461,8 +735,10 @@ void SqlQuery::finish()
 {
     if (!_stmt)
         return;
+    endExecution();
     SQLITE_DO(sqlite3_finalize(_stmt));
     _stmt = 0;
+    clearBoundStrings();
     if (_sqldb) {
         _sqldb->_queries.remove(this);
     }
@@ -471,8 +747,10 @@ void SqlQuery::finish()
 void SqlQuery::reset_and_clear_bindings()
 {
     if (_stmt) {
+        endExecution();
         SQLITE_DO(sqlite3_reset(_stmt));
         SQLITE_DO(sqlite3_clear_bindings(_stmt));
+        clearBoundStrings();
     }
 }
 
@@ -22,6 +22,13 @@
 #include <QObject>
 #include <QVariant>
 #include <QSet>
+#include <QHash>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QVector>
+
+#include <type_traits>
+#include <vector>
 
 #include "ocsynclib.h"
 
@@ -32,6 +39,18 @@ namespace OCC {
 
 class SqlQuery;
 
+/**
+ * Execution statistics of one statement, see SqlDatabase::statistics()
+ */
+struct OCSYNC_EXPORT SqlQueryStatistics
+{
+    QByteArray sql;
+    quint64 executions = 0;
+    quint64 rows = 0; // rows returned by all executions
+    qint64 totalNsecs = 0; // time spent in sqlite3_step()
+    qint64 maxNsecs = 0; // the slowest execution
+};
+
 /**
  * @brief The SqlDatabase class
  * @ingroup libsync
@@ -45,13 +64,47 @@ public:
 
     bool isOpen();
     bool openOrCreateReadWrite(const QString &filename);
-    bool openReadOnly(const QString &filename);
+    /// Skipping the quick check is only safe for databases another connection checked already.
+    bool openReadOnly(const QString &filename, bool quickCheck = true);
     bool transaction();
     bool commit();
     void close();
     QString error() const;
     sqlite3 *sqliteDb();
 
+    /**
+     * Returns a prepared query for sql, reset and without bindings.
+     *
+     * The statements are kept in a cache keyed by the sql text, which drops
+     * the least recently used statement that isn't running when it grows
+     * beyond its capacity, and on close(). So the query must not be kept
+     * beyond the current operation.
+     *
+     * Returns nullptr if the statement can't be prepared, see error().
+     */
+    SqlQuery *cachedQuery(const QByteArray &sql);
+
+    /**
+     * Resets all cached statements, so that none of them keeps a read
+     * transaction open. Needed before VACUUM and complete checkpoints.
+     */
+    void resetCachedQueries();
+
+    /**
+     * The statistics of the statements executed with this database since it
+     * was created or resetStatistics() was called, sorted by total time.
+     *
+     * May be called from any thread.
+     */
+    QVector<SqlQueryStatistics> statistics() const;
+    void resetStatistics();
+
+    /**
+     * Executions slower than this are logged. Defaults to the value of
+     * OWNCLOUD_SQL_SLOW_QUERY_MS, or 200 ms. 0 disables the logging.
+     */
+    static qint64 slowQueryThresholdMsecs();
+
 private:
     enum class CheckDbResult {
         Ok,
@@ -62,6 +115,8 @@ private:
 
     bool openHelper(const QString &filename, int sqliteFlags);
     CheckDbResult checkDb();
+    void evictCachedQuery();
+    void clearQueryCache();
 
     sqlite3 *_db;
     QString _error; // last error string
@@ -69,6 +124,20 @@ private:
 
     friend class SqlQuery;
     QSet<SqlQuery *> _queries;
+
+    struct CachedQuery
+    {
+        SqlQuery *query;
+        quint64 lastUse;
+    };
+    QHash<QByteArray, CachedQuery> _queryCache;
+    quint64 _queryCacheUses = 0;
+
+    // The counters are shared with the queries, which update them
+    struct StatementCounters;
+    QSharedPointer<StatementCounters> countersFor(const QByteArray &sql);
+    mutable QMutex _statisticsMutex;
+    QHash<QByteArray, QSharedPointer<StatementCounters>> _statistics;
 };
 
 /**
@@ -126,23 +195,56 @@ public:
     int intValue(int index);
     quint64 int64Value(int index);
     QByteArray baValue(int index);
+    /**
+     * Like baValue(), but doesn't copy: the result points into sqlite's
+     * buffer and is only valid until the next call to next(),
+     * reset_and_clear_bindings() or finish(). Don't bind it to a query.
+     */
+    QByteArray baValueView(int index);
     bool isSelect();
     bool isPragma();
     bool exec();
     bool next();
     void bindValue(int pos, const QVariant &value);
+
+    /* Typed bindings. Strings are bound without copying their data, the
+     * query keeps a reference to them until the bindings are cleared. */
+    void bindValue(int pos, const QByteArray &value);
+    void bindValue(int pos, const QString &value);
+    void bindValue(int pos, const char *value) { bindValue(pos, QByteArray(value)); }
+    template <typename T, typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, int>::type = 0>
+    void bindValue(int pos, T value) { bindInt64(pos, static_cast<qint64>(value)); }
+
     QString lastQuery() const;
     int numRowsAffected();
     void reset_and_clear_bindings();
     void finish();
 
 private:
+    friend class SqlDatabase;
+
+    void bindInt64(int pos, qint64 value);
+    void checkBindResult(int pos, int res);
+    void clearBoundStrings();
+
+    // sqlite3_step(), accounting the time in the statistics
+    int step();
+    void endExecution();
+
     SqlDatabase *_sqldb = nullptr;
     sqlite3 *_db = nullptr;
     sqlite3_stmt *_stmt = nullptr;
     QString _error;
     int _errId;
     QByteArray _sql;
+
+    // The strings bound with SQLITE_STATIC, by parameter index - 1
+    std::vector<QByteArray> _boundByteArrays;
+    std::vector<QString> _boundStrings;
+
+    QSharedPointer<SqlDatabase::StatementCounters> _counters;
+    bool _executing = false;
+    qint64 _executionNsecs = 0;
 };
 
 } // namespace OCC
@@ -21,11 +21,14 @@
 #include <QLoggingCategory>
 #include <QStringList>
 #include <QElapsedTimer>
+#include <QTextStream>
 #include <QUrl>
 #include <QDir>
+#include <QThread>
 #include <sqlite3.h>
 
 #include "common/syncjournaldb.h"
+#include "common/syncjournalsnapshot.h"
 #include "version.h"
 #include "filesystembase.h"
 #include "common/asserts.h"
@@ -81,6 +84,159 @@ static QByteArray defaultJournalMode(const QString &dbPath)
     return "WAL";
 }
 
+/* Group commit parameters of the asynchronous writer: a commit happens once
+ * this many writes are queued, or this long after the first of them. */
+static const int asyncWriteBatchSize = 1000;
+static const int asyncWriteIntervalMs = 200;
+/* How often the writer checks whether it was stopped while waiting for the lock */
+static const int asyncWriteLockPollMs = 10;
+
+/* Number of unused read-only connections that are kept open */
+static const size_t maxIdleReadConnections = 4;
+
+/* Number of file records that are committed together during a bulk load */
+static const int bulkLoadTransactionSize = 10000;
+
+/* The secondary indexes of the metadata table, dropped during a bulk load */
+static const struct
+{
+    const char *name;
+    const char *column;
+} metadataIndexes[] = {
+    { "metadata_inode", "inode" },
+    { "metadata_path", "path" },
+    { "metadata_file_id", "fileid" },
+};
+
+/* Databases without incremental auto-vacuum are rebuilt when they are opened
+ * once at least this many pages, and a quarter of the file, are unused */
+static const qint64 rebuildMinimumFreePages = 1024;
+/* Value of PRAGMA auto_vacuum for INCREMENTAL */
+static const qint64 incrementalAutoVacuum = 2;
+/* Pages returned to the file system per incremental vacuum statement */
+static const int incrementalVacuumPages = 256;
+
+namespace {
+struct MaintenanceDeadline
+{
+    QElapsedTimer timer;
+    qint64 budgetMsecs;
+    const std::atomic<bool> *interrupted;
+
+    qint64 remainingMsecs() const { return *interrupted ? 0 : qMax<qint64>(0, budgetMsecs - timer.elapsed()); }
+};
+}
+
+// Called by sqlite during long statements, a non-zero result interrupts them
+static int maintenanceProgressHandler(void *data)
+{
+    return static_cast<const MaintenanceDeadline *>(data)->remainingMsecs() == 0;
+}
+
+class SyncJournalDb::Locker
+{
+public:
+    explicit Locker(SyncJournalDb *journal)
+        : _journal(journal)
+    {
+        // The writes this thread queued must be visible to it. The writer
+        // needs _mutex for them, so this is only possible before locking it.
+        if (_journal->_lockOwner != QThread::currentThreadId())
+            _journal->waitForPendingWrites();
+
+        if (!_journal->_mutex.tryLock()) {
+            QElapsedTimer timer;
+            timer.start();
+            _journal->_mutex.lock();
+            ++_journal->_lockWaits;
+            _journal->_lockWaitNsecs += timer.nsecsElapsed();
+        }
+        _journal->lockAcquired();
+    }
+
+    ~Locker()
+    {
+        _journal->lockReleased();
+        _journal->_mutex.unlock();
+    }
+
+private:
+    Q_DISABLE_COPY(Locker)
+    SyncJournalDb *_journal;
+};
+
+class SyncJournalDb::AsyncWriter : public QThread
+{
+public:
+    explicit AsyncWriter(SyncJournalDb *journal)
+        : _journal(journal)
+    {
+    }
+
+    std::atomic<bool> _stop{ false }; // set with _pendingWritesMutex held
+
+protected:
+    void run() override
+    {
+        QMutexLocker locker(&_journal->_pendingWritesMutex);
+        forever {
+            while (!_stop && _journal->_pendingWrites.isEmpty() && !_journal->_commitRequested)
+                _journal->_pendingWritesCondition.wait(&_journal->_pendingWritesMutex);
+
+            // Wait for more writes, so they share the commit
+            QElapsedTimer timer;
+            timer.start();
+            while (!_stop && !_journal->_flushRequested
+                && _journal->_pendingWrites.size() < asyncWriteBatchSize) {
+                qint64 remaining = asyncWriteIntervalMs - timer.elapsed();
+                if (remaining <= 0
+                    || !_journal->_pendingWritesCondition.wait(&_journal->_pendingWritesMutex, static_cast<unsigned long>(remaining))) {
+                    break;
+                }
+            }
+            if (_stop)
+                return; // the remaining writes are applied by stopAsyncWriter()
+            _journal->_commitRequested = false;
+            _journal->_flushRequested = false;
+            locker.unlock();
+
+            // stopAsyncWriter() may be called by a thread that holds the
+            // lock, as close() is on errors, and then waits for this one
+            if (!lockJournal())
+                return;
+            _journal->applyPendingWrites();
+            if (_journal->_db.isOpen() && !_journal->bulkLoadDefersCommit())
+                _journal->commitInternal(QStringLiteral("async writes"));
+            _journal->lockReleased();
+            _journal->_mutex.unlock();
+
+            locker.relock();
+            _journal->_pendingWritesApplied.wakeAll();
+        }
+    }
+
+private:
+    bool lockJournal()
+    {
+        while (!_journal->_mutex.tryLock(asyncWriteLockPollMs)) {
+            if (_stop)
+                return false;
+        }
+        _journal->lockAcquired();
+        return true;
+    }
+
+    SyncJournalDb *_journal;
+};
+
+/* A read-only connection of the pool used by getCommittedFileRecord() */
+struct SyncJournalDb::ReadConnection
+{
+    SqlDatabase db;
+    SqlQuery getFileRecordQuery;
+    int generation = 0;
+};
+
 SyncJournalDb::SyncJournalDb(const QString &dbFilePath, QObject *parent)
     : QObject(parent)
     , _dbFile(dbFilePath)
@@ -211,7 +367,7 @@ bool SyncJournalDb::maybeMigrateDb(const QString &localPath, const QString &abso
 
 bool SyncJournalDb::exists()
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
     return (!_dbFile.isEmpty() && QFile::exists(_dbFile));
 }
 
@@ -220,20 +376,6 @@ QString SyncJournalDb::databaseFilePath() const
     return _dbFile;
 }
 
-// Note that this does not change the size of the -wal file, but it is supposed to make
-// the normal .db faster since the changes from the wal will be incorporated into it.
-// Then the next sync (and the SocketAPI) will have a faster access.
-void SyncJournalDb::walCheckpoint()
-{
-    QElapsedTimer t;
-    t.start();
-    SqlQuery pragma1(_db);
-    pragma1.prepare("PRAGMA wal_checkpoint(FULL);");
-    if (pragma1.exec()) {
-        qCDebug(lcDb) << "took" << t.elapsed() << "msec";
-    }
-}
-
 void SyncJournalDb::startTransaction()
 {
     if (_transaction == 0) {
@@ -255,6 +397,7 @@ void SyncJournalDb::commitTransaction()
             return;
         }
         _transaction = 0;
+        _bulkLoadUncommittedRecords = 0;
     } else {
         qCDebug(lcDb) << "No database Transaction to commit";
     }
@@ -301,12 +444,47 @@ bool SyncJournalDb::checkConnect()
         qCInfo(lcDb) << "sqlite3 version" << pragma1.stringValue(0);
     }
 
+    // Only has an effect before the first table is created, existing
+    // databases get it with the VACUUM below
+    pragma1.prepare("PRAGMA auto_vacuum = INCREMENTAL;");
+    if (!pragma1.exec()) {
+        return sqlFail("Set PRAGMA auto_vacuum", pragma1);
+    }
+
+    // Rebuilding rewrites the whole file, which is done once here before
+    // the journal is used rather than by a maintenance step holding the
+    // lock in the middle of the session
+    {
+        auto pragmaValue = [this](const char *pragma) -> qint64 {
+            SqlQuery query(_db);
+            query.prepare(pragma);
+            return query.next() ? query.int64Value(0) : -1;
+        };
+        const qint64 freePages = pragmaValue("PRAGMA freelist_count;");
+        if (pragmaValue("PRAGMA auto_vacuum;") != incrementalAutoVacuum && freePages >= rebuildMinimumFreePages
+            && freePages * 4 >= pragmaValue("PRAGMA page_count;")) {
+            qCInfo(lcDb) << "Rebuilding the database with incremental auto-vacuum," << freePages << "pages are unused";
+            QElapsedTimer timer;
+            timer.start();
+            SqlQuery rebuild(_db);
+            rebuild.prepare("VACUUM;");
+            if (rebuild.exec()) {
+                qCInfo(lcDb) << "Rebuilding the database took" << timer.elapsed() << "ms";
+            } else {
+                // Tried again at the next start
+                qCWarning(lcDb) << "Error rebuilding the database:" << rebuild.error();
+            }
+        }
+    }
+
+    bool walMode = false;
     pragma1.prepare("PRAGMA journal_mode=" + _journalMode + ";");
     if (!pragma1.exec()) {
         return sqlFail("Set PRAGMA journal_mode", pragma1);
     } else {
         pragma1.next();
         qCInfo(lcDb) << "sqlite3 journal_mode=" << pragma1.stringValue(0);
+        walMode = pragma1.stringValue(0).compare(QLatin1String("wal"), Qt::CaseInsensitive) == 0;
     }
 
     // For debugging purposes, allow temp_store to be set
@@ -465,6 +643,19 @@ bool SyncJournalDb::checkConnect()
         return sqlFail("Create table conflicts", createQuery);
     }
 
+    // create the checksumcache table, see getCachedChecksum()
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS checksumcache("
+                        "inode INTEGER,"
+                        "checksumTypeId INTEGER,"
+                        "modtime INTEGER(8),"
+                        "filesize INTEGER(8),"
+                        "checksum TEXT,"
+                        "PRIMARY KEY(inode, checksumTypeId)"
+                        ");");
+    if (!createQuery.exec()) {
+        return sqlFail("Create table checksumcache", createQuery);
+    }
+
     createQuery.prepare("CREATE TABLE IF NOT EXISTS version("
                         "major INTEGER(8),"
                         "minor INTEGER(8),"
@@ -545,26 +736,6 @@ bool SyncJournalDb::checkConnect()
     if (forceRemoteDiscovery) {
         forceRemoteDiscoveryNextSyncLocked();
     }
-    if (!_deleteDownloadInfoQuery.initOrReset("DELETE FROM downloadinfo WHERE path=?1", _db)) {
-        return sqlFail("prepare _deleteDownloadInfoQuery", _deleteDownloadInfoQuery);
-    }
-
-
-    if (!_deleteUploadInfoQuery.initOrReset("DELETE FROM uploadinfo WHERE path=?1", _db)) {
-        return sqlFail("prepare _deleteUploadInfoQuery", _deleteUploadInfoQuery);
-    }
-
-    QByteArray sql("SELECT lastTryEtag, lastTryModtime, retrycount, errorstring, lastTryTime, ignoreDuration, renameTarget, errorCategory "
-                   "FROM blacklist WHERE path=?1");
-    if (Utility::fsCasePreserving()) {
-        // if the file system is case preserving we have to check the blacklist
-        // case insensitively
-        sql += " COLLATE NOCASE";
-    }
-    if (!_getErrorBlacklistQuery.initOrReset(sql, _db)) {
-        return sqlFail("prepare _getErrorBlacklistQuery", _getErrorBlacklistQuery);
-    }
-
     // don't start a new transaction now
     commitInternal(QString("checkConnect End"), false);
 
@@ -578,18 +749,30 @@ bool SyncJournalDb::checkConnect()
     FileSystem::setFileHidden(databaseFilePath() + "-shm", true);
     FileSystem::setFileHidden(databaseFilePath() + "-journal", true);
 
+    // Only in WAL mode readers don't block and aren't blocked by the writer
+    if (rc && walMode) {
+        QMutexLocker locker(&_readConnectionsMutex);
+        _readConnectionsAvailable = true;
+    }
+
     return rc;
 }
 
 void SyncJournalDb::close()
 {
-    QMutexLocker locker(&_mutex);
+    stopAsyncWriter();
+    closeReadConnections();
+
+    Locker locker(this);
+    applyPendingWrites();
     qCInfo(lcDb) << "Closing DB" << _dbFile;
 
+    finishBulkLoadLocked();
     commitTransaction();
     _db.close();
     clearEtagStorageFilter();
     _metadataTableIsEmpty = false;
+    _metadataSnapshot.reset();
 }
 
 
@@ -666,6 +849,17 @@ bool SyncJournalDb::updateMetadataTableStructure()
         commitInternal("update database structure: add path index");
     }
 
+    if (1) {
+        // Missing if a bulk load was interrupted
+        SqlQuery query(_db);
+        query.prepare("CREATE INDEX IF NOT EXISTS metadata_file_id ON metadata(fileid);");
+        if (!query.exec()) {
+            sqlFail("updateMetadataTableStructure: create index fileid", query);
+            re = false;
+        }
+        commitInternal("update database structure: add fileid index");
+    }
+
     if (columns.indexOf("ignoredChildrenRemote") == -1) {
         SqlQuery query(_db);
         query.prepare("ALTER TABLE metadata ADD COLUMN ignoredChildrenRemote INT;");
@@ -794,10 +988,20 @@ qint64 SyncJournalDb::getPHash(const QByteArray &file)
     return h;
 }
 
-bool SyncJournalDb::setFileRecord(const SyncJournalFileRecord &_record)
+bool SyncJournalDb::setFileRecord(const SyncJournalFileRecord &record)
+{
+    if (enqueueWrite([this, record] { return setFileRecordLocked(record); }))
+        return true;
+
+    Locker locker(this);
+    applyPendingWrites();
+    return setFileRecordLocked(record);
+}
+
+bool SyncJournalDb::setFileRecordLocked(const SyncJournalFileRecord &_record)
 {
     SyncJournalFileRecord record = _record;
-    QMutexLocker locker(&_mutex);
+    _metadataSnapshot.reset();
 
     if (!_etagStorageFilter.isEmpty()) {
         // If we are a directory that should not be read from db next time, don't write the etag
@@ -831,36 +1035,39 @@ bool SyncJournalDb::setFileRecord(const SyncJournalFileRecord &_record)
         parseChecksumHeader(record._checksumHeader, &checksumType, &checksum);
         int contentChecksumTypeId = mapChecksumType(checksumType);
 
-        if (!_setFileRecordQuery.initOrReset(QByteArrayLiteral(
+        auto query = _db.cachedQuery(QByteArrayLiteral(
             "INSERT OR REPLACE INTO metadata "
             "(phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize, ignoredChildrenRemote, contentChecksum, contentChecksumTypeId) "
-            "VALUES (?1 , ?2, ?3 , ?4 , ?5 , ?6 , ?7,  ?8 , ?9 , ?10, ?11, ?12, ?13, ?14, ?15, ?16);"), _db)) {
+            "VALUES (?1 , ?2, ?3 , ?4 , ?5 , ?6 , ?7,  ?8 , ?9 , ?10, ?11, ?12, ?13, ?14, ?15, ?16);"));
+        if (!query) {
             return false;
         }
 
-        _setFileRecordQuery.bindValue(1, phash);
-        _setFileRecordQuery.bindValue(2, plen);
-        _setFileRecordQuery.bindValue(3, record._path);
-        _setFileRecordQuery.bindValue(4, record._inode);
-        _setFileRecordQuery.bindValue(5, 0); // uid Not used
-        _setFileRecordQuery.bindValue(6, 0); // gid Not used
-        _setFileRecordQuery.bindValue(7, 0); // mode Not used
-        _setFileRecordQuery.bindValue(8, record._modtime);
-        _setFileRecordQuery.bindValue(9, record._type);
-        _setFileRecordQuery.bindValue(10, etag);
-        _setFileRecordQuery.bindValue(11, fileId);
-        _setFileRecordQuery.bindValue(12, remotePerm);
-        _setFileRecordQuery.bindValue(13, record._fileSize);
-        _setFileRecordQuery.bindValue(14, record._serverHasIgnoredFiles ? 1 : 0);
-        _setFileRecordQuery.bindValue(15, checksum);
-        _setFileRecordQuery.bindValue(16, contentChecksumTypeId);
-
-        if (!_setFileRecordQuery.exec()) {
+        query->bindValue(1, phash);
+        query->bindValue(2, plen);
+        query->bindValue(3, record._path);
+        query->bindValue(4, record._inode);
+        query->bindValue(5, 0); // uid Not used
+        query->bindValue(6, 0); // gid Not used
+        query->bindValue(7, 0); // mode Not used
+        query->bindValue(8, record._modtime);
+        query->bindValue(9, record._type);
+        query->bindValue(10, etag);
+        query->bindValue(11, fileId);
+        query->bindValue(12, remotePerm);
+        query->bindValue(13, record._fileSize);
+        query->bindValue(14, record._serverHasIgnoredFiles ? 1 : 0);
+        query->bindValue(15, checksum);
+        query->bindValue(16, contentChecksumTypeId);
+
+        if (!query->exec()) {
             return false;
         }
 
         // Can't be true anymore.
         _metadataTableIsEmpty = false;
+        if (_bulkLoad)
+            ++_bulkLoadUncommittedRecords;
 
         return true;
     } else {
@@ -871,26 +1078,30 @@ bool SyncJournalDb::setFileRecord(const SyncJournalFileRecord &_record)
 
 bool SyncJournalDb::deleteFileRecord(const QString &filename, bool recursively)
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
+    _metadataSnapshot.reset();
 
     if (checkConnect()) {
         // if (!recursively) {
         // always delete the actual file.
 
-        if (!_deleteFileRecordPhash.initOrReset(QByteArrayLiteral("DELETE FROM metadata WHERE phash=?1"), _db))
+        auto query = _db.cachedQuery(QByteArrayLiteral("DELETE FROM metadata WHERE phash=?1"));
+        if (!query)
             return false;
 
         qlonglong phash = getPHash(filename.toUtf8());
-        _deleteFileRecordPhash.bindValue(1, phash);
+        query->bindValue(1, phash);
 
-        if (!_deleteFileRecordPhash.exec())
+        if (!query->exec())
             return false;
 
         if (recursively) {
-            if (!_deleteFileRecordRecursively.initOrReset(QByteArrayLiteral("DELETE FROM metadata WHERE " IS_PREFIX_PATH_OF("?1", "path")), _db))
+            query = _db.cachedQuery(QByteArrayLiteral("DELETE FROM metadata WHERE " IS_PREFIX_PATH_OF("?1", "path")));
+            if (!query)
                 return false;
-            _deleteFileRecordRecursively.bindValue(1, filename);
-            if (!_deleteFileRecordRecursively.exec()) {
+            query->bindValue(1, filename);
+            if (!query->exec()) {
                 return false;
             }
         }
@@ -904,7 +1115,8 @@ bool SyncJournalDb::deleteFileRecord(const QString &filename, bool recursively)
 
 bool SyncJournalDb::getFileRecord(const QByteArray &filename, SyncJournalFileRecord *rec)
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
 
     // Reset the output var in case the caller is reusing it.
     Q_ASSERT(rec);
@@ -914,26 +1126,33 @@ bool SyncJournalDb::getFileRecord(const QByteArray &filename, SyncJournalFileRec
     if (_metadataTableIsEmpty)
         return true; // no error, yet nothing found (rec->isValid() == false)
 
+    if (auto snapshot = _metadataSnapshot) {
+        if (!filename.isEmpty())
+            snapshot->getFileRecord(filename, rec);
+        return true;
+    }
+
     if (!checkConnect())
         return false;
 
     if (!filename.isEmpty()) {
-        if (!_getFileRecordQuery.initOrReset(QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE phash=?1"), _db))
+        auto query = _db.cachedQuery(QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE phash=?1"));
+        if (!query)
             return false;
 
-        _getFileRecordQuery.bindValue(1, getPHash(filename));
+        query->bindValue(1, getPHash(filename));
 
-        if (!_getFileRecordQuery.exec()) {
+        if (!query->exec()) {
             close();
             return false;
         }
 
-        if (_getFileRecordQuery.next()) {
-            fillFileRecordFromGetQuery(*rec, _getFileRecordQuery);
+        if (query->next()) {
+            fillFileRecordFromGetQuery(*rec, *query);
         } else {
-            int errId = _getFileRecordQuery.errorId();
+            int errId = query->errorId();
             if (errId != SQLITE_DONE) { // only do this if the problem is different from SQLITE_DONE
-                QString err = _getFileRecordQuery.error();
+                QString err = query->error();
                 qCWarning(lcDb) << "No journal entry found for " << filename << "Error: " << err;
                 close();
             }
@@ -942,9 +1161,92 @@ bool SyncJournalDb::getFileRecord(const QByteArray &filename, SyncJournalFileRec
     return true;
 }
 
+bool SyncJournalDb::getCommittedFileRecord(const QByteArray &filename, SyncJournalFileRecord *rec)
+{
+    auto connection = takeReadConnection();
+    if (!connection)
+        return getFileRecord(filename, rec);
+
+    // Reset the output var in case the caller is reusing it.
+    Q_ASSERT(rec);
+    rec->_path.clear();
+    Q_ASSERT(!rec->isValid());
+
+    if (!filename.isEmpty()) {
+        auto &query = connection->getFileRecordQuery;
+        if (!query.initOrReset(QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE phash=?1"), connection->db))
+            return getFileRecord(filename, rec);
+
+        query.bindValue(1, getPHash(filename));
+        if (!query.exec())
+            return getFileRecord(filename, rec);
+
+        if (query.next()) {
+            fillFileRecordFromGetQuery(*rec, query);
+        } else if (query.errorId() != SQLITE_DONE) {
+            qCWarning(lcDb) << "Reading the record of" << filename << "without the lock failed:" << query.error();
+            return getFileRecord(filename, rec);
+        }
+
+        // Ends the read transaction, which would prevent checkpoints
+        query.reset_and_clear_bindings();
+    }
+
+    returnReadConnection(std::move(connection));
+    return true;
+}
+
+std::unique_ptr<SyncJournalDb::ReadConnection> SyncJournalDb::takeReadConnection()
+{
+    int generation = 0;
+    {
+        QMutexLocker locker(&_readConnectionsMutex);
+        if (!_readConnectionsAvailable)
+            return nullptr;
+        if (!_readConnections.empty()) {
+            auto connection = std::move(_readConnections.back());
+            _readConnections.pop_back();
+            return connection;
+        }
+        generation = _readConnectionsGeneration;
+    }
+
+    // The main connection verified the database already
+    std::unique_ptr<ReadConnection> connection(new ReadConnection);
+    if (!connection->db.openReadOnly(_dbFile, /*quickCheck=*/false)) {
+        qCWarning(lcDb) << "Could not open a read-only connection to" << _dbFile << connection->db.error();
+        return nullptr;
+    }
+    connection->generation = generation;
+    return connection;
+}
+
+void SyncJournalDb::returnReadConnection(std::unique_ptr<ReadConnection> connection)
+{
+    QMutexLocker locker(&_readConnectionsMutex);
+    // Don't keep connections opened before close(), the file may be replaced
+    if (connection->generation != _readConnectionsGeneration
+        || _readConnections.size() >= maxIdleReadConnections) {
+        return;
+    }
+    _readConnections.push_back(std::move(connection));
+}
+
+void SyncJournalDb::closeReadConnections()
+{
+    std::vector<std::unique_ptr<ReadConnection>> connections;
+    {
+        QMutexLocker locker(&_readConnectionsMutex);
+        _readConnectionsAvailable = false;
+        ++_readConnectionsGeneration;
+        connections.swap(_readConnections);
+    }
+}
+
 bool SyncJournalDb::getFileRecordByInode(quint64 inode, SyncJournalFileRecord *rec)
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
 
     // Reset the output var in case the caller is reusing it.
     Q_ASSERT(rec);
@@ -954,44 +1256,57 @@ bool SyncJournalDb::getFileRecordByInode(quint64 inode, SyncJournalFileRecord *r
     if (!inode || _metadataTableIsEmpty)
         return true; // no error, yet nothing found (rec->isValid() == false)
 
+    if (auto snapshot = _metadataSnapshot) {
+        snapshot->getFileRecordByInode(inode, rec);
+        return true;
+    }
+
     if (!checkConnect())
         return false;
 
-    if (!_getFileRecordQueryByInode.initOrReset(QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE inode=?1"), _db))
+    auto query = _db.cachedQuery(QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE inode=?1"));
+    if (!query)
         return false;
 
-    _getFileRecordQueryByInode.bindValue(1, inode);
+    query->bindValue(1, inode);
 
-    if (!_getFileRecordQueryByInode.exec())
+    if (!query->exec())
         return false;
 
-    if (_getFileRecordQueryByInode.next())
-        fillFileRecordFromGetQuery(*rec, _getFileRecordQueryByInode);
+    if (query->next())
+        fillFileRecordFromGetQuery(*rec, *query);
 
     return true;
 }
 
 bool SyncJournalDb::getFileRecordsByFileId(const QByteArray &fileId, const std::function<void(const SyncJournalFileRecord &)> &rowCallback)
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
 
     if (fileId.isEmpty() || _metadataTableIsEmpty)
         return true; // no error, yet nothing found (rec->isValid() == false)
 
+    if (auto snapshot = _metadataSnapshot) {
+        snapshot->getFileRecordsByFileId(fileId, rowCallback);
+        return true;
+    }
+
     if (!checkConnect())
         return false;
 
-    if (!_getFileRecordQueryByFileId.initOrReset(QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE fileid=?1"), _db))
+    auto query = _db.cachedQuery(QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE fileid=?1"));
+    if (!query)
         return false;
 
-    _getFileRecordQueryByFileId.bindValue(1, fileId);
+    query->bindValue(1, fileId);
 
-    if (!_getFileRecordQueryByFileId.exec())
+    if (!query->exec())
         return false;
 
-    while (_getFileRecordQueryByFileId.next()) {
+    while (query->next()) {
         SyncJournalFileRecord rec;
-        fillFileRecordFromGetQuery(rec, _getFileRecordQueryByFileId);
+        fillFileRecordFromGetQuery(rec, *query);
         rowCallback(rec);
     }
 
@@ -1000,11 +1315,17 @@ bool SyncJournalDb::getFileRecordsByFileId(const QByteArray &fileId, const std::
 
 bool SyncJournalDb::getFilesBelowPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord&)> &rowCallback)
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
 
     if (_metadataTableIsEmpty)
         return true; // no error, yet nothing found
 
+    if (auto snapshot = _metadataSnapshot) {
+        snapshot->getFilesBelowPath(path, rowCallback);
+        return true;
+    }
+
     if (!checkConnect())
         return false;
 
@@ -1016,13 +1337,13 @@ bool SyncJournalDb::getFilesBelowPath(const QByteArray &path, const std::functio
         // and find nothing. So, unfortunately, we have to use a different query for
         // retrieving the whole tree.
 
-        if (!_getAllFilesQuery.initOrReset(QByteArrayLiteral( GET_FILE_RECORD_QUERY " ORDER BY path||'/' ASC"), _db))
+        query = _db.cachedQuery(QByteArrayLiteral(GET_FILE_RECORD_QUERY " ORDER BY path||'/' ASC"));
+        if (!query)
             return false;
-        query = &_getAllFilesQuery;
     } else {
         // This query is used to skip discovery and fill the tree from the
         // database instead
-        if (!_getFilesBelowPathQuery.initOrReset(QByteArrayLiteral(
+        query = _db.cachedQuery(QByteArrayLiteral(
                 GET_FILE_RECORD_QUERY
                 " WHERE " IS_PREFIX_PATH_OF("?1", "path")
                 // We want to ensure that the contents of a directory are sorted
@@ -1030,10 +1351,59 @@ bool SyncJournalDb::getFilesBelowPath(const QByteArray &path, const std::functio
                 // an ordering like foo, foo-2, foo/file would be returned.
                 // With the trailing /, we get foo-2, foo, foo/file. This property
                 // is used in fill_tree_from_db().
-                " ORDER BY path||'/' ASC"), _db)) {
+                " ORDER BY path||'/' ASC"));
+        if (!query) {
+            return false;
+        }
+        query->bindValue(1, path);
+    }
+
+    if (!query->exec()) {
+        return false;
+    }
+
+    while (query->next()) {
+        SyncJournalFileRecord rec;
+        fillFileRecordFromGetQuery(rec, *query);
+        rowCallback(rec);
+    }
+
+    return true;
+}
+
+bool SyncJournalDb::getFilesInDirectory(const QByteArray &path, const std::function<void(const SyncJournalFileRecord &)> &rowCallback)
+{
+    Locker locker(this);
+    applyPendingWrites();
+
+    if (_metadataTableIsEmpty)
+        return true; // no error, yet nothing found
+
+    if (auto snapshot = _metadataSnapshot) {
+        snapshot->getFilesInDirectory(path, rowCallback);
+        return true;
+    }
+
+    if (!checkConnect())
+        return false;
+
+    // The entries deeper down in the tree are filtered out with LIKE, instr()
+    // is not available in old sqlite versions.
+    SqlQuery *query = nullptr;
+    if (path.isEmpty()) {
+        query = _db.cachedQuery(QByteArrayLiteral(
+                GET_FILE_RECORD_QUERY " WHERE path NOT LIKE '%/%'"));
+        if (!query) {
+            return false;
+        }
+    } else {
+        query = _db.cachedQuery(QByteArrayLiteral(
+                GET_FILE_RECORD_QUERY
+                " WHERE " IS_PREFIX_PATH_OF("?1", "path")
+                " AND substr(path, length(?1) + 2) NOT LIKE '%/%'"));
+        if (!query) {
             return false;
         }
-        query = &_getFilesBelowPathQuery;
         query->bindValue(1, path);
     }
 
@@ -1050,10 +1420,43 @@ bool SyncJournalDb::getFilesBelowPath(const QByteArray &path, const std::functio
     return true;
 }
 
+bool SyncJournalDb::createMetadataSnapshot()
+{
+    Locker locker(this);
+    applyPendingWrites();
+
+    if (!checkConnect())
+        return false;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    _metadataSnapshot.reset();
+    auto snapshot = std::make_shared<SyncJournalSnapshot>();
+    if (!getFilesBelowPath(QByteArray(), [&snapshot](const SyncJournalFileRecord &rec) { snapshot->append(rec); })) {
+        qCWarning(lcDb) << "Could not read the metadata table for the snapshot";
+        return false;
+    }
+    snapshot->build();
+    _metadataSnapshot = snapshot;
+
+    qCInfo(lcDb) << "Metadata snapshot with" << snapshot->size() << "entries took" << timer.elapsed() << "msec";
+    return true;
+}
+
+void SyncJournalDb::dropMetadataSnapshot()
+{
+    Locker locker(this);
+    applyPendingWrites();
+    _metadataSnapshot.reset();
+}
+
 bool SyncJournalDb::postSyncCleanup(const QSet<QString> &filepathsToKeep,
     const QSet<QString> &prefixesToKeep)
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
+    _metadataSnapshot.reset();
 
     if (!checkConnect()) {
         return false;
@@ -1069,7 +1472,7 @@ bool SyncJournalDb::postSyncCleanup(const QSet<QString> &filepathsToKeep,
     QByteArrayList superfluousItems;
 
     while (query.next()) {
-        const QString file = query.baValue(1);
+        const QString file = query.baValueView(1);
         bool keep = filepathsToKeep.contains(file);
         if (!keep) {
             foreach (const QString &prefix, prefixesToKeep) {
@@ -1094,15 +1497,21 @@ bool SyncJournalDb::postSyncCleanup(const QSet<QString> &filepathsToKeep,
         }
     }
 
-    // Incorporate results back into main DB
-    walCheckpoint();
+    // Drop the cached checksums of files that are gone
+    auto cacheQuery = _db.cachedQuery(QByteArrayLiteral(
+        "DELETE FROM checksumcache WHERE inode NOT IN (SELECT inode FROM metadata WHERE inode IS NOT NULL)"));
+    if (!cacheQuery || !cacheQuery->exec()) {
+        return false;
+    }
 
+    // The changes are incorporated into the main DB by performMaintenance()
     return true;
 }
 
 int SyncJournalDb::getFileRecordCount()
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
 
     SqlQuery query(_db);
     query.prepare("SELECT COUNT(*) FROM metadata");
@@ -1123,7 +1532,9 @@ bool SyncJournalDb::updateFileRecordChecksum(const QString &filename,
     const QByteArray &contentChecksum,
     const QByteArray &contentChecksumType)
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
+    _metadataSnapshot.reset();
 
     qCInfo(lcDb) << "Updating file checksum" << filename << contentChecksum << contentChecksumType;
 
@@ -1135,23 +1546,26 @@ bool SyncJournalDb::updateFileRecordChecksum(const QString &filename,
 
     int checksumTypeId = mapChecksumType(contentChecksumType);
 
-    if (!_setFileRecordChecksumQuery.initOrReset(QByteArrayLiteral(
+    auto query = _db.cachedQuery(QByteArrayLiteral(
             "UPDATE metadata"
             " SET contentChecksum = ?2, contentChecksumTypeId = ?3"
-            " WHERE phash == ?1;"), _db)) {
+            " WHERE phash == ?1;"));
+    if (!query) {
         return false;
     }
-    _setFileRecordChecksumQuery.bindValue(1, phash);
-    _setFileRecordChecksumQuery.bindValue(2, contentChecksum);
-    _setFileRecordChecksumQuery.bindValue(3, checksumTypeId);
-    return _setFileRecordChecksumQuery.exec();
+    query->bindValue(1, phash);
+    query->bindValue(2, contentChecksum);
+    query->bindValue(3, checksumTypeId);
+    return query->exec();
 }
 
 bool SyncJournalDb::updateLocalMetadata(const QString &filename,
     qint64 modtime, quint64 size, quint64 inode)
 
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
+    _metadataSnapshot.reset();
 
     qCInfo(lcDb) << "Updating local metadata for:" << filename << modtime << size << inode;
 
@@ -1162,18 +1576,19 @@ bool SyncJournalDb::updateLocalMetadata(const QString &filename,
     }
 
 
-    if (!_setFileRecordLocalMetadataQuery.initOrReset(QByteArrayLiteral(
+    auto query = _db.cachedQuery(QByteArrayLiteral(
             "UPDATE metadata"
             " SET inode=?2, modtime=?3, filesize=?4"
-            " WHERE phash == ?1;"), _db)) {
+            " WHERE phash == ?1;"));
+    if (!query) {
         return false;
     }
 
-    _setFileRecordLocalMetadataQuery.bindValue(1, phash);
-    _setFileRecordLocalMetadataQuery.bindValue(2, inode);
-    _setFileRecordLocalMetadataQuery.bindValue(3, modtime);
-    _setFileRecordLocalMetadataQuery.bindValue(4, size);
-    return _setFileRecordLocalMetadataQuery.exec();
+    query->bindValue(1, phash);
+    query->bindValue(2, inode);
+    query->bindValue(3, modtime);
+    query->bindValue(4, size);
+    return query->exec();
 }
 
 bool SyncJournalDb::setFileRecordMetadata(const SyncJournalFileRecord &record)
@@ -1208,45 +1623,29 @@ static void toDownloadInfo(SqlQuery &query, SyncJournalDb::DownloadInfo *res)
     res->_valid = ok;
 }
 
-static bool deleteBatch(SqlQuery &query, const QStringList &entries, const QString &name)
-{
-    if (entries.isEmpty())
-        return true;
-
-    qCDebug(lcDb) << "Removing stale " << qPrintable(name) << " entries: " << entries.join(", ");
-    // FIXME: Was ported from execBatch, check if correct!
-    foreach (const QString &entry, entries) {
-        query.reset_and_clear_bindings();
-        query.bindValue(1, entry);
-        if (!query.exec()) {
-            return false;
-        }
-    }
-
-    return true;
-}
-
 SyncJournalDb::DownloadInfo SyncJournalDb::getDownloadInfo(const QString &file)
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
 
     DownloadInfo res;
 
     if (checkConnect()) {
 
-        if (!_getDownloadInfoQuery.initOrReset(QByteArrayLiteral(
-                "SELECT tmpfile, etag, errorcount FROM downloadinfo WHERE path=?1"), _db)) {
+        auto query = _db.cachedQuery(QByteArrayLiteral(
+                "SELECT tmpfile, etag, errorcount FROM downloadinfo WHERE path=?1"));
+        if (!query) {
             return res;
         }
 
-        _getDownloadInfoQuery.bindValue(1, file);
+        query->bindValue(1, file);
 
-        if (!_getDownloadInfoQuery.exec()) {
+        if (!query->exec()) {
             return res;
         }
 
-        if (_getDownloadInfoQuery.next()) {
-            toDownloadInfo(_getDownloadInfoQuery, &res);
+        if (query->next()) {
+            toDownloadInfo(*query, &res);
         } else {
             res._valid = false;
         }
@@ -1256,73 +1655,118 @@ SyncJournalDb::DownloadInfo SyncJournalDb::getDownloadInfo(const QString &file)
 
 void SyncJournalDb::setDownloadInfo(const QString &file, const SyncJournalDb::DownloadInfo &i)
 {
-    QMutexLocker locker(&_mutex);
+    if (enqueueWrite([this, file, i] { setDownloadInfoLocked(file, i); return true; }))
+        return;
+
+    Locker locker(this);
+    applyPendingWrites();
+    setDownloadInfoLocked(file, i);
+}
 
+void SyncJournalDb::setDownloadInfoLocked(const QString &file, const SyncJournalDb::DownloadInfo &i)
+{
     if (!checkConnect()) {
         return;
     }
 
 
     if (i._valid) {
-        if (!_setDownloadInfoQuery.initOrReset(QByteArrayLiteral(
+        auto query = _db.cachedQuery(QByteArrayLiteral(
                 "INSERT OR REPLACE INTO downloadinfo "
                 "(path, tmpfile, etag, errorcount) "
-                "VALUES ( ?1 , ?2, ?3, ?4 )"), _db)) {
+                "VALUES ( ?1 , ?2, ?3, ?4 )"));
+        if (!query) {
             return;
         }
-        _setDownloadInfoQuery.bindValue(1, file);
-        _setDownloadInfoQuery.bindValue(2, i._tmpfile);
-        _setDownloadInfoQuery.bindValue(3, i._etag);
-        _setDownloadInfoQuery.bindValue(4, i._errorCount);
-        _setDownloadInfoQuery.exec();
+        query->bindValue(1, file);
+        query->bindValue(2, i._tmpfile);
+        query->bindValue(3, i._etag);
+        query->bindValue(4, i._errorCount);
+        query->exec();
     } else {
-        _deleteDownloadInfoQuery.reset_and_clear_bindings();
-        _deleteDownloadInfoQuery.bindValue(1, file);
-        _deleteDownloadInfoQuery.exec();
+        auto query = _db.cachedQuery(QByteArrayLiteral("DELETE FROM downloadinfo WHERE path=?1"));
+        if (!query) {
+            return;
+        }
+        query->bindValue(1, file);
+        query->exec();
     }
 }
 
-QVector<SyncJournalDb::DownloadInfo> SyncJournalDb::getAndDeleteStaleDownloadInfos(const QSet<QString> &keep)
+bool SyncJournalDb::fillKeepPaths(const QVector<QString> &keep)
 {
-    QVector<SyncJournalDb::DownloadInfo> empty_result;
-    QMutexLocker locker(&_mutex);
+    SqlQuery createQuery(_db);
+    createQuery.prepare("CREATE TEMP TABLE IF NOT EXISTS keep_paths(path TEXT PRIMARY KEY);");
+    if (!createQuery.exec()) {
+        return false;
+    }
 
-    if (!checkConnect()) {
-        return empty_result;
+    auto query = _db.cachedQuery(QByteArrayLiteral("DELETE FROM temp.keep_paths"));
+    if (!query || !query->exec()) {
+        return false;
+    }
+    query = _db.cachedQuery(QByteArrayLiteral("INSERT OR IGNORE INTO temp.keep_paths (path) VALUES (?1)"));
+    if (!query) {
+        return false;
     }
+    for (const auto &path : keep) {
+        query->reset_and_clear_bindings();
+        query->bindValue(1, path);
+        if (!query->exec()) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    SqlQuery query(_db);
-    // The selected values *must* match the ones expected by toDownloadInfo().
-    query.prepare("SELECT tmpfile, etag, errorcount, path FROM downloadinfo");
+void SyncJournalDb::clearKeepPaths()
+{
+    if (auto query = _db.cachedQuery(QByteArrayLiteral("DELETE FROM temp.keep_paths")))
+        query->exec();
+}
 
-    if (!query.exec()) {
+QVector<SyncJournalDb::DownloadInfo> SyncJournalDb::getAndDeleteStaleDownloadInfos(const QVector<QString> &keep)
+{
+    QVector<SyncJournalDb::DownloadInfo> empty_result;
+    Locker locker(this);
+    applyPendingWrites();
+
+    if (!checkConnect() || !fillKeepPaths(keep)) {
         return empty_result;
     }
 
-    QStringList superfluousPaths;
     QVector<SyncJournalDb::DownloadInfo> deleted_entries;
-
-    while (query.next()) {
-        const QString file = query.stringValue(3); // path
-        if (!keep.contains(file)) {
-            superfluousPaths.append(file);
+    {
+        // The selected values *must* match the ones expected by toDownloadInfo().
+        auto query = _db.cachedQuery(QByteArrayLiteral(
+            "SELECT tmpfile, etag, errorcount FROM downloadinfo "
+            "WHERE path NOT IN (SELECT path FROM temp.keep_paths)"));
+        if (!query || !query->exec()) {
+            return empty_result;
+        }
+        while (query->next()) {
             DownloadInfo info;
-            toDownloadInfo(query, &info);
+            toDownloadInfo(*query, &info);
             deleted_entries.append(info);
         }
     }
 
-    if (!deleteBatch(_deleteDownloadInfoQuery, superfluousPaths, "downloadinfo"))
-        return empty_result;
-
-    return deleted_entries;
+    auto deleteQuery = _db.cachedQuery(QByteArrayLiteral(
+        "DELETE FROM downloadinfo WHERE path NOT IN (SELECT path FROM temp.keep_paths)"));
+    bool ok = deleteQuery && deleteQuery->exec();
+    if (ok && !deleted_entries.isEmpty()) {
+        qCDebug(lcDb) << "Removed" << deleteQuery->numRowsAffected() << "stale downloadinfo entries";
+    }
+    clearKeepPaths();
+    return ok ? deleted_entries : empty_result;
 }
 
 int SyncJournalDb::downloadInfoCount()
 {
     int re = 0;
 
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
     if (checkConnect()) {
         SqlQuery query("SELECT count(*) FROM downloadinfo", _db);
 
@@ -1338,30 +1782,32 @@ int SyncJournalDb::downloadInfoCount()
 
 SyncJournalDb::UploadInfo SyncJournalDb::getUploadInfo(const QString &file)
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
 
     UploadInfo res;
 
     if (checkConnect()) {
-        if (!_getUploadInfoQuery.initOrReset(QByteArrayLiteral(
+        auto query = _db.cachedQuery(QByteArrayLiteral(
                 "SELECT chunk, transferid, errorcount, size, modtime, contentChecksum FROM "
-                "uploadinfo WHERE path=?1"), _db)) {
+                "uploadinfo WHERE path=?1"));
+        if (!query) {
             return res;
         }
-        _getUploadInfoQuery.bindValue(1, file);
+        query->bindValue(1, file);
 
-        if (!_getUploadInfoQuery.exec()) {
+        if (!query->exec()) {
             return res;
         }
 
-        if (_getUploadInfoQuery.next()) {
+        if (query->next()) {
             bool ok = true;
-            res._chunk = _getUploadInfoQuery.intValue(0);
-            res._transferid = _getUploadInfoQuery.intValue(1);
-            res._errorCount = _getUploadInfoQuery.intValue(2);
-            res._size = _getUploadInfoQuery.int64Value(3);
-            res._modtime = _getUploadInfoQuery.int64Value(4);
-            res._contentChecksum = _getUploadInfoQuery.baValue(5);
+            res._chunk = query->intValue(0);
+            res._transferid = query->intValue(1);
+            res._errorCount = query->intValue(2);
+            res._size = query->int64Value(3);
+            res._modtime = query->int64Value(4);
+            res._contentChecksum = query->baValue(5);
             res._valid = ok;
         }
     }
@@ -1370,74 +1816,87 @@ SyncJournalDb::UploadInfo SyncJournalDb::getUploadInfo(const QString &file)
 
 void SyncJournalDb::setUploadInfo(const QString &file, const SyncJournalDb::UploadInfo &i)
 {
-    QMutexLocker locker(&_mutex);
+    if (enqueueWrite([this, file, i] { setUploadInfoLocked(file, i); return true; }))
+        return;
+
+    Locker locker(this);
+    applyPendingWrites();
+    setUploadInfoLocked(file, i);
+}
 
+void SyncJournalDb::setUploadInfoLocked(const QString &file, const SyncJournalDb::UploadInfo &i)
+{
     if (!checkConnect()) {
         return;
     }
 
     if (i._valid) {
-        if (!_setUploadInfoQuery.initOrReset(QByteArrayLiteral(
+        auto query = _db.cachedQuery(QByteArrayLiteral(
             "INSERT OR REPLACE INTO uploadinfo "
             "(path, chunk, transferid, errorcount, size, modtime, contentChecksum) "
-            "VALUES ( ?1 , ?2, ?3 , ?4 ,  ?5, ?6 , ?7 )"), _db)) {
+            "VALUES ( ?1 , ?2, ?3 , ?4 ,  ?5, ?6 , ?7 )"));
+        if (!query) {
             return;
         }
 
-        _setUploadInfoQuery.bindValue(1, file);
-        _setUploadInfoQuery.bindValue(2, i._chunk);
-        _setUploadInfoQuery.bindValue(3, i._transferid);
-        _setUploadInfoQuery.bindValue(4, i._errorCount);
-        _setUploadInfoQuery.bindValue(5, i._size);
-        _setUploadInfoQuery.bindValue(6, i._modtime);
-        _setUploadInfoQuery.bindValue(7, i._contentChecksum);
+        query->bindValue(1, file);
+        query->bindValue(2, i._chunk);
+        query->bindValue(3, i._transferid);
+        query->bindValue(4, i._errorCount);
+        query->bindValue(5, i._size);
+        query->bindValue(6, i._modtime);
+        query->bindValue(7, i._contentChecksum);
 
-        if (!_setUploadInfoQuery.exec()) {
+        if (!query->exec()) {
             return;
         }
     } else {
-        _deleteUploadInfoQuery.reset_and_clear_bindings();
-        _deleteUploadInfoQuery.bindValue(1, file);
+        auto query = _db.cachedQuery(QByteArrayLiteral("DELETE FROM uploadinfo WHERE path=?1"));
+        if (!query) {
+            return;
+        }
+        query->bindValue(1, file);
 
-        if (!_deleteUploadInfoQuery.exec()) {
+        if (!query->exec()) {
             return;
         }
     }
 }
 
-QVector<uint> SyncJournalDb::deleteStaleUploadInfos(const QSet<QString> &keep)
+QVector<uint> SyncJournalDb::deleteStaleUploadInfos(const QVector<QString> &keep)
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
     QVector<uint> ids;
 
-    if (!checkConnect()) {
+    if (!checkConnect() || !fillKeepPaths(keep)) {
         return ids;
     }
 
-    SqlQuery query(_db);
-    query.prepare("SELECT path,transferid FROM uploadinfo");
-
-    if (!query.exec()) {
-        return ids;
-    }
-
-    QStringList superfluousPaths;
-
-    while (query.next()) {
-        const QString file = query.stringValue(0);
-        if (!keep.contains(file)) {
-            superfluousPaths.append(file);
-            ids.append(query.intValue(1));
+    {
+        auto query = _db.cachedQuery(QByteArrayLiteral(
+            "SELECT transferid FROM uploadinfo WHERE path NOT IN (SELECT path FROM temp.keep_paths)"));
+        if (!query || !query->exec()) {
+            return ids;
+        }
+        while (query->next()) {
+            ids.append(query->intValue(0));
         }
     }
 
-    deleteBatch(_deleteUploadInfoQuery, superfluousPaths, "uploadinfo");
+    auto deleteQuery = _db.cachedQuery(QByteArrayLiteral(
+        "DELETE FROM uploadinfo WHERE path NOT IN (SELECT path FROM temp.keep_paths)"));
+    if (deleteQuery && deleteQuery->exec() && !ids.isEmpty()) {
+        qCDebug(lcDb) << "Removed" << deleteQuery->numRowsAffected() << "stale uploadinfo entries";
+    }
+    clearKeepPaths();
     return ids;
 }
 
 SyncJournalErrorBlacklistRecord SyncJournalDb::errorBlacklistEntry(const QString &file)
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
     SyncJournalErrorBlacklistRecord entry;
 
     if (file.isEmpty())
@@ -1446,19 +1905,28 @@ SyncJournalErrorBlacklistRecord SyncJournalDb::errorBlacklistEntry(const QString
     // SELECT lastTryEtag, lastTryModtime, retrycount, errorstring
 
     if (checkConnect()) {
-        _getErrorBlacklistQuery.reset_and_clear_bindings();
-        _getErrorBlacklistQuery.bindValue(1, file);
-        if (_getErrorBlacklistQuery.exec()) {
-            if (_getErrorBlacklistQuery.next()) {
-                entry._lastTryEtag = _getErrorBlacklistQuery.baValue(0);
-                entry._lastTryModtime = _getErrorBlacklistQuery.int64Value(1);
-                entry._retryCount = _getErrorBlacklistQuery.intValue(2);
-                entry._errorString = _getErrorBlacklistQuery.stringValue(3);
-                entry._lastTryTime = _getErrorBlacklistQuery.int64Value(4);
-                entry._ignoreDuration = _getErrorBlacklistQuery.int64Value(5);
-                entry._renameTarget = _getErrorBlacklistQuery.stringValue(6);
+        QByteArray sql("SELECT lastTryEtag, lastTryModtime, retrycount, errorstring, lastTryTime, ignoreDuration, renameTarget, errorCategory "
+                       "FROM blacklist WHERE path=?1");
+        if (Utility::fsCasePreserving()) {
+            // if the file system is case preserving we have to check the blacklist
+            // case insensitively
+            sql += " COLLATE NOCASE";
+        }
+        auto query = _db.cachedQuery(sql);
+        if (!query)
+            return entry;
+        query->bindValue(1, file);
+        if (query->exec()) {
+            if (query->next()) {
+                entry._lastTryEtag = query->baValue(0);
+                entry._lastTryModtime = query->int64Value(1);
+                entry._retryCount = query->intValue(2);
+                entry._errorString = query->stringValue(3);
+                entry._lastTryTime = query->int64Value(4);
+                entry._ignoreDuration = query->int64Value(5);
+                entry._renameTarget = query->stringValue(6);
                 entry._errorCategory = static_cast<SyncJournalErrorBlacklistRecord::Category>(
-                    _getErrorBlacklistQuery.intValue(7));
+                    query->intValue(7));
                 entry._file = file;
             }
         }
@@ -1467,40 +1935,31 @@ SyncJournalErrorBlacklistRecord SyncJournalDb::errorBlacklistEntry(const QString
     return entry;
 }
 
-bool SyncJournalDb::deleteStaleErrorBlacklistEntries(const QSet<QString> &keep)
+bool SyncJournalDb::deleteStaleErrorBlacklistEntries(const QVector<QString> &keep)
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
 
-    if (!checkConnect()) {
+    if (!checkConnect() || !fillKeepPaths(keep)) {
         return false;
     }
 
-    SqlQuery query(_db);
-    query.prepare("SELECT path FROM blacklist");
-
-    if (!query.exec()) {
-        return false;
+    auto deleteQuery = _db.cachedQuery(QByteArrayLiteral(
+        "DELETE FROM blacklist WHERE path NOT IN (SELECT path FROM temp.keep_paths)"));
+    bool ok = deleteQuery && deleteQuery->exec();
+    if (ok && deleteQuery->numRowsAffected() > 0) {
+        qCDebug(lcDb) << "Removed" << deleteQuery->numRowsAffected() << "stale blacklist entries";
     }
-
-    QStringList superfluousPaths;
-
-    while (query.next()) {
-        const QString file = query.stringValue(0);
-        if (!keep.contains(file)) {
-            superfluousPaths.append(file);
-        }
-    }
-
-    SqlQuery delQuery(_db);
-    delQuery.prepare("DELETE FROM blacklist WHERE path = ?");
-    return deleteBatch(delQuery, superfluousPaths, "blacklist");
+    clearKeepPaths();
+    return ok;
 }
 
 int SyncJournalDb::errorBlackListEntryCount()
 {
     int re = 0;
 
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
     if (checkConnect()) {
         SqlQuery query("SELECT count(*) FROM blacklist", _db);
 
@@ -1516,7 +1975,8 @@ int SyncJournalDb::errorBlackListEntryCount()
 
 int SyncJournalDb::wipeErrorBlacklist()
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
     if (checkConnect()) {
         SqlQuery query(_db);
 
@@ -1537,7 +1997,8 @@ void SyncJournalDb::wipeErrorBlacklistEntry(const QString &file)
         return;
     }
 
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
     if (checkConnect()) {
         SqlQuery query(_db);
 
@@ -1551,7 +2012,8 @@ void SyncJournalDb::wipeErrorBlacklistEntry(const QString &file)
 
 void SyncJournalDb::wipeErrorBlacklistCategory(SyncJournalErrorBlacklistRecord::Category category)
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
     if (checkConnect()) {
         SqlQuery query(_db);
 
@@ -1565,8 +2027,16 @@ void SyncJournalDb::wipeErrorBlacklistCategory(SyncJournalErrorBlacklistRecord::
 
 void SyncJournalDb::setErrorBlacklistEntry(const SyncJournalErrorBlacklistRecord &item)
 {
-    QMutexLocker locker(&_mutex);
+    if (enqueueWrite([this, item] { setErrorBlacklistEntryLocked(item); return true; }))
+        return;
+
+    Locker locker(this);
+    applyPendingWrites();
+    setErrorBlacklistEntryLocked(item);
+}
 
+void SyncJournalDb::setErrorBlacklistEntryLocked(const SyncJournalErrorBlacklistRecord &item)
+{
     qCInfo(lcDb) << "Setting blacklist entry for " << item._file << item._retryCount
                  << item._errorString << item._lastTryTime << item._ignoreDuration
                  << item._lastTryModtime << item._lastTryEtag << item._renameTarget
@@ -1576,28 +2046,30 @@ void SyncJournalDb::setErrorBlacklistEntry(const SyncJournalErrorBlacklistRecord
         return;
     }
 
-    if (!_setErrorBlacklistQuery.initOrReset(QByteArrayLiteral(
+    auto query = _db.cachedQuery(QByteArrayLiteral(
         "INSERT OR REPLACE INTO blacklist "
         "(path, lastTryEtag, lastTryModtime, retrycount, errorstring, lastTryTime, ignoreDuration, renameTarget, errorCategory) "
-        "VALUES ( ?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9)"), _db)) {
+        "VALUES ( ?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9)"));
+    if (!query) {
         return;
     }
 
-    _setErrorBlacklistQuery.bindValue(1, item._file);
-    _setErrorBlacklistQuery.bindValue(2, item._lastTryEtag);
-    _setErrorBlacklistQuery.bindValue(3, item._lastTryModtime);
-    _setErrorBlacklistQuery.bindValue(4, item._retryCount);
-    _setErrorBlacklistQuery.bindValue(5, item._errorString);
-    _setErrorBlacklistQuery.bindValue(6, item._lastTryTime);
-    _setErrorBlacklistQuery.bindValue(7, item._ignoreDuration);
-    _setErrorBlacklistQuery.bindValue(8, item._renameTarget);
-    _setErrorBlacklistQuery.bindValue(9, item._errorCategory);
-    _setErrorBlacklistQuery.exec();
+    query->bindValue(1, item._file);
+    query->bindValue(2, item._lastTryEtag);
+    query->bindValue(3, item._lastTryModtime);
+    query->bindValue(4, item._retryCount);
+    query->bindValue(5, item._errorString);
+    query->bindValue(6, item._lastTryTime);
+    query->bindValue(7, item._ignoreDuration);
+    query->bindValue(8, item._renameTarget);
+    query->bindValue(9, item._errorCategory);
+    query->exec();
 }
 
 QVector<SyncJournalDb::PollInfo> SyncJournalDb::getPollInfos()
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
 
     QVector<SyncJournalDb::PollInfo> res;
 
@@ -1624,7 +2096,8 @@ QVector<SyncJournalDb::PollInfo> SyncJournalDb::getPollInfos()
 
 void SyncJournalDb::setPollInfo(const SyncJournalDb::PollInfo &info)
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
     if (!checkConnect()) {
         return;
     }
@@ -1648,24 +2121,26 @@ QStringList SyncJournalDb::getSelectiveSyncList(SyncJournalDb::SelectiveSyncList
     QStringList result;
     ASSERT(ok);
 
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
     if (!checkConnect()) {
         *ok = false;
         return result;
     }
 
-    if (!_getSelectiveSyncListQuery.initOrReset(QByteArrayLiteral("SELECT path FROM selectivesync WHERE type=?1"), _db)) {
+    auto query = _db.cachedQuery(QByteArrayLiteral("SELECT path FROM selectivesync WHERE type=?1"));
+    if (!query) {
         *ok = false;
         return result;
     }
 
-    _getSelectiveSyncListQuery.bindValue(1, int(type));
-    if (!_getSelectiveSyncListQuery.exec()) {
+    query->bindValue(1, int(type));
+    if (!query->exec()) {
         *ok = false;
         return result;
     }
-    while (_getSelectiveSyncListQuery.next()) {
-        auto entry = _getSelectiveSyncListQuery.stringValue(0);
+    while (query->next()) {
+        auto entry = query->stringValue(0);
         if (!entry.endsWith(QLatin1Char('/'))) {
             entry.append(QLatin1Char('/'));
         }
@@ -1678,7 +2153,8 @@ QStringList SyncJournalDb::getSelectiveSyncList(SyncJournalDb::SelectiveSyncList
 
 void SyncJournalDb::setSelectiveSyncList(SyncJournalDb::SelectiveSyncListType type, const QStringList &list)
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
     if (!checkConnect()) {
         return;
     }
@@ -1707,7 +2183,9 @@ void SyncJournalDb::setSelectiveSyncList(SyncJournalDb::SelectiveSyncListType ty
 
 void SyncJournalDb::avoidRenamesOnNextSync(const QByteArray &path)
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
+    _metadataSnapshot.reset();
 
     if (!checkConnect()) {
         return;
@@ -1725,7 +2203,9 @@ void SyncJournalDb::avoidRenamesOnNextSync(const QByteArray &path)
 
 void SyncJournalDb::avoidReadFromDbOnNextSync(const QByteArray &fileName)
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
+    _metadataSnapshot.reset();
 
     if (!checkConnect()) {
         return;
@@ -1751,12 +2231,16 @@ void SyncJournalDb::avoidReadFromDbOnNextSync(const QByteArray &fileName)
 
 void SyncJournalDb::clearEtagStorageFilter()
 {
+    Locker locker(this);
+    // Queued writes were made while the filter was active
+    applyPendingWrites();
     _etagStorageFilter.clear();
 }
 
 void SyncJournalDb::forceRemoteDiscoveryNextSync()
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
 
     if (!checkConnect()) {
         return;
@@ -1768,6 +2252,7 @@ void SyncJournalDb::forceRemoteDiscoveryNextSync()
 void SyncJournalDb::forceRemoteDiscoveryNextSyncLocked()
 {
     qCInfo(lcDb) << "Forcing remote re-discovery by deleting folder Etags";
+    _metadataSnapshot.reset();
     SqlQuery deleteRemoteFolderEtagsQuery(_db);
     deleteRemoteFolderEtagsQuery.prepare("UPDATE metadata SET md5='_invalid_' WHERE type=2;");
     deleteRemoteFolderEtagsQuery.exec();
@@ -1776,25 +2261,26 @@ void SyncJournalDb::forceRemoteDiscoveryNextSyncLocked()
 
 QByteArray SyncJournalDb::getChecksumType(int checksumTypeId)
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
     if (!checkConnect()) {
         return QByteArray();
     }
 
     // Retrieve the id
-    auto &query = _getChecksumTypeQuery;
-    if (!query.initOrReset(QByteArrayLiteral("SELECT name FROM checksumtype WHERE id=?1"), _db))
+    auto query = _db.cachedQuery(QByteArrayLiteral("SELECT name FROM checksumtype WHERE id=?1"));
+    if (!query)
         return {};
-    query.bindValue(1, checksumTypeId);
-    if (!query.exec()) {
+    query->bindValue(1, checksumTypeId);
+    if (!query->exec()) {
         return 0;
     }
 
-    if (!query.next()) {
+    if (!query->next()) {
         qCWarning(lcDb) << "No checksum type mapping found for" << checksumTypeId;
         return 0;
     }
-    return query.baValue(0);
+    return query->baValue(0);
 }
 
 int SyncJournalDb::mapChecksumType(const QByteArray &checksumType)
@@ -1804,120 +2290,196 @@ int SyncJournalDb::mapChecksumType(const QByteArray &checksumType)
     }
 
     // Ensure the checksum type is in the db
-    if (!_insertChecksumTypeQuery.initOrReset(QByteArrayLiteral("INSERT OR IGNORE INTO checksumtype (name) VALUES (?1)"), _db))
+    auto insertQuery = _db.cachedQuery(QByteArrayLiteral("INSERT OR IGNORE INTO checksumtype (name) VALUES (?1)"));
+    if (!insertQuery)
         return 0;
-    _insertChecksumTypeQuery.bindValue(1, checksumType);
-    if (!_insertChecksumTypeQuery.exec()) {
+    insertQuery->bindValue(1, checksumType);
+    if (!insertQuery->exec()) {
         return 0;
     }
 
     // Retrieve the id
-    if (!_getChecksumTypeIdQuery.initOrReset(QByteArrayLiteral("SELECT id FROM checksumtype WHERE name=?1"), _db))
+    auto idQuery = _db.cachedQuery(QByteArrayLiteral("SELECT id FROM checksumtype WHERE name=?1"));
+    if (!idQuery)
         return 0;
-    _getChecksumTypeIdQuery.bindValue(1, checksumType);
-    if (!_getChecksumTypeIdQuery.exec()) {
+    idQuery->bindValue(1, checksumType);
+    if (!idQuery->exec()) {
         return 0;
     }
 
-    if (!_getChecksumTypeIdQuery.next()) {
+    if (!idQuery->next()) {
         qCWarning(lcDb) << "No checksum type mapping found for" << checksumType;
         return 0;
     }
-    return _getChecksumTypeIdQuery.intValue(0);
+    return idQuery->intValue(0);
+}
+
+QByteArray SyncJournalDb::getCachedChecksum(quint64 inode, qint64 modtime, qint64 size, const QByteArray &checksumType)
+{
+    Locker locker(this);
+    applyPendingWrites();
+    if (!checkConnect()) {
+        return QByteArray();
+    }
+
+    int checksumTypeId = mapChecksumType(checksumType);
+    if (!checksumTypeId) {
+        return QByteArray();
+    }
+    auto query = _db.cachedQuery(QByteArrayLiteral(
+        "SELECT checksum FROM checksumcache "
+        "WHERE inode=?1 AND checksumTypeId=?2 AND modtime=?3 AND filesize=?4"));
+    if (!query) {
+        return QByteArray();
+    }
+    query->bindValue(1, inode);
+    query->bindValue(2, checksumTypeId);
+    query->bindValue(3, modtime);
+    query->bindValue(4, size);
+    if (!query->next()) {
+        return QByteArray();
+    }
+    return query->baValue(0);
+}
+
+void SyncJournalDb::setCachedChecksum(quint64 inode, qint64 modtime, qint64 size,
+    const QByteArray &checksumType, const QByteArray &checksum)
+{
+    if (enqueueWrite([=] { setCachedChecksumLocked(inode, modtime, size, checksumType, checksum); return true; }))
+        return;
+
+    Locker locker(this);
+    applyPendingWrites();
+    setCachedChecksumLocked(inode, modtime, size, checksumType, checksum);
+}
+
+void SyncJournalDb::setCachedChecksumLocked(quint64 inode, qint64 modtime, qint64 size,
+    const QByteArray &checksumType, const QByteArray &checksum)
+{
+    if (!checkConnect()) {
+        return;
+    }
+
+    int checksumTypeId = mapChecksumType(checksumType);
+    if (!checksumTypeId) {
+        return;
+    }
+    auto query = _db.cachedQuery(QByteArrayLiteral(
+        "INSERT OR REPLACE INTO checksumcache (inode, checksumTypeId, modtime, filesize, checksum) "
+        "VALUES (?1, ?2, ?3, ?4, ?5)"));
+    if (!query) {
+        return;
+    }
+    query->bindValue(1, inode);
+    query->bindValue(2, checksumTypeId);
+    query->bindValue(3, modtime);
+    query->bindValue(4, size);
+    query->bindValue(5, checksum);
+    query->exec();
 }
 
 QByteArray SyncJournalDb::dataFingerprint()
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
     if (!checkConnect()) {
         return QByteArray();
     }
 
-    if (!_getDataFingerprintQuery.initOrReset(QByteArrayLiteral("SELECT fingerprint FROM datafingerprint"), _db))
+    auto query = _db.cachedQuery(QByteArrayLiteral("SELECT fingerprint FROM datafingerprint"));
+    if (!query)
         return QByteArray();
 
-    if (!_getDataFingerprintQuery.exec()) {
+    if (!query->exec()) {
         return QByteArray();
     }
 
-    if (!_getDataFingerprintQuery.next()) {
+    if (!query->next()) {
         return QByteArray();
     }
-    return _getDataFingerprintQuery.baValue(0);
+    return query->baValue(0);
 }
 
 void SyncJournalDb::setDataFingerprint(const QByteArray &dataFingerprint)
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
     if (!checkConnect()) {
         return;
     }
 
-    if (!_setDataFingerprintQuery1.initOrReset(QByteArrayLiteral("DELETE FROM datafingerprint;"), _db)
-        || !_setDataFingerprintQuery2.initOrReset(QByteArrayLiteral("INSERT INTO datafingerprint (fingerprint) VALUES (?1);"), _db)) {
+    auto query = _db.cachedQuery(QByteArrayLiteral("DELETE FROM datafingerprint;"));
+    if (!query) {
         return;
     }
+    query->exec();
 
-    _setDataFingerprintQuery1.exec();
-
-    _setDataFingerprintQuery2.bindValue(1, dataFingerprint);
-    _setDataFingerprintQuery2.exec();
+    query = _db.cachedQuery(QByteArrayLiteral("INSERT INTO datafingerprint (fingerprint) VALUES (?1);"));
+    if (!query) {
+        return;
+    }
+    query->bindValue(1, dataFingerprint);
+    query->exec();
 }
 
 void SyncJournalDb::setConflictRecord(const ConflictRecord &record)
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
     if (!checkConnect())
         return;
 
-    auto &query = _setConflictRecordQuery;
-    ASSERT(query.initOrReset(QByteArrayLiteral(
-                          "INSERT OR REPLACE INTO conflicts "
-                          "(path, baseFileId, baseModtime, baseEtag) "
-                          "VALUES (?1, ?2, ?3, ?4);"),
-        _db));
-    query.bindValue(1, record.path);
-    query.bindValue(2, record.baseFileId);
-    query.bindValue(3, record.baseModtime);
-    query.bindValue(4, record.baseEtag);
-    ASSERT(query.exec());
+    auto query = _db.cachedQuery(QByteArrayLiteral(
+        "INSERT OR REPLACE INTO conflicts "
+        "(path, baseFileId, baseModtime, baseEtag) "
+        "VALUES (?1, ?2, ?3, ?4);"));
+    ASSERT(query);
+    query->bindValue(1, record.path);
+    query->bindValue(2, record.baseFileId);
+    query->bindValue(3, record.baseModtime);
+    query->bindValue(4, record.baseEtag);
+    ASSERT(query->exec());
 }
 
 ConflictRecord SyncJournalDb::conflictRecord(const QByteArray &path)
 {
     ConflictRecord entry;
 
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
     if (!checkConnect())
         return entry;
-    auto &query = _getConflictRecordQuery;
-    ASSERT(query.initOrReset(QByteArrayLiteral("SELECT baseFileId, baseModtime, baseEtag FROM conflicts WHERE path=?1;"), _db));
-    query.bindValue(1, path);
-    ASSERT(query.exec());
-    if (!query.next())
+    auto query = _db.cachedQuery(QByteArrayLiteral("SELECT baseFileId, baseModtime, baseEtag FROM conflicts WHERE path=?1;"));
+    ASSERT(query);
+    query->bindValue(1, path);
+    ASSERT(query->exec());
+    if (!query->next())
         return entry;
 
     entry.path = path;
-    entry.baseFileId = query.baValue(0);
-    entry.baseModtime = query.int64Value(1);
-    entry.baseEtag = query.baValue(2);
+    entry.baseFileId = query->baValue(0);
+    entry.baseModtime = query->int64Value(1);
+    entry.baseEtag = query->baValue(2);
     return entry;
 }
 
 void SyncJournalDb::deleteConflictRecord(const QByteArray &path)
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
     if (!checkConnect())
         return;
 
-    ASSERT(_deleteConflictRecordQuery.initOrReset("DELETE FROM conflicts WHERE path=?1;", _db));
-    _deleteConflictRecordQuery.bindValue(1, path);
-    ASSERT(_deleteConflictRecordQuery.exec());
+    auto query = _db.cachedQuery(QByteArrayLiteral("DELETE FROM conflicts WHERE path=?1;"));
+    ASSERT(query);
+    query->bindValue(1, path);
+    ASSERT(query->exec());
 }
 
 QByteArrayList SyncJournalDb::conflictRecordPaths()
 {
-    QMutexLocker locker(&_mutex);
+    Locker locker(this);
+    applyPendingWrites();
     if (!checkConnect())
         return {};
 
@@ -1934,7 +2496,9 @@ QByteArrayList SyncJournalDb::conflictRecordPaths()
 
 void SyncJournalDb::clearFileTable()
 {
-    QMutexLocker lock(&_mutex);
+    Locker lock(this);
+    applyPendingWrites();
+    _metadataSnapshot.reset();
     SqlQuery query(_db);
     query.prepare("DELETE FROM metadata;");
     query.exec();
@@ -1942,13 +2506,27 @@ void SyncJournalDb::clearFileTable()
 
 void SyncJournalDb::commit(const QString &context, bool startTrans)
 {
-    QMutexLocker lock(&_mutex);
+    if (startTrans && bulkLoadDefersCommit())
+        return;
+
+    if (startTrans) {
+        QMutexLocker locker(&_pendingWritesMutex);
+        if (_asyncWriter) {
+            _commitRequested = true;
+            _pendingWritesCondition.wakeOne();
+            return;
+        }
+    }
+
+    Locker lock(this);
+    applyPendingWrites();
     commitInternal(context, startTrans);
 }
 
 void SyncJournalDb::commitIfNeededAndStartNewTransaction(const QString &context)
 {
-    QMutexLocker lock(&_mutex);
+    Locker lock(this);
+    applyPendingWrites();
     if (_transaction == 1) {
         commitInternal(context, true);
     } else {
@@ -1967,6 +2545,292 @@ void SyncJournalDb::commitInternal(const QString &context, bool startTrans)
     }
 }
 
+void SyncJournalDb::setAsyncWritesEnabled(bool enabled)
+{
+    if (!enabled) {
+        stopAsyncWriter();
+        Locker lock(this);
+        applyPendingWrites();
+        return;
+    }
+
+    QMutexLocker locker(&_pendingWritesMutex);
+    if (_asyncWriter)
+        return;
+    _asyncWriter.reset(new AsyncWriter(this));
+    _asyncWriter->start();
+}
+
+void SyncJournalDb::stopAsyncWriter()
+{
+    std::unique_ptr<AsyncWriter> writer;
+    {
+        QMutexLocker locker(&_pendingWritesMutex);
+        if (!_asyncWriter)
+            return;
+        // New writes are executed directly from now on, after the queued ones
+        writer = std::move(_asyncWriter);
+        writer->_stop = true;
+        _pendingWritesCondition.wakeOne();
+        _pendingWritesApplied.wakeAll();
+    }
+    // The writer gives up waiting for _mutex when stopped, so this may be
+    // called with the lock held
+    writer->wait();
+}
+
+bool SyncJournalDb::flushWrites()
+{
+    Locker lock(this);
+    applyPendingWrites();
+    if (_db.isOpen())
+        commitInternal(QStringLiteral("flush writes"));
+
+    bool ok = !_pendingWritesFailed;
+    _pendingWritesFailed = false;
+    return ok;
+}
+
+bool SyncJournalDb::startBulkLoad()
+{
+    Locker lock(this);
+    applyPendingWrites();
+    if (_bulkLoad)
+        return true;
+    if (!checkConnect() || !_metadataTableIsEmpty)
+        return false;
+
+    qCInfo(lcDb) << "Starting bulk load, dropping the metadata indexes";
+    _bulkLoad = true;
+    for (const auto &index : metadataIndexes) {
+        SqlQuery query(_db);
+        query.prepare(QByteArray("DROP INDEX IF EXISTS ") + index.name + ";");
+        if (!query.exec()) {
+            // Recreates the indexes that were dropped already
+            finishBulkLoadLocked();
+            return false;
+        }
+    }
+    commitInternal(QStringLiteral("start bulk load"));
+    return true;
+}
+
+bool SyncJournalDb::finishBulkLoad()
+{
+    Locker lock(this);
+    applyPendingWrites();
+    return finishBulkLoadLocked();
+}
+
+bool SyncJournalDb::finishBulkLoadLocked()
+{
+    if (!_bulkLoad)
+        return true;
+    _bulkLoad = false;
+    if (!_db.isOpen())
+        return false; // the indexes are recreated by checkConnect()
+
+    QElapsedTimer timer;
+    timer.start();
+    bool ok = true;
+    for (const auto &index : metadataIndexes) {
+        SqlQuery query(_db);
+        query.prepare(QByteArray("CREATE INDEX IF NOT EXISTS ") + index.name
+            + " ON metadata(" + index.column + ");");
+        if (!query.exec()) {
+            qCWarning(lcDb) << "Error creating index" << index.name << query.error();
+            ok = false;
+        }
+    }
+    commitInternal(QStringLiteral("finish bulk load"));
+    qCInfo(lcDb) << "Created the metadata indexes in" << timer.elapsed() << "ms";
+    return ok;
+}
+
+bool SyncJournalDb::bulkLoadDefersCommit() const
+{
+    return _bulkLoad && _bulkLoadUncommittedRecords < bulkLoadTransactionSize;
+}
+
+QString SyncJournalDb::statisticsReport() const
+{
+    QString report;
+    QTextStream stream(&report);
+    stream << "Statistics of the journal " << _dbFile << "\n";
+    stream << "Waited " << _lockWaits.load() << " times for the journal lock, "
+           << _lockWaitNsecs.load() / 1000000 << " ms in total\n";
+    stream << "     calls       rows   total ms     max ms  statement\n";
+    for (const auto &stats : _db.statistics()) {
+        stream << qSetFieldWidth(10) << stats.executions << qSetFieldWidth(1) << " "
+               << qSetFieldWidth(10) << stats.rows << qSetFieldWidth(1) << " "
+               << qSetFieldWidth(10) << stats.totalNsecs / 1000000 << qSetFieldWidth(1) << " "
+               << qSetFieldWidth(10) << stats.maxNsecs / 1000000 << qSetFieldWidth(0) << "  "
+               << stats.sql.simplified() << "\n";
+    }
+    stream.flush();
+    return report;
+}
+
+void SyncJournalDb::resetStatistics()
+{
+    _db.resetStatistics();
+    _lockWaits = 0;
+    _lockWaitNsecs = 0;
+}
+
+bool SyncJournalDb::performMaintenance(std::chrono::milliseconds budget)
+{
+    MaintenanceDeadline deadline;
+    deadline.timer.start();
+    deadline.budgetMsecs = budget.count();
+    deadline.interrupted = &_maintenanceInterrupted;
+
+    bool workLeft = false;
+    {
+        Locker locker(this);
+        applyPendingWrites();
+        {
+            QMutexLocker pendingLocker(&_pendingWritesMutex);
+            if (_asyncWriter || _bulkLoad) {
+                qCInfo(lcDb) << "Not running the maintenance during a sync";
+                _maintenanceInterrupted = false;
+                return true;
+            }
+        }
+        if (!checkConnect()) {
+            _maintenanceInterrupted = false;
+            return false;
+        }
+
+        // Open transactions and statements would keep VACUUM from running
+        // and the checkpoint from completing
+        commitInternal("maintenance", false);
+        _db.resetCachedQueries();
+        sqlite3_progress_handler(_db.sqliteDb(), 1000, maintenanceProgressHandler, &deadline);
+
+        auto pragmaValue = [this](const char *pragma) -> qint64 {
+            SqlQuery query(_db);
+            query.prepare(pragma);
+            return query.next() ? query.int64Value(0) : -1;
+        };
+
+        qint64 freePages = pragmaValue("PRAGMA freelist_count;");
+
+        // Databases without incremental auto-vacuum are rebuilt by checkConnect()
+        if (pragmaValue("PRAGMA auto_vacuum;") == incrementalAutoVacuum) {
+            SqlQuery vacuum(_db);
+            vacuum.prepare("PRAGMA incremental_vacuum(" + QByteArray::number(incrementalVacuumPages) + ");");
+            while (freePages > 0 && deadline.remainingMsecs() > 0) {
+                vacuum.reset_and_clear_bindings();
+                while (vacuum.next()) {
+                }
+                if (vacuum.errorId() != SQLITE_DONE)
+                    break;
+                freePages = pragmaValue("PRAGMA freelist_count;");
+            }
+            workLeft = freePages > 0;
+        }
+
+        // The checkpoint itself can't be interrupted, but a passive one
+        // doesn't wait for readers or writers. The truncation does.
+        if (deadline.remainingMsecs() == 0) {
+            workLeft = true;
+        } else {
+            SqlQuery checkpoint(_db);
+            checkpoint.prepare("PRAGMA wal_checkpoint(PASSIVE);");
+            if (checkpoint.next()) {
+                const qint64 walFrames = checkpoint.int64Value(1);
+                const bool complete = checkpoint.intValue(0) == 0 && checkpoint.int64Value(2) == walFrames;
+                checkpoint.reset_and_clear_bindings();
+                const qint64 remaining = deadline.remainingMsecs();
+                if (complete && walFrames > 0 && remaining > 0) {
+                    const qint64 busyTimeout = pragmaValue("PRAGMA busy_timeout;");
+                    sqlite3_busy_timeout(_db.sqliteDb(), static_cast<int>(remaining));
+                    checkpoint.prepare("PRAGMA wal_checkpoint(TRUNCATE);");
+                    checkpoint.next();
+                    sqlite3_busy_timeout(_db.sqliteDb(), static_cast<int>(busyTimeout));
+                } else if (walFrames > 0) {
+                    workLeft = true;
+                }
+            }
+        }
+
+        sqlite3_progress_handler(_db.sqliteDb(), 0, nullptr, nullptr);
+    }
+
+    qCDebug(lcDb) << "Maintenance took" << deadline.timer.elapsed() << "ms, work left:" << workLeft;
+    _maintenanceInterrupted = false;
+    return workLeft;
+}
+
+void SyncJournalDb::interruptMaintenance()
+{
+    _maintenanceInterrupted = true;
+}
+
+bool SyncJournalDb::enqueueWrite(std::function<bool()> write)
+{
+    QMutexLocker locker(&_pendingWritesMutex);
+    if (!_asyncWriter)
+        return false;
+
+    _pendingWrites.append(std::move(write));
+    // The writer waits for the first write, then for a full batch
+    if (_pendingWrites.size() == 1 || _pendingWrites.size() == asyncWriteBatchSize)
+        _pendingWritesCondition.wakeOne();
+    return true;
+}
+
+void SyncJournalDb::waitForPendingWrites()
+{
+    QMutexLocker locker(&_pendingWritesMutex);
+    if (QThread::currentThread() == _asyncWriter.get())
+        return;
+    while (_asyncWriter && !_pendingWrites.isEmpty()) {
+        _flushRequested = true;
+        _pendingWritesCondition.wakeOne();
+        _pendingWritesApplied.wait(&_pendingWritesMutex);
+    }
+    // A batch the writer took from the queue is applied once it releases _mutex
+}
+
+void SyncJournalDb::applyPendingWrites()
+{
+    // The queued writes call back into functions that apply the pending writes
+    if (_applyingPendingWrites)
+        return;
+
+    QVector<std::function<bool()>> writes;
+    {
+        QMutexLocker locker(&_pendingWritesMutex);
+        // Only the writer runs the queue while there is one, see waitForPendingWrites()
+        if (_asyncWriter && QThread::currentThread() != _asyncWriter.get())
+            return;
+        writes.swap(_pendingWrites);
+    }
+    if (writes.isEmpty())
+        return;
+
+    _applyingPendingWrites = true;
+    for (const auto &write : writes) {
+        if (!write())
+            _pendingWritesFailed = true;
+    }
+    _applyingPendingWrites = false;
+}
+
+void SyncJournalDb::lockAcquired()
+{
+    if (_lockDepth++ == 0)
+        _lockOwner = QThread::currentThreadId();
+}
+
+void SyncJournalDb::lockReleased()
+{
+    if (--_lockDepth == 0)
+        _lockOwner = nullptr;
+}
+
 SyncJournalDb::~SyncJournalDb()
 {
     close();
@@ -1974,7 +2838,8 @@ SyncJournalDb::~SyncJournalDb()
 
 bool SyncJournalDb::isConnected()
 {
-    QMutexLocker lock(&_mutex);
+    Locker lock(this);
+    applyPendingWrites();
     return checkConnect();
 }
 
@@ -23,7 +23,13 @@
 #include <qmutex.h>
 #include <QDateTime>
 #include <QHash>
+#include <QVector>
+#include <QWaitCondition>
+#include <atomic>
+#include <chrono>
 #include <functional>
+#include <memory>
+#include <vector>
 
 #include "common/utility.h"
 #include "common/ownsql.h"
@@ -31,6 +37,7 @@
 
 namespace OCC {
 class SyncJournalFileRecord;
+class SyncJournalSnapshot;
 
 /**
  * @brief Class that handles the sync database
@@ -58,8 +65,27 @@ public:
     bool getFileRecord(const QString &filename, SyncJournalFileRecord *rec) { return getFileRecord(filename.toUtf8(), rec); }
     bool getFileRecord(const QByteArray &filename, SyncJournalFileRecord *rec);
     bool getFileRecordByInode(quint64 inode, SyncJournalFileRecord *rec);
+
+    /**
+     * Like getFileRecord(), but reads through one of a pool of read-only
+     * connections without locking the journal.
+     *
+     * Meant for status queries, like the ones of the file manager overlays,
+     * which shouldn't wait for a running sync. Only sees committed changes.
+     * Falls back to getFileRecord() when the journal isn't in WAL mode or
+     * wasn't opened yet.
+     */
+    bool getCommittedFileRecord(const QString &filename, SyncJournalFileRecord *rec) { return getCommittedFileRecord(filename.toUtf8(), rec); }
+    bool getCommittedFileRecord(const QByteArray &filename, SyncJournalFileRecord *rec);
     bool getFileRecordsByFileId(const QByteArray &fileId, const std::function<void(const SyncJournalFileRecord &)> &rowCallback);
     bool getFilesBelowPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord&)> &rowCallback);
+    /**
+     * Like getFilesBelowPath, but only returns the direct children of the directory.
+     * The empty path is the sync root.
+     *
+     * Used by the discovery to load the entries of a directory in one query.
+     */
+    bool getFilesInDirectory(const QByteArray &path, const std::function<void(const SyncJournalFileRecord &)> &rowCallback);
     bool setFileRecord(const SyncJournalFileRecord &record);
 
     /// Like setFileRecord, but preserves checksums
@@ -72,7 +98,6 @@ public:
     bool updateLocalMetadata(const QString &filename,
         qint64 modtime, quint64 size, quint64 inode);
     bool exists();
-    void walCheckpoint();
 
     QString databaseFilePath() const;
 
@@ -130,16 +155,21 @@ public:
 
     DownloadInfo getDownloadInfo(const QString &file);
     void setDownloadInfo(const QString &file, const DownloadInfo &i);
-    QVector<DownloadInfo> getAndDeleteStaleDownloadInfos(const QSet<QString> &keep);
+    /**
+     * The functions for removing stale entries delete all entries whose path
+     * isn't in keep. The comparison is done by sqlite, with a temporary
+     * table that is filled with the paths to keep.
+     */
+    QVector<DownloadInfo> getAndDeleteStaleDownloadInfos(const QVector<QString> &keep);
     int downloadInfoCount();
 
     UploadInfo getUploadInfo(const QString &file);
     void setUploadInfo(const QString &file, const UploadInfo &i);
     // Return the list of transfer ids that were removed.
-    QVector<uint> deleteStaleUploadInfos(const QSet<QString> &keep);
+    QVector<uint> deleteStaleUploadInfos(const QVector<QString> &keep);
 
     SyncJournalErrorBlacklistRecord errorBlacklistEntry(const QString &);
-    bool deleteStaleErrorBlacklistEntries(const QSet<QString> &keep);
+    bool deleteStaleErrorBlacklistEntries(const QVector<QString> &keep);
 
     void avoidRenamesOnNextSync(const QString &path) { avoidRenamesOnNextSync(path.toUtf8()); }
     void avoidRenamesOnNextSync(const QByteArray &path);
@@ -200,10 +230,82 @@ public:
 
     /* Because sqlite transactions are really slow, we encapsulate everything in big transactions
      * Commit will actually commit the transaction and create a new one.
+     *
+     * With asynchronous writes, committing and starting a new transaction is
+     * left to the writer thread, which commits the queued writes in groups.
      */
     void commit(const QString &context, bool startTrans = true);
     void commitIfNeededAndStartNewTransaction(const QString &context);
 
+    /**
+     * Queue setFileRecord(), setDownloadInfo(), setUploadInfo() and
+     * setErrorBlacklistEntry() instead of executing them on the calling thread.
+     *
+     * The queued writes are applied in order by a writer thread, which commits
+     * them in batches. All other functions first wait until the writer thread
+     * applied the writes queued so far, so reads see them. The queue is never
+     * run on the calling thread. Since errors of queued writes are only known
+     * later, setFileRecord() returns true and flushWrites() reports them.
+     *
+     * Disabling the asynchronous writes, as well as close(), stops the writer
+     * thread and applies the remaining writes.
+     */
+    void setAsyncWritesEnabled(bool enabled);
+
+    /**
+     * Applies and commits all queued writes.
+     *
+     * Returns false if any write queued since the last flush failed.
+     */
+    bool flushWrites();
+
+    /**
+     * Starts a bulk load of the records of an initial sync, if the metadata
+     * table is empty.
+     *
+     * Until finishBulkLoad() the secondary indexes of the metadata table are
+     * dropped, and commit() only commits once a large number of file records
+     * were written. Lookups by inode, file id or path still work, but scan
+     * the table.
+     *
+     * Returns whether the journal is in bulk load mode.
+     */
+    bool startBulkLoad();
+
+    /**
+     * Commits the bulk load and rebuilds the indexes of the metadata table.
+     * Also done by close(), and on the next open after a crash.
+     */
+    bool finishBulkLoad();
+
+    /**
+     * A report of the statements executed on the journal, and of the time
+     * spent waiting for the journal's lock, for diagnostics.
+     *
+     * May be called from any thread, also during a sync.
+     */
+    QString statisticsReport() const;
+    void resetStatistics();
+
+    /**
+     * Runs a step of the maintenance of the database file, to be called
+     * while no sync is running:
+     *  - unused pages are returned to the file system with incremental
+     *    vacuum steps,
+     *  - the WAL is checkpointed passively, and truncated if that completed.
+     *
+     * Statements are interrupted when the budget is exceeded or when
+     * interruptMaintenance() is called; the next step continues the work.
+     * Databases created without incremental auto-vacuum are rebuilt with it
+     * when they are opened, if a large part of their pages is unused.
+     *
+     * Returns whether there is work left for another step.
+     */
+    bool performMaintenance(std::chrono::milliseconds budget);
+
+    /** Makes a running performMaintenance() return soon. May be called from any thread. */
+    void interruptMaintenance();
+
     void close();
 
     /**
@@ -216,6 +318,18 @@ public:
      */
     QByteArray getChecksumType(int checksumTypeId);
 
+    /**
+     * A cache of the content checksums of local files, keyed by inode and
+     * checksum type. The checksum is only returned if the file's modtime
+     * and size still match the ones it was computed for, so any change of
+     * the file invalidates it.
+     *
+     * Returns an empty checksum if there is no valid entry.
+     */
+    QByteArray getCachedChecksum(quint64 inode, qint64 modtime, qint64 size, const QByteArray &checksumType);
+    void setCachedChecksum(quint64 inode, qint64 modtime, qint64 size,
+        const QByteArray &checksumType, const QByteArray &checksum);
+
     /**
      * The data-fingerprint used to detect backup
      */
@@ -245,6 +359,17 @@ public:
      */
     void clearFileTable();
 
+    /**
+     * Loads the metadata table into a read-only in-memory snapshot.
+     *
+     * While the snapshot exists, getFileRecord(), getFileRecordByInode(),
+     * getFileRecordsByFileId(), getFilesBelowPath() and getFilesInDirectory()
+     * are answered from memory without sqlite. Any modification of the
+     * metadata table drops the snapshot, as does close().
+     */
+    bool createMetadataSnapshot();
+    void dropMetadataSnapshot();
+
 private:
     int getFileRecordCount();
     bool updateDatabaseStructure();
@@ -257,6 +382,34 @@ private:
     QVector<QByteArray> tableColumns(const QByteArray &table);
     bool checkConnect();
 
+    // Queues the write if asynchronous writes are enabled, returns false otherwise
+    bool enqueueWrite(std::function<bool()> write);
+    // Waits until the writer thread applied the queued writes, _mutex must not be held
+    void waitForPendingWrites();
+    // Applies the queued writes when there is no writer thread, _mutex must be held
+    void applyPendingWrites();
+    void stopAsyncWriter();
+
+    bool finishBulkLoadLocked();
+    // Whether commit() leaves the transaction open because of a bulk load
+    bool bulkLoadDefersCommit() const;
+
+    struct ReadConnection;
+    std::unique_ptr<ReadConnection> takeReadConnection();
+    void returnReadConnection(std::unique_ptr<ReadConnection> connection);
+    void closeReadConnections();
+
+    // Fills the temporary keep_paths table used for removing stale entries
+    bool fillKeepPaths(const QVector<QString> &keep);
+    void clearKeepPaths();
+
+    bool setFileRecordLocked(const SyncJournalFileRecord &record);
+    void setDownloadInfoLocked(const QString &file, const DownloadInfo &i);
+    void setUploadInfoLocked(const QString &file, const UploadInfo &i);
+    void setErrorBlacklistEntryLocked(const SyncJournalErrorBlacklistRecord &item);
+    void setCachedChecksumLocked(quint64 inode, qint64 modtime, qint64 size,
+        const QByteArray &checksumType, const QByteArray &checksum);
+
     // Same as forceRemoteDiscoveryNextSync but without acquiring the lock
     void forceRemoteDiscoveryNextSyncLocked();
 
@@ -268,37 +421,52 @@ private:
     SqlDatabase _db;
     QString _dbFile;
     QMutex _mutex; // Public functions are protected with the mutex.
+
+    // Locks _mutex, counting the waits for it in the statistics
+    class Locker;
+    std::atomic<quint64> _lockWaits{ 0 };
+    std::atomic<qint64> _lockWaitNsecs{ 0 };
+
+    // The thread holding _mutex, to know whether it may wait for the writer thread
+    void lockAcquired();
+    void lockReleased();
+    std::atomic<Qt::HANDLE> _lockOwner{ nullptr };
+    int _lockDepth = 0; // protected by _mutex
     int _transaction;
     bool _metadataTableIsEmpty;
 
-    SqlQuery _getFileRecordQuery;
-    SqlQuery _getFileRecordQueryByInode;
-    SqlQuery _getFileRecordQueryByFileId;
-    SqlQuery _getFilesBelowPathQuery;
-    SqlQuery _getAllFilesQuery;
-    SqlQuery _setFileRecordQuery;
-    SqlQuery _setFileRecordChecksumQuery;
-    SqlQuery _setFileRecordLocalMetadataQuery;
-    SqlQuery _getDownloadInfoQuery;
-    SqlQuery _setDownloadInfoQuery;
-    SqlQuery _deleteDownloadInfoQuery;
-    SqlQuery _getUploadInfoQuery;
-    SqlQuery _setUploadInfoQuery;
-    SqlQuery _deleteUploadInfoQuery;
-    SqlQuery _deleteFileRecordPhash;
-    SqlQuery _deleteFileRecordRecursively;
-    SqlQuery _getErrorBlacklistQuery;
-    SqlQuery _setErrorBlacklistQuery;
-    SqlQuery _getSelectiveSyncListQuery;
-    SqlQuery _getChecksumTypeIdQuery;
-    SqlQuery _getChecksumTypeQuery;
-    SqlQuery _insertChecksumTypeQuery;
-    SqlQuery _getDataFingerprintQuery;
-    SqlQuery _setDataFingerprintQuery1;
-    SqlQuery _setDataFingerprintQuery2;
-    SqlQuery _getConflictRecordQuery;
-    SqlQuery _setConflictRecordQuery;
-    SqlQuery _deleteConflictRecordQuery;
+    /* See setAsyncWritesEnabled(). The queue and the writer thread are
+     * protected by _pendingWritesMutex, which may be locked while holding
+     * _mutex but not the other way round. */
+    class AsyncWriter;
+    std::unique_ptr<AsyncWriter> _asyncWriter;
+    QMutex _pendingWritesMutex;
+    QWaitCondition _pendingWritesCondition;
+    QWaitCondition _pendingWritesApplied;
+    QVector<std::function<bool()>> _pendingWrites;
+    bool _commitRequested = false;
+    bool _flushRequested = false;
+    bool _applyingPendingWrites = false; // protected by _mutex
+    bool _pendingWritesFailed = false; // protected by _mutex
+
+    /* See startBulkLoad(). Atomic as commit() checks them without _mutex. */
+    std::atomic<bool> _bulkLoad{ false };
+    std::atomic<int> _bulkLoadUncommittedRecords{ 0 };
+
+    /* See performMaintenance() */
+    std::atomic<bool> _maintenanceInterrupted{ false };
+
+    /* Idle connections for getCommittedFileRecord(), protected by
+     * _readConnectionsMutex. Connections that were opened before the last
+     * close() are discarded when they are returned. */
+    QMutex _readConnectionsMutex;
+    std::vector<std::unique_ptr<ReadConnection>> _readConnections;
+    int _readConnectionsGeneration = 0;
+    bool _readConnectionsAvailable = false;
+
+    /* See createMetadataSnapshot(). Shared so a lookup that is iterating it
+     * is not affected if a row callback modifies the table. */
+    std::shared_ptr<const SyncJournalSnapshot> _metadataSnapshot;
 
     /* Storing etags to these folders, or their parent folders, is filtered out.
      *
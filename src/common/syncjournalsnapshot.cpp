@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <QHash>
+
+#include <algorithm>
+#include <string.h>
+
+#include "common/syncjournalsnapshot.h"
+#include "common/syncjournaldb.h"
+
+namespace OCC {
+
+void SyncJournalSnapshot::append(const SyncJournalFileRecord &rec)
+{
+    Entry entry;
+    entry.path = addString(rec._path);
+    entry.etag = addString(rec._etag);
+    entry.fileId = addString(rec._fileId);
+    entry.checksumHeader = addString(rec._checksumHeader);
+    entry.inode = rec._inode;
+    entry.modtime = rec._modtime;
+    entry.fileSize = rec._fileSize;
+    entry.remotePerm = rec._remotePerm;
+    entry.type = static_cast<quint8>(rec._type);
+    entry.serverHasIgnoredFiles = rec._serverHasIgnoredFiles;
+    _entries.push_back(entry);
+}
+
+void SyncJournalSnapshot::build()
+{
+    _entries.shrink_to_fit();
+    _strings.squeeze();
+
+    // Keep the tables at most half full
+    uint capacity = 16;
+    while (capacity < 2 * _entries.size())
+        capacity *= 2;
+    _mask = capacity - 1;
+    _byPHash.assign(capacity, 0);
+    _byInode.assign(capacity, 0);
+    _byFileId.assign(capacity, 0);
+
+    for (quint32 i = 0; i < _entries.size(); ++i) {
+        const auto &entry = _entries[i];
+        insert(_byPHash, qHash(SyncJournalDb::getPHash(string(entry.path))), i);
+        if (entry.inode)
+            insert(_byInode, qHash(entry.inode), i);
+        if (entry.fileId.size)
+            insert(_byFileId, qHashBits(_strings.constData() + entry.fileId.offset, entry.fileId.size), i);
+    }
+}
+
+void SyncJournalSnapshot::getFileRecord(const QByteArray &path, SyncJournalFileRecord *rec) const
+{
+    find(_byPHash, qHash(SyncJournalDb::getPHash(path)), [&](const Entry &entry) {
+        if (!equals(entry.path, path))
+            return true;
+        *rec = record(entry);
+        return false;
+    });
+}
+
+void SyncJournalSnapshot::getFileRecordByInode(quint64 inode, SyncJournalFileRecord *rec) const
+{
+    find(_byInode, qHash(inode), [&](const Entry &entry) {
+        if (entry.inode != inode)
+            return true;
+        *rec = record(entry);
+        return false;
+    });
+}
+
+void SyncJournalSnapshot::getFileRecordsByFileId(const QByteArray &fileId, const std::function<void(const SyncJournalFileRecord &)> &rowCallback) const
+{
+    find(_byFileId, qHashBits(fileId.constData(), fileId.size()), [&](const Entry &entry) {
+        if (equals(entry.fileId, fileId))
+            rowCallback(record(entry));
+        return true;
+    });
+}
+
+void SyncJournalSnapshot::getFilesBelowPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord &)> &rowCallback) const
+{
+    forEachBelow(path, [&](const Entry &entry, int) {
+        rowCallback(record(entry));
+    });
+}
+
+void SyncJournalSnapshot::getFilesInDirectory(const QByteArray &path, const std::function<void(const SyncJournalFileRecord &)> &rowCallback) const
+{
+    forEachBelow(path, [&](const Entry &entry, int relativeStart) {
+        auto begin = _strings.constData() + entry.path.offset;
+        if (!memchr(begin + relativeStart, '/', entry.path.size - relativeStart))
+            rowCallback(record(entry));
+    });
+}
+
+SyncJournalSnapshot::StringRef SyncJournalSnapshot::addString(const QByteArray &str)
+{
+    StringRef ref;
+    ref.offset = static_cast<quint32>(_strings.size());
+    ref.size = static_cast<quint32>(str.size());
+    _strings.append(str);
+    return ref;
+}
+
+QByteArray SyncJournalSnapshot::string(StringRef ref) const
+{
+    return QByteArray(_strings.constData() + ref.offset, static_cast<int>(ref.size));
+}
+
+bool SyncJournalSnapshot::equals(StringRef ref, const QByteArray &str) const
+{
+    return ref.size == static_cast<quint32>(str.size())
+        && memcmp(_strings.constData() + ref.offset, str.constData(), ref.size) == 0;
+}
+
+SyncJournalFileRecord SyncJournalSnapshot::record(const Entry &entry) const
+{
+    SyncJournalFileRecord rec;
+    rec._path = string(entry.path);
+    rec._inode = entry.inode;
+    rec._modtime = entry.modtime;
+    rec._type = static_cast<ItemType>(entry.type);
+    rec._etag = string(entry.etag);
+    rec._fileId = string(entry.fileId);
+    rec._remotePerm = entry.remotePerm;
+    rec._fileSize = entry.fileSize;
+    rec._serverHasIgnoredFiles = entry.serverHasIgnoredFiles;
+    rec._checksumHeader = string(entry.checksumHeader);
+    return rec;
+}
+
+void SyncJournalSnapshot::insert(std::vector<quint32> &table, uint hash, quint32 index)
+{
+    uint slot = hash & _mask;
+    while (table[slot])
+        slot = (slot + 1) & _mask;
+    table[slot] = index + 1;
+}
+
+/*
+ * Calls match for all entries in the probe sequence of hash, until it returns false.
+ */
+template <typename Match>
+void SyncJournalSnapshot::find(const std::vector<quint32> &table, uint hash, Match match) const
+{
+    if (table.empty())
+        return;
+    for (uint slot = hash & _mask; table[slot]; slot = (slot + 1) & _mask) {
+        if (!match(_entries[table[slot] - 1]))
+            return;
+    }
+}
+
+size_t SyncJournalSnapshot::lowerBound(const QByteArray &dirPrefix) const
+{
+    const auto keySize = static_cast<quint32>(dirPrefix.size());
+    auto lessThanKey = [&](const Entry &entry, const QByteArray &) {
+        // Compare the path with a trailing '/' to the key, like sqlite would
+        auto path = reinterpret_cast<const uchar *>(_strings.constData() + entry.path.offset);
+        auto key = reinterpret_cast<const uchar *>(dirPrefix.constData());
+        auto common = qMin(entry.path.size, keySize);
+        int cmp = memcmp(path, key, common);
+        if (cmp != 0)
+            return cmp < 0;
+        if (entry.path.size >= keySize)
+            return false;
+        if (key[entry.path.size] != '/')
+            return '/' < key[entry.path.size];
+        return entry.path.size + 1 < keySize;
+    };
+    return std::lower_bound(_entries.begin(), _entries.end(), dirPrefix, lessThanKey) - _entries.begin();
+}
+
+void SyncJournalSnapshot::forEachBelow(const QByteArray &path, const std::function<void(const Entry &, int)> &callback) const
+{
+    if (path.isEmpty()) {
+        for (const auto &entry : _entries)
+            callback(entry, 0);
+        return;
+    }
+
+    const QByteArray dirPrefix = path + '/';
+    for (auto i = lowerBound(dirPrefix); i < _entries.size(); ++i) {
+        const auto &entry = _entries[i];
+        if (equals(entry.path, path))
+            continue; // the directory itself sorts right before its content
+        if (entry.path.size < static_cast<quint32>(dirPrefix.size())
+            || memcmp(_strings.constData() + entry.path.offset, dirPrefix.constData(), dirPrefix.size()) != 0) {
+            break;
+        }
+        callback(entry, dirPrefix.size());
+    }
+}
+
+} // namespace OCC
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef SYNCJOURNALSNAPSHOT_H
+#define SYNCJOURNALSNAPSHOT_H
+
+#include <QByteArray>
+
+#include <functional>
+#include <vector>
+
+#include "ocsynclib.h"
+#include "common/syncjournalfilerecord.h"
+
+namespace OCC {
+
+/**
+ * @brief Read-only in-memory copy of the metadata table of the journal
+ * @ingroup libsync
+ *
+ * The strings of all records are stored in one contiguous buffer, and the
+ * records are found through open addressing hash tables keyed by phash, inode
+ * and file id. Lookups don't need sqlite and don't allocate besides the
+ * returned records.
+ *
+ * The records are kept in the order of getFilesBelowPath() (path + '/'), so
+ * that the records of a subtree are a contiguous range.
+ */
+class OCSYNC_EXPORT SyncJournalSnapshot
+{
+public:
+    /**
+     * Adds a record to the snapshot.
+     *
+     * Records must be added ordered by path + '/', and build() must be
+     * called once all records were added.
+     */
+    void append(const SyncJournalFileRecord &rec);
+
+    /// Builds the lookup tables.
+    void build();
+
+    int size() const { return static_cast<int>(_entries.size()); }
+
+    /// Sets rec to the record with the given path, or to an invalid record.
+    void getFileRecord(const QByteArray &path, SyncJournalFileRecord *rec) const;
+    /// Sets rec to a record with the given inode, or to an invalid record.
+    void getFileRecordByInode(quint64 inode, SyncJournalFileRecord *rec) const;
+    void getFileRecordsByFileId(const QByteArray &fileId, const std::function<void(const SyncJournalFileRecord &)> &rowCallback) const;
+    void getFilesBelowPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord &)> &rowCallback) const;
+    void getFilesInDirectory(const QByteArray &path, const std::function<void(const SyncJournalFileRecord &)> &rowCallback) const;
+
+private:
+    struct StringRef
+    {
+        quint32 offset = 0;
+        quint32 size = 0;
+    };
+
+    struct Entry
+    {
+        StringRef path;
+        StringRef etag;
+        StringRef fileId;
+        StringRef checksumHeader;
+        quint64 inode;
+        qint64 modtime;
+        qint64 fileSize;
+        RemotePermissions remotePerm;
+        quint8 type;
+        bool serverHasIgnoredFiles;
+    };
+
+    StringRef addString(const QByteArray &str);
+    QByteArray string(StringRef ref) const;
+    bool equals(StringRef ref, const QByteArray &str) const;
+    SyncJournalFileRecord record(const Entry &entry) const;
+
+    void insert(std::vector<quint32> &table, uint hash, quint32 index);
+    template <typename Match>
+    void find(const std::vector<quint32> &table, uint hash, Match match) const;
+
+    // Index of the first entry that sorts after dirPrefix ("dir/"), like
+    // path||'/' >= dirPrefix
+    size_t lowerBound(const QByteArray &dirPrefix) const;
+    void forEachBelow(const QByteArray &path, const std::function<void(const Entry &, int relativeStart)> &callback) const;
+
+    QByteArray _strings;
+    std::vector<Entry> _entries;
+
+    // The tables contain the index of the entry + 1, 0 marks an empty slot
+    std::vector<quint32> _byPHash;
+    std::vector<quint32> _byInode;
+    std::vector<quint32> _byFileId;
+    uint _mask = 0;
+};
+
+} // namespace OCC
+
+#endif // SYNCJOURNALSNAPSHOT_H
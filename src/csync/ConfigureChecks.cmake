@@ -16,6 +16,7 @@ set(SOURCEDIR ${CMAKE_CURRENT_SOURCE_DIR})
 
 # HEADER FILES
 check_include_file(argp.h HAVE_ARGP_H)
+check_include_file(linux/io_uring.h HAVE_LINUX_IO_URING_H)
 
 # FUNCTIONS
 if (NOT LINUX)
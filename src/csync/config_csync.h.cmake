@@ -7,6 +7,7 @@
 #cmakedefine SOURCEDIR "${SOURCEDIR}"
 
 #cmakedefine HAVE_ARGP_H 1
+#cmakedefine HAVE_LINUX_IO_URING_H 1
 
 #cmakedefine HAVE_TIMEGM 1
 #cmakedefine HAVE_STRERROR_R 1
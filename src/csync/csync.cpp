@@ -44,6 +44,7 @@
 #include "csync_reconcile.h"
 
 #include "vio/csync_vio.h"
+#include "vio/csync_vio_local_prefetch.h"
 
 #include "csync_rename.h"
 #include "common/c_jhash.h"
@@ -88,7 +89,15 @@ int csync_update(CSYNC *ctx) {
 
   qCInfo(lcCSync, "## Starting local discovery ##");
 
-  rc = csync_ftw(ctx, ctx->local.uri, csync_walker, MAX_DEPTH);
+  {
+      std::unique_ptr<LocalDirectoryPrefetcher> prefetcher;
+      if (ctx->local.prefetch_threads > 1) {
+          prefetcher.reset(new LocalDirectoryPrefetcher(ctx->local.prefetch_threads));
+      }
+      ctx->local.prefetcher = prefetcher.get();
+      rc = csync_ftw(ctx, ctx->local.uri, csync_walker, MAX_DEPTH);
+      ctx->local.prefetcher = nullptr;
+  }
   if (rc < 0) {
     if(ctx->status_code == CSYNC_STATUS_OK) {
         ctx->status_code = csync_errno_to_status(errno, CSYNC_STATUS_UPDATE_ERROR);
@@ -106,6 +115,10 @@ int csync_update(CSYNC *ctx) {
 
   qCInfo(lcCSync, "## Starting remote discovery ##");
 
+  // The remote tree usually has about as many entries as the local one,
+  // avoid rehashing while it grows.
+  ctx->remote.files.reserve(ctx->local.files.size());
+
   rc = csync_ftw(ctx, "", csync_walker, MAX_DEPTH);
   if (rc < 0) {
       if(ctx->status_code == CSYNC_STATUS_OK) {
@@ -239,6 +252,7 @@ int csync_s::reinitialize() {
 
   local.files.clear();
   remote.files.clear();
+  remote.unreconciled.clear();
 
   renames.folder_renamed_from.clear();
   renames.folder_renamed_to.clear();
@@ -93,6 +93,7 @@ enum csync_status_codes_e {
     CSYNC_STATUS_INDIVIDUAL_TOO_DEEP,
     CSYNC_STATUS_INDIVIDUAL_IS_CONFLICT_FILE,
     CSYNC_STATUS_INDIVIDUAL_CANNOT_ENCODE
+    // Note: csync_file_stat_s::error_status is a BITFIELD(11)
 };
 
 typedef enum csync_status_codes_e CSYNC_STATUS;
@@ -129,6 +130,7 @@ enum csync_instructions_e {
                                                       or back. */
   CSYNC_INSTRUCTION_UPDATE_METADATA = 0x00000400,  /* If the etag has been updated and need to be writen to the db,
                                                       but without any propagation (UPDATE|RECONCILE) */
+  // Note: csync_file_stat_s::instruction is a BITFIELD(12)
 };
 
 // This enum is used with BITFIELD(3) and BITFIELD(4) in several places.
@@ -160,6 +162,12 @@ struct OCSYNC_EXPORT csync_file_stat_s {
   bool child_modified BITFIELD(1);
   bool has_ignored_files BITFIELD(1); // Specify that a directory, or child directory contains ignored files.
   bool is_hidden BITFIELD(1); // Not saved in the DB, only used during discovery for local files.
+  bool reconciled BITFIELD(1); // Already reconciled during the remote discovery, see csync_reconcile_discovered()
+  bool propagated_early BITFIELD(1); // Already handed to callbacks.propagate_early_hook during the discovery
+
+  // Packed with the fields above, there is one of these structs per file in both trees.
+  CSYNC_STATUS error_status BITFIELD(11);
+  enum csync_instructions_e instruction BITFIELD(12);
 
   QByteArray path;
   QByteArray rename_path;
@@ -175,10 +183,6 @@ struct OCSYNC_EXPORT csync_file_stat_s {
   // In both cases, the format is "SHA1:baff".
   QByteArray checksumHeader;
 
-  CSYNC_STATUS error_status;
-
-  enum csync_instructions_e instruction; /* u32 */
-
   csync_file_stat_s()
     : modtime(0)
     , size(0)
@@ -187,6 +191,8 @@ struct OCSYNC_EXPORT csync_file_stat_s {
     , child_modified(false)
     , has_ignored_files(false)
     , is_hidden(false)
+    , reconciled(false)
+    , propagated_early(false)
     , error_status(CSYNC_STATUS_OK)
     , instruction(CSYNC_INSTRUCTION_NONE)
   { }
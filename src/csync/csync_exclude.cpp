@@ -40,6 +40,8 @@
 #include <QFile>
 #include <QDir>
 
+#include <algorithm>
+
 
 /** Expands C-like escape sequences (in place)
  */
@@ -240,6 +242,124 @@ static CSYNC_EXCLUDE_TYPE _csync_excluded_common(const char *path, bool excludeC
 }
 
 
+void ExcludeNameMatcher::clear()
+{
+    _exactNames.clear();
+    _suffixes.clear();
+    _suffixLengths.clear();
+    _prefixTrie.clear();
+}
+
+bool ExcludeNameMatcher::add(const QByteArray &pattern)
+{
+    if (pattern.isEmpty())
+        return false;
+
+    const bool suffix = pattern.startsWith('*');
+    const bool prefix = !suffix && pattern.endsWith('*');
+    QByteArray literal = pattern;
+    if (suffix)
+        literal.remove(0, 1);
+    else if (prefix)
+        literal.chop(1);
+
+    for (char c : literal) {
+        switch (c) {
+        case '*':
+        case '?':
+        case '[':
+        case '\\':
+            return false;
+        default:
+            break;
+        }
+        if (_caseInsensitive && (c & 0x80))
+            return false;
+    }
+    if (_caseInsensitive)
+        literal = literal.toLower();
+
+    if (suffix) {
+        _suffixes.insert(literal);
+        auto it = std::lower_bound(_suffixLengths.begin(), _suffixLengths.end(), literal.size());
+        if (it == _suffixLengths.end() || *it != literal.size())
+            _suffixLengths.insert(it, literal.size());
+    } else if (prefix) {
+        if (_prefixTrie.empty())
+            _prefixTrie.emplace_back();
+        quint32 node = 0;
+        for (char c : literal) {
+            auto &children = _prefixTrie[node].children;
+            auto child = std::find_if(children.begin(), children.end(),
+                [c](const std::pair<char, quint32> &p) { return p.first == c; });
+            if (child != children.end()) {
+                node = child->second;
+            } else {
+                auto next = static_cast<quint32>(_prefixTrie.size());
+                children.emplace_back(c, next);
+                _prefixTrie.emplace_back(); // invalidates children
+                node = next;
+            }
+        }
+        _prefixTrie[node].terminal = true;
+    } else {
+        _exactNames.insert(literal);
+    }
+    return true;
+}
+
+bool ExcludeNameMatcher::canMatch(const char *name, size_t len, bool caseInsensitive)
+{
+    // Longer names are excluded before, see _csync_excluded_common()
+    if (len > 255)
+        return false;
+    for (size_t i = 0; i < len; ++i) {
+        if (name[i] == '\n' || (caseInsensitive && (name[i] & 0x80)))
+            return false;
+    }
+    return true;
+}
+
+bool ExcludeNameMatcher::matches(const char *name, size_t len) const
+{
+    char lowered[256];
+    if (_caseInsensitive) {
+        for (size_t i = 0; i < len; ++i) {
+            char c = name[i];
+            lowered[i] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+        }
+        name = lowered;
+    }
+    const int size = static_cast<int>(len);
+
+    if (!_exactNames.isEmpty() && _exactNames.contains(QByteArray::fromRawData(name, size)))
+        return true;
+
+    for (int suffixLength : _suffixLengths) {
+        if (suffixLength > size)
+            break;
+        if (_suffixes.contains(QByteArray::fromRawData(name + size - suffixLength, suffixLength)))
+            return true;
+    }
+
+    if (!_prefixTrie.empty()) {
+        quint32 node = 0;
+        for (int i = 0; !_prefixTrie[node].terminal; ++i) {
+            if (i == size)
+                return false;
+            const auto &children = _prefixTrie[node].children;
+            auto child = std::find_if(children.begin(), children.end(),
+                [c = name[i]](const std::pair<char, quint32> &p) { return p.first == c; });
+            if (child == children.end())
+                return false;
+            node = child->second;
+        }
+        return true;
+    }
+    return false;
+}
+
+
 using namespace OCC;
 
 ExcludedFiles::ExcludedFiles()
@@ -419,21 +539,34 @@ CSYNC_EXCLUDE_TYPE ExcludedFiles::traversalPatternMatch(const char *path, ItemTy
     } else {
         bname = path;
     }
-    QString bnameStr = QString::fromUtf8(bname);
-
-    QRegularExpressionMatch m;
-    if (filetype == ItemTypeDirectory) {
-        m = _bnameTraversalRegexDir.match(bnameStr);
+    const size_t blen = strlen(bname);
+    const bool isDir = filetype == ItemTypeDirectory;
+
+    // Like in the regex, excludes take precedence over exclude-and-remove,
+    // which take precedence over the activation of full path matching.
+    bool removeMatched = false;
+    const QRegularExpression *bnameRegex = nullptr;
+    if (ExcludeNameMatcher::canMatch(bname, blen, _caseInsensitive)) {
+        if (_bnameMatcherFileDirKeep.matches(bname, blen)
+            || (isDir && _bnameMatcherDirKeep.matches(bname, blen))) {
+            return CSYNC_FILE_EXCLUDE_LIST;
+        }
+        removeMatched = _bnameMatcherFileDirRemove.matches(bname, blen)
+            || (isDir && _bnameMatcherDirRemove.matches(bname, blen));
+        bnameRegex = isDir ? &_bnameTraversalRegexDir : &_bnameTraversalRegexFile;
     } else {
-        m = _bnameTraversalRegexFile.match(bnameStr);
+        bnameRegex = isDir ? &_bnameFallbackRegexDir : &_bnameFallbackRegexFile;
     }
-    if (!m.hasMatch())
-        return CSYNC_NOT_EXCLUDED;
-    if (m.capturedStart(QStringLiteral("exclude")) != -1) {
+
+    QRegularExpressionMatch m;
+    if (!bnameRegex->pattern().isEmpty())
+        m = bnameRegex->match(QString::fromUtf8(bname, static_cast<int>(blen)));
+    if (m.hasMatch() && m.capturedStart(QStringLiteral("exclude")) != -1)
         return CSYNC_FILE_EXCLUDE_LIST;
-    } else if (m.capturedStart(QStringLiteral("excluderemove")) != -1) {
+    if (removeMatched || (m.hasMatch() && m.capturedStart(QStringLiteral("excluderemove")) != -1))
         return CSYNC_FILE_EXCLUDE_AND_REMOVE;
-    }
+    if (!m.hasMatch())
+        return CSYNC_NOT_EXCLUDED;
 
     // third capture: full path matching is triggered
     QString pathStr = QString::fromUtf8(path);
@@ -651,6 +784,18 @@ void ExcludedFiles::prepare()
     QString bnameTriggerFileDir;
     QString bnameTriggerDir;
 
+    // The bname patterns that are not handled by the ExcludeNameMatchers
+    QString bnameRegexFileDirKeep;
+    QString bnameRegexFileDirRemove;
+    QString bnameRegexDirKeep;
+    QString bnameRegexDirRemove;
+
+    _caseInsensitive = OCC::Utility::fsCasePreserving();
+    for (auto matcher : { &_bnameMatcherFileDirKeep, &_bnameMatcherFileDirRemove, &_bnameMatcherDirKeep, &_bnameMatcherDirRemove }) {
+        matcher->clear();
+        matcher->setCaseInsensitive(_caseInsensitive);
+    }
+
     auto regexAppend = [](QString &fileDirPattern, QString &dirPattern, const QString &appendMe, bool dirOnly) {
         QString &pattern = dirOnly ? dirPattern : fileDirPattern;
         if (!pattern.isEmpty())
@@ -683,6 +828,15 @@ void ExcludedFiles::prepare()
         auto regexExclude = convertToRegexpSyntax(QString::fromUtf8(exclude), _wildcardsMatchSlash);
         if (!fullPath) {
             regexAppend(bnameFileDir, bnameDir, regexExclude, matchDirOnly);
+
+            auto &matcher = removeExcluded
+                ? (matchDirOnly ? _bnameMatcherDirRemove : _bnameMatcherFileDirRemove)
+                : (matchDirOnly ? _bnameMatcherDirKeep : _bnameMatcherFileDirKeep);
+            if (!matcher.add(exclude)) {
+                regexAppend(removeExcluded ? bnameRegexFileDirRemove : bnameRegexFileDirKeep,
+                    removeExcluded ? bnameRegexDirRemove : bnameRegexDirKeep,
+                    regexExclude, matchDirOnly);
+            }
         } else {
             regexAppend(fullFileDir, fullDir, regexExclude, matchDirOnly);
 
@@ -693,6 +847,12 @@ void ExcludedFiles::prepare()
         }
     }
 
+    // Without these, the _bnameTraversalRegex would never match
+    const bool bnameTraversalRegexFileNeeded = !bnameRegexFileDirKeep.isEmpty()
+        || !bnameRegexFileDirRemove.isEmpty() || !bnameTriggerFileDir.isEmpty();
+    const bool bnameTraversalRegexDirNeeded = bnameTraversalRegexFileNeeded
+        || !bnameRegexDirKeep.isEmpty() || !bnameRegexDirRemove.isEmpty() || !bnameTriggerDir.isEmpty();
+
     // The empty pattern would match everything - change it to match-nothing
     auto emptyMatchNothing = [](QString &pattern) {
         if (pattern.isEmpty())
@@ -711,19 +871,38 @@ void ExcludedFiles::prepare()
     emptyMatchNothing(bnameTriggerFileDir);
     emptyMatchNothing(bnameTriggerDir);
 
+    emptyMatchNothing(bnameRegexFileDirKeep);
+    emptyMatchNothing(bnameRegexFileDirRemove);
+    emptyMatchNothing(bnameRegexDirKeep);
+    emptyMatchNothing(bnameRegexDirRemove);
+
     // The bname regex is applied to the bname only, so it must be
     // anchored in the beginning and in the end. It has the structure:
     // (exclude)|(excluderemove)|(bname triggers).
     // If the third group matches, the fullActivatedRegex needs to be applied
     // to the full path.
-    _bnameTraversalRegexFile.setPattern(
-        "^(?P<exclude>" + bnameFileDirKeep + ")$|"
-        + "^(?P<excluderemove>" + bnameFileDirRemove + ")$|"
-        + "^(?P<trigger>" + bnameTriggerFileDir + ")$");
-    _bnameTraversalRegexDir.setPattern(
-        "^(?P<exclude>" + bnameFileDirKeep + "|" + bnameDirKeep + ")$|"
-        + "^(?P<excluderemove>" + bnameFileDirRemove + "|" + bnameDirRemove + ")$|"
-        + "^(?P<trigger>" + bnameTriggerFileDir + "|" + bnameTriggerDir + ")$");
+    auto bnameRegexFile = [](const QString &fileDirKeep, const QString &fileDirRemove, const QString &triggerFileDir) {
+        return "^(?P<exclude>" + fileDirKeep + ")$|"
+            + "^(?P<excluderemove>" + fileDirRemove + ")$|"
+            + "^(?P<trigger>" + triggerFileDir + ")$";
+    };
+    auto bnameRegexDir = [](const QString &fileDirKeep, const QString &dirKeep, const QString &fileDirRemove,
+                             const QString &dirRemove, const QString &triggerFileDir, const QString &triggerDir) {
+        return "^(?P<exclude>" + fileDirKeep + "|" + dirKeep + ")$|"
+            + "^(?P<excluderemove>" + fileDirRemove + "|" + dirRemove + ")$|"
+            + "^(?P<trigger>" + triggerFileDir + "|" + triggerDir + ")$";
+    };
+    _bnameFallbackRegexFile.setPattern(bnameRegexFile(bnameFileDirKeep, bnameFileDirRemove, bnameTriggerFileDir));
+    _bnameFallbackRegexDir.setPattern(bnameRegexDir(bnameFileDirKeep, bnameDirKeep, bnameFileDirRemove,
+        bnameDirRemove, bnameTriggerFileDir, bnameTriggerDir));
+    // Only the patterns the matchers don't handle, empty when there are none
+    _bnameTraversalRegexFile.setPattern(bnameTraversalRegexFileNeeded
+            ? bnameRegexFile(bnameRegexFileDirKeep, bnameRegexFileDirRemove, bnameTriggerFileDir)
+            : QString());
+    _bnameTraversalRegexDir.setPattern(bnameTraversalRegexDirNeeded
+            ? bnameRegexDir(bnameRegexFileDirKeep, bnameRegexDirKeep, bnameRegexFileDirRemove,
+                  bnameRegexDirRemove, bnameTriggerFileDir, bnameTriggerDir)
+            : QString());
 
     // The full traveral regex is applied to the full path if the trigger capture of
     // the bname regex matches. Its basic form is (exclude)|(excluderemove)".
@@ -771,12 +950,16 @@ void ExcludedFiles::prepare()
         + ")");
 
     QRegularExpression::PatternOptions patternOptions = QRegularExpression::NoPatternOption;
-    if (OCC::Utility::fsCasePreserving())
+    if (_caseInsensitive)
         patternOptions |= QRegularExpression::CaseInsensitiveOption;
     _bnameTraversalRegexFile.setPatternOptions(patternOptions);
     _bnameTraversalRegexFile.optimize();
     _bnameTraversalRegexDir.setPatternOptions(patternOptions);
     _bnameTraversalRegexDir.optimize();
+    _bnameFallbackRegexFile.setPatternOptions(patternOptions);
+    _bnameFallbackRegexFile.optimize();
+    _bnameFallbackRegexDir.setPatternOptions(patternOptions);
+    _bnameFallbackRegexDir.optimize();
     _fullTraversalRegexFile.setPatternOptions(patternOptions);
     _fullTraversalRegexFile.optimize();
     _fullTraversalRegexDir.setPatternOptions(patternOptions);
@@ -31,6 +31,8 @@
 #include <QRegularExpression>
 
 #include <functional>
+#include <utility>
+#include <vector>
 
 enum csync_exclude_type_e {
   CSYNC_NOT_EXCLUDED   = 0,
@@ -49,6 +51,52 @@ typedef enum csync_exclude_type_e CSYNC_EXCLUDE_TYPE;
 
 class ExcludedFilesTest;
 
+/**
+ * Matches file names against the exclude patterns that don't need a regular
+ * expression: exact names, "*suffix" and "prefix*".
+ *
+ * Exact names and suffixes are looked up in hash sets, prefixes in a trie.
+ * Everything works on the UTF-8 bytes of the name. Case insensitive matching
+ * is only done for ASCII, see canMatch().
+ */
+class OCSYNC_EXPORT ExcludeNameMatcher
+{
+public:
+    void clear();
+    void setCaseInsensitive(bool caseInsensitive) { _caseInsensitive = caseInsensitive; }
+
+    /**
+     * Adds the pattern if it has one of the supported shapes.
+     *
+     * Returns false if the pattern needs to be matched in another way.
+     */
+    bool add(const QByteArray &pattern);
+
+    /**
+     * Whether matches() gives the same result as the regular expression
+     * built from the patterns for the given name.
+     *
+     * That's not the case for names with a newline (the regex would match
+     * "name\n" for "name") and, when case insensitive, for non-ASCII names.
+     */
+    static bool canMatch(const char *name, size_t len, bool caseInsensitive);
+
+    bool matches(const char *name, size_t len) const;
+
+private:
+    struct TrieNode
+    {
+        bool terminal = false;
+        std::vector<std::pair<char, quint32>> children;
+    };
+
+    bool _caseInsensitive = false;
+    QSet<QByteArray> _exactNames;
+    QSet<QByteArray> _suffixes;
+    std::vector<int> _suffixLengths; // sorted
+    std::vector<TrieNode> _prefixTrie; // the root is the first node
+};
+
 /**
  * Manages file/directory exclusion.
  *
@@ -216,6 +264,12 @@ private:
      * Note: The traversal matcher will return not-excluded on some paths that the
      * full matcher would exclude. Example: "b" is excluded. traversal("b/c")
      * returns not-excluded because "c" isn't a bname activation pattern.
+     *
+     * Most bname patterns are exact names or simple "*.ext"/"prefix*" globs.
+     * These are put into the ExcludeNameMatcher instances and left out of
+     * _bnameTraversalRegex, which then often only contains the activation
+     * patterns. The _bnameFallbackRegex contains all bname patterns for the
+     * names the matchers can't handle.
      */
     void prepare();
 
@@ -229,8 +283,14 @@ private:
     QList<QByteArray> _allExcludes;
 
     /// see prepare()
-    QRegularExpression _bnameTraversalRegexFile;
-    QRegularExpression _bnameTraversalRegexDir;
+    ExcludeNameMatcher _bnameMatcherFileDirKeep;
+    ExcludeNameMatcher _bnameMatcherFileDirRemove;
+    ExcludeNameMatcher _bnameMatcherDirKeep;
+    ExcludeNameMatcher _bnameMatcherDirRemove;
+    QRegularExpression _bnameTraversalRegexFile; // empty if not needed
+    QRegularExpression _bnameTraversalRegexDir; // empty if not needed
+    QRegularExpression _bnameFallbackRegexFile;
+    QRegularExpression _bnameFallbackRegexDir;
     QRegularExpression _fullTraversalRegexFile;
     QRegularExpression _fullTraversalRegexDir;
     QRegularExpression _fullRegexFile;
@@ -238,6 +298,9 @@ private:
 
     bool _excludeConflictFiles = true;
 
+    /// Whether the patterns are matched case insensitively, see prepare()
+    bool _caseInsensitive = false;
+
     /**
      * Whether * and ? in patterns can match a /
      *
@@ -38,6 +38,7 @@
 #include <stdbool.h>
 #include <map>
 #include <set>
+#include <vector>
 #include <functional>
 
 #include "common/syncjournaldb.h"
@@ -49,6 +50,8 @@
 #include "csync_exclude.h"
 #include "csync_macros.h"
 
+class LocalDirectoryPrefetcher;
+
 /**
  * How deep to scan directories.
  */
@@ -142,6 +145,10 @@ struct OCSYNC_EXPORT csync_s {
       csync_checksum_hook checksum_hook = nullptr;
       void *checksum_userdata = nullptr;
 
+      /* hook for new remote entries that were reconciled during the discovery and can be
+       * propagated before it is done (uses the update_callback_userdata) */
+      void (*propagate_early_hook)(void *, const csync_file_stat_t *) = nullptr;
+
   } callbacks;
 
   OCC::SyncJournalDb *statedb;
@@ -162,11 +169,20 @@ struct OCSYNC_EXPORT csync_s {
   struct {
     char *uri = nullptr;
     FileMap files;
+
+    /* Number of threads reading local directories ahead of the update phase.
+     * With 0 or 1, every directory is read when it is entered. */
+    int prefetch_threads = 0;
+    /* Only set while the local tree is walked, see LocalDirectoryPrefetcher */
+    LocalDirectoryPrefetcher *prefetcher = nullptr;
   } local;
 
   struct {
     FileMap files;
     bool read_from_db = false;
+    /* Paths added to the remote tree that were not reconciled yet, in the order
+     * they were discovered. Only used with reconcile_during_discovery. */
+    std::vector<QByteArray> unreconciled;
     OCC::RemotePermissions root_perms; /* Permission of the root folder. (Since the root folder is not in the db tree, we need to keep a separate entry.) */
   } remote;
 
@@ -177,6 +193,16 @@ struct OCSYNC_EXPORT csync_s {
      parent directories */
   csync_file_stat_t *current_fs = nullptr;
 
+  /* The journal entries of a directory, keyed by path. */
+  struct DirectoryRecords {
+      QByteArray path;
+      QHash<QByteArray, OCC::SyncJournalFileRecord> records;
+  };
+
+  /* Used in the update phase: the journal entries of the directory that is being
+     walked, loaded with a single query when entering it. */
+  const DirectoryRecords *current_dir_records = nullptr;
+
   /* csync error code */
   enum csync_status_codes_e status_code = CSYNC_STATUS_OK;
 
@@ -206,6 +232,12 @@ struct OCSYNC_EXPORT csync_s {
    */
   QByteArray placeholder_suffix;
 
+  /**
+   * Whether the remote subtrees are reconciled as soon as they are discovered
+   * completely, see csync_reconcile_discovered().
+   */
+  bool reconcile_during_discovery = false;
+
   csync_s(const char *localUri, OCC::SyncJournalDb *statedb);
   ~csync_s();
   int reinitialize();
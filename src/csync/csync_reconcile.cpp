@@ -484,6 +484,90 @@ static void _csync_merge_algorithm_visitor(csync_file_stat_t *cur, CSYNC * ctx)
     }
 }
 
+/* Whether reconciling the remote entry and its local counterpart has the same
+ * outcome now as after the discovery of the whole remote tree. */
+static bool _csync_can_reconcile_early(CSYNC *ctx, const csync_file_stat_t *remote, const csync_file_stat_t *local)
+{
+    auto isPlaceholder = [](const csync_file_stat_t *fs) {
+        return fs->type == ItemTypePlaceholder || fs->type == ItemTypePlaceholderDownload;
+    };
+
+    /* Rename origins and placeholders are looked up in the whole tree */
+    if (remote->instruction == CSYNC_INSTRUCTION_EVAL_RENAME || isPlaceholder(remote)) {
+        return false;
+    }
+    if (csync_rename_count(ctx)
+        && (csync_rename_adjust_parent_path(ctx, remote->path) != remote->path
+               || csync_rename_adjust_parent_path_source(ctx, remote->path) != remote->path)) {
+        return false;
+    }
+
+    /* An entry that exists locally might be the origin of a remote rename that
+     * is not discovered yet: moved away on the server and recreated there. */
+    if (local) {
+        return false;
+    }
+
+    /* A new remote file has no journal entry, so no local rename can claim it.
+     * Any other remote-only entry might still turn out to be a rename origin. */
+    return remote->instruction == CSYNC_INSTRUCTION_NEW;
+}
+
+/* Hands a new remote entry to the propagate_early_hook if it can be created
+ * locally before the discovery is done: its parent directory must already
+ * exist locally or have been handed over before. */
+static void _csync_propagate_early(CSYNC *ctx, csync_file_stat_t *remote)
+{
+    if (!ctx->callbacks.propagate_early_hook
+        || remote->instruction != CSYNC_INSTRUCTION_NEW
+        || (remote->type != ItemTypeFile && remote->type != ItemTypeDirectory)) {
+        return;
+    }
+
+    const int slash = remote->path.lastIndexOf('/');
+    if (slash > 0) {
+        const QByteArray parentPath = remote->path.left(slash);
+        const csync_file_stat_t *localParent = ctx->local.files.findFile(parentPath);
+        const csync_file_stat_t *remoteParent = ctx->remote.files.findFile(parentPath);
+        if (!remoteParent || remoteParent->type != ItemTypeDirectory) {
+            return;
+        }
+        const bool parentExists = localParent && localParent->type == ItemTypeDirectory
+            && localParent->instruction != CSYNC_INSTRUCTION_IGNORE;
+        if (!parentExists && !remoteParent->propagated_early) {
+            return;
+        }
+    }
+
+    remote->propagated_early = true;
+    ctx->callbacks.propagate_early_hook(ctx->callbacks.update_callback_userdata, remote);
+}
+
+void csync_reconcile_discovered(CSYNC *ctx, size_t first) {
+  auto &paths = ctx->remote.unreconciled;
+  const auto current = ctx->current;
+
+  for (size_t i = first; i < paths.size(); ++i) {
+    csync_file_stat_t *remote = ctx->remote.files.findFile(paths[i]);
+    if (!remote || remote->reconciled) {
+      continue;
+    }
+    csync_file_stat_t *local = ctx->local.files.findFile(paths[i]);
+    if (!_csync_can_reconcile_early(ctx, remote, local)) {
+      continue;
+    }
+
+    ctx->current = REMOTE_REPLICA;
+    _csync_merge_algorithm_visitor(remote, ctx);
+    remote->reconciled = true;
+
+    _csync_propagate_early(ctx, remote);
+  }
+
+  ctx->current = current;
+  paths.resize(first);
+}
+
 void csync_reconcile_updates(CSYNC *ctx) {
   csync_s::FileMap *tree = nullptr;
 
@@ -499,6 +583,9 @@ void csync_reconcile_updates(CSYNC *ctx) {
   }
 
   for (auto &pair : *tree) {
+    if (pair.second->reconciled) {
+      continue;
+    }
     _csync_merge_algorithm_visitor(pair.second.get(), ctx);
   }
 }
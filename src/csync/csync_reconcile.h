@@ -50,6 +50,28 @@
  */
 void OCSYNC_EXPORT csync_reconcile_updates(CSYNC *ctx);
 
+/**
+ * @brief Reconcile remote entries whose subtree was discovered completely.
+ *
+ * Called during the remote discovery, once all the entries in
+ * ctx->remote.unreconciled from index first on and everything below them
+ * are in the remote tree. The local tree is complete at that point.
+ *
+ * Only the entries whose outcome can't depend on entries that are not
+ * discovered yet are reconciled: new remote entries without a local entry of
+ * the same path. Everything else, including renames and placeholders, is left
+ * for csync_reconcile_updates().
+ *
+ * The processed paths are removed from ctx->remote.unreconciled.
+ *
+ * New remote entries that can be created locally right away are passed to
+ * ctx->callbacks.propagate_early_hook and marked as propagated_early.
+ *
+ * @param  ctx          The csync context to use.
+ * @param  first        The index of the first entry of the subtree.
+ */
+void OCSYNC_EXPORT csync_reconcile_discovered(CSYNC *ctx, size_t first);
+
 /**
  * }@
  */
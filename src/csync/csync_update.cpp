@@ -36,6 +36,7 @@
 #include "csync_private.h"
 #include "csync_exclude.h"
 #include "csync_update.h"
+#include "csync_reconcile.h"
 #include "csync_util.h"
 #include "csync_misc.h"
 
@@ -95,6 +96,21 @@ static bool _csync_mtime_equal(time_t a, time_t b)
     return false;
 }
 
+/* Looks up the journal entry for path, from the entries of the current
+ * directory if they were loaded. */
+static bool _csync_get_file_record(CSYNC *ctx, const QByteArray &path, OCC::SyncJournalFileRecord *rec) {
+  auto dir_records = ctx->current_dir_records;
+  if (dir_records) {
+      int slash = path.lastIndexOf('/');
+      QByteArray parent = slash < 0 ? QByteArray() : path.left(slash);
+      if (parent == dir_records->path) {
+          *rec = dir_records->records.value(path);
+          return true;
+      }
+  }
+  return ctx->statedb->getFileRecord(path, rec);
+}
+
 /**
  * The main function of the discovery/update pass.
  *
@@ -182,7 +198,7 @@ static int _csync_detect_update(CSYNC *ctx, std::unique_ptr<csync_file_stat_t> f
    * renamed, the db gets queried by the inode of the file as that one
    * does not change on rename.
    */
-  if(!ctx->statedb->getFileRecord(fs->path, &base)) {
+  if(!_csync_get_file_record(ctx, fs->path, &base)) {
       ctx->status_code = CSYNC_STATUS_UNSUCCESSFUL;
       return -1;
   }
@@ -194,7 +210,7 @@ static int _csync_detect_update(CSYNC *ctx, std::unique_ptr<csync_file_stat_t> f
   if (ctx->current == REMOTE_REPLICA && !base.isValid() && fs->type == ItemTypeFile) {
       auto placeholderPath = fs->path;
       placeholderPath.append(ctx->placeholder_suffix);
-      ctx->statedb->getFileRecord(placeholderPath, &base);
+      _csync_get_file_record(ctx, placeholderPath, &base);
       if (base.isValid() && base._type == ItemTypePlaceholder) {
           fs->type = ItemTypePlaceholder;
           fs->path = placeholderPath;
@@ -491,6 +507,9 @@ out:
       ctx->local.files[path] = std::move(fs);
       break;
     case REMOTE_REPLICA:
+      if (ctx->reconcile_during_discovery) {
+        ctx->remote.unreconciled.push_back(path);
+      }
       ctx->remote.files[path] = std::move(fs);
       break;
     default:
@@ -588,6 +607,9 @@ static bool fill_tree_from_db(CSYNC *ctx, const char *uri, bool singleFile = fal
         }
 
         /* store into result list. */
+        if (ctx->current == REMOTE_REPLICA && ctx->reconcile_during_discovery) {
+            ctx->remote.unreconciled.push_back(rec._path);
+        }
         files[rec._path] = std::move(st);
         ++count;
     };
@@ -635,12 +657,15 @@ static bool mark_current_item_ignored( CSYNC *ctx, csync_file_stat_t *previous_f
 int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     unsigned int depth) {
   QByteArray filename;
+  QByteArray path;
   QByteArray fullpath;
   csync_vio_handle_t *dh = NULL;
   std::unique_ptr<csync_file_stat_t> dirent;
   csync_file_stat_t *previous_fs = NULL;
   int read_from_db = 0;
   int rc = 0;
+  csync_s::DirectoryRecords dir_records;
+  const csync_s::DirectoryRecords *previous_dir_records = ctx->current_dir_records;
 
   bool do_read_from_db = (ctx->current == REMOTE_REPLICA && ctx->remote.read_from_db);
   const char *db_uri = uri;
@@ -714,6 +739,23 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
       goto error;
   }
 
+  /* Load the journal entries of the whole directory at once instead of
+   * querying the database for every file in _csync_detect_update. */
+  dir_records.path = uri;
+  if (ctx->current == LOCAL_REPLICA) {
+      const char *local_uri = uri + strlen(ctx->local.uri);
+      if (*local_uri == '/')
+          ++local_uri;
+      dir_records.path = local_uri;
+  }
+  if (!ctx->statedb->getFilesInDirectory(dir_records.path, [&dir_records](const OCC::SyncJournalFileRecord &rec) {
+          dir_records.records.insert(rec._path, rec);
+      })) {
+      ctx->status_code = CSYNC_STATUS_UNSUCCESSFUL;
+      goto error;
+  }
+  ctx->current_dir_records = &dir_records;
+
   while ((dirent = csync_vio_readdir(ctx, dh))) {
     /* Conversion error */
     if (dirent->path.isEmpty() && !dirent->original_path.isEmpty()) {
@@ -735,10 +777,12 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
       continue;
     }
 
-    if (uri[0] == '\0') {
-        fullpath = filename;
+    // The path relative to the sync root for the local replica, or to the data root on the remote.
+    // The absolute local path is only built when it is needed, to descend into a directory.
+    if (dir_records.path.isEmpty()) {
+        path = filename;
     } else {
-        fullpath = QByteArray() % uri % '/' % filename;
+        path = QByteArray() % dir_records.path % '/' % filename;
     }
 
     // When encountering placeholder files, read the relevant
@@ -746,11 +790,9 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     if (ctx->current == LOCAL_REPLICA
         && dirent->type == ItemTypeFile
         && filename.endsWith(ctx->placeholder_suffix)) {
-        QByteArray db_uri = fullpath.mid(strlen(ctx->local.uri) + 1);
-
-        if( ! fill_tree_from_db(ctx, db_uri.constData(), true) ) {
+        if( ! fill_tree_from_db(ctx, path.constData(), true) ) {
             qCWarning(lcUpdate) << "Placeholder without db entry for" << filename;
-            QFile::remove(fullpath);
+            QFile::remove(QByteArray() % uri % '/' % filename);
         }
 
         continue;
@@ -766,13 +808,7 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
         }
     }
 
-    // Now process to have a relative path to the sync root for the local replica, or to the data root on the remote.
-    dirent->path = fullpath;
-    if (ctx->current == LOCAL_REPLICA) {
-        ASSERT(dirent->path.startsWith(ctx->local.uri)); // path is relative to uri
-        // "len + 1" to include the slash in-between.
-        dirent->path = dirent->path.mid(strlen(ctx->local.uri) + 1);
-    }
+    dirent->path = path;
 
     previous_fs = ctx->current_fs;
     bool recurse = dirent->type == ItemTypeDirectory;
@@ -792,6 +828,21 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
 
     if (recurse && rc == 0
         && (!ctx->current_fs || ctx->current_fs->instruction != CSYNC_INSTRUCTION_IGNORE)) {
+      if (ctx->current == LOCAL_REPLICA) {
+          fullpath = QByteArray() % uri % '/' % filename;
+      } else {
+          fullpath = path;
+      }
+      size_t unreconciled = ctx->remote.unreconciled.size();
+      /* A new remote directory can be decided before its content, so that the
+       * content can be propagated early into it */
+      if (ctx->current == REMOTE_REPLICA && ctx->reconcile_during_discovery
+          && ctx->callbacks.propagate_early_hook && ctx->current_fs
+          && ctx->current_fs->instruction == CSYNC_INSTRUCTION_NEW
+          && unreconciled > 0 && ctx->remote.unreconciled.back() == ctx->current_fs->path
+          && !ctx->local.files.findFile(ctx->current_fs->path)) {
+          csync_reconcile_discovered(ctx, --unreconciled);
+      }
       rc = csync_ftw(ctx, fullpath, fn, depth - 1);
       if (rc < 0) {
         ctx->current_fs = previous_fs;
@@ -811,6 +862,11 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
           /* If a directory has ignored files, put the flag on the parent directory as well */
           previous_fs->has_ignored_files = ctx->current_fs->has_ignored_files;
       }
+
+      /* Everything below this directory is known now */
+      if (ctx->current == REMOTE_REPLICA && ctx->reconcile_during_discovery) {
+          csync_reconcile_discovered(ctx, unreconciled);
+      }
     }
 
     if (ctx->current_fs && previous_fs && ctx->current_fs->child_modified) {
@@ -823,12 +879,14 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
   }
 
   csync_vio_closedir(ctx, dh);
+  ctx->current_dir_records = previous_dir_records;
   qCDebug(lcUpdate, " <= Closing walk for %s with read_from_db %d", uri, read_from_db);
 
   return rc;
 
 error:
   ctx->remote.read_from_db = read_from_db;
+  ctx->current_dir_records = previous_dir_records;
   if (dh != NULL) {
     csync_vio_closedir(ctx, dh);
   }
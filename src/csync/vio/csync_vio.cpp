@@ -24,14 +24,47 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <string.h>
 #include "common/asserts.h"
 
 #include "csync_private.h"
 #include "csync_util.h"
 #include "vio/csync_vio.h"
 #include "vio/csync_vio_local.h"
+#include "vio/csync_vio_local_prefetch.h"
 #include "common/c_jhash.h"
 
+/* Schedule reading the sub directories of a local directory that the update phase will enter. */
+static void _csync_vio_prefetch_subdirectories(CSYNC *ctx, const char *name, const LocalDirectoryListing &listing) {
+  const QByteArray dirPath(name);
+  const int rootLength = strlen(ctx->local.uri);
+  if (!dirPath.startsWith(ctx->local.uri)) {
+      return;
+  }
+
+  for (const auto &fs : listing.entries) {
+      if (fs->type != ItemTypeDirectory || fs->path.isEmpty()) {
+          continue;
+      }
+      if (ctx->ignore_hidden_files && (fs->is_hidden || fs->path.startsWith('.'))) {
+          continue;
+      }
+
+      const QByteArray fullPath = dirPath + '/' + fs->path;
+      // "len + 1" to include the slash in-between.
+      const QByteArray relativePath = fullPath.mid(rootLength + 1);
+      if (ctx->exclude_traversal_fn
+          && ctx->exclude_traversal_fn(relativePath, ItemTypeDirectory) != CSYNC_NOT_EXCLUDED) {
+          continue;
+      }
+      // Will be read from the database, see csync_ftw
+      if (ctx->should_discover_locally_fn && !ctx->should_discover_locally_fn(relativePath)) {
+          continue;
+      }
+      ctx->local.prefetcher->prefetch(fullPath);
+  }
+}
+
 csync_vio_handle_t *csync_vio_opendir(CSYNC *ctx, const char *name) {
   switch(ctx->current) {
     case REMOTE_REPLICA:
@@ -42,6 +75,15 @@ csync_vio_handle_t *csync_vio_opendir(CSYNC *ctx, const char *name) {
 	if( ctx->callbacks.update_callback ) {
         ctx->callbacks.update_callback(/*local=*/true, name, ctx->callbacks.update_callback_userdata);
 	}
+      if (ctx->local.prefetcher) {
+          auto listing = ctx->local.prefetcher->take(name);
+          if (listing->error != 0) {
+              errno = listing->error;
+              return NULL;
+          }
+          _csync_vio_prefetch_subdirectories(ctx, name, *listing);
+          return listing.release();
+      }
       return csync_vio_local_opendir(name);
       break;
     default:
@@ -65,6 +107,14 @@ int csync_vio_closedir(CSYNC *ctx, csync_vio_handle_t *dhandle) {
       rc = 0;
       break;
   case LOCAL_REPLICA:
+      if (ctx->local.prefetcher) {
+          auto listing = static_cast<LocalDirectoryListing *>(dhandle);
+          // The update phase is done with this directory, what it skipped below won't be taken
+          ctx->local.prefetcher->dropBelow(listing->path);
+          delete listing;
+          rc = 0;
+          break;
+      }
       rc = csync_vio_local_closedir(dhandle);
       break;
   default:
@@ -81,6 +131,15 @@ std::unique_ptr<csync_file_stat_t> csync_vio_readdir(CSYNC *ctx, csync_vio_handl
       return ctx->callbacks.remote_readdir_hook(dhandle, ctx->callbacks.vio_userdata);
       break;
     case LOCAL_REPLICA:
+      if (ctx->local.prefetcher) {
+          auto listing = static_cast<LocalDirectoryListing *>(dhandle);
+          if (listing->entries.empty()) {
+              return NULL;
+          }
+          auto file_stat = std::move(listing->entries.front());
+          listing->entries.pop_front();
+          return file_stat;
+      }
       return csync_vio_local_readdir(dhandle);
       break;
     default:
@@ -0,0 +1,132 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <errno.h>
+
+#include "csync_private.h"
+#include "vio/csync_vio_local.h"
+#include "vio/csync_vio_local_prefetch.h"
+
+#include <QtConcurrent>
+
+Q_LOGGING_CATEGORY(lcCSyncVIOPrefetch, "sync.csync.vio_prefetch", QtInfoMsg)
+
+LocalDirectoryPrefetcher::LocalDirectoryPrefetcher(int threadCount)
+    // Finished listings are kept in memory until they are taken, bound how far
+    // the workers may run ahead.
+    : _maxEntries(16 * threadCount)
+{
+    _pool.setMaxThreadCount(threadCount);
+}
+
+LocalDirectoryPrefetcher::~LocalDirectoryPrefetcher()
+{
+    _pool.clear();
+    _pool.waitForDone();
+}
+
+void LocalDirectoryPrefetcher::prefetch(const QByteArray &path)
+{
+    {
+        QMutexLocker locker(&_mutex);
+        if (_entries.size() >= _maxEntries || _entries.contains(path))
+            return;
+        _entries.insert(path, std::make_shared<Entry>());
+    }
+    QtConcurrent::run(&_pool, [this, path] { run(path); });
+}
+
+void LocalDirectoryPrefetcher::run(const QByteArray &path)
+{
+    std::shared_ptr<Entry> entry;
+    {
+        QMutexLocker locker(&_mutex);
+        entry = _entries.value(path);
+        if (!entry || entry->state != State::Queued)
+            return; // taken in the meantime
+        entry->state = State::Running;
+    }
+
+    auto listing = readDirectory(path);
+
+    QMutexLocker locker(&_mutex);
+    entry->listing = std::move(listing);
+    entry->state = State::Done;
+    _finished.wakeAll();
+}
+
+std::unique_ptr<LocalDirectoryListing> LocalDirectoryPrefetcher::take(const QByteArray &path)
+{
+    {
+        QMutexLocker locker(&_mutex);
+        auto entry = _entries.value(path);
+        if (entry) {
+            while (entry->state == State::Running)
+                _finished.wait(&_mutex);
+            _entries.remove(path);
+            if (entry->state == State::Done)
+                return std::move(entry->listing);
+            // Not started yet: don't wait for a worker to get there, the
+            // worker skips it since it is no longer in _entries.
+        }
+    }
+    return readDirectory(path);
+}
+
+void LocalDirectoryPrefetcher::dropBelow(const QByteArray &path)
+{
+    const QByteArray prefix = path + '/';
+    QMutexLocker locker(&_mutex);
+    for (auto it = _entries.begin(); it != _entries.end();) {
+        if (it.key().startsWith(prefix)) {
+            // A running worker still holds the entry and finishes it unseen
+            qCDebug(lcCSyncVIOPrefetch) << "Dropping the unused listing of" << it.key();
+            it = _entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+int LocalDirectoryPrefetcher::pendingCount()
+{
+    QMutexLocker locker(&_mutex);
+    return _entries.size();
+}
+
+std::unique_ptr<LocalDirectoryListing> LocalDirectoryPrefetcher::readDirectory(const QByteArray &path)
+{
+    std::unique_ptr<LocalDirectoryListing> listing(new LocalDirectoryListing);
+    listing->path = path;
+
+    csync_vio_handle_t *dh = csync_vio_local_opendir(path.constData());
+    if (!dh) {
+        listing->error = errno;
+        if (listing->error == 0)
+            listing->error = EIO;
+        qCDebug(lcCSyncVIOPrefetch) << "opendir failed for" << path << listing->error;
+        return listing;
+    }
+    while (auto dirent = csync_vio_local_readdir(dh)) {
+        listing->entries.push_back(std::move(dirent));
+    }
+    csync_vio_local_closedir(dh);
+    return listing;
+}
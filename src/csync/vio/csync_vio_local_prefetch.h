@@ -0,0 +1,102 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include "csync.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+#include <deque>
+#include <memory>
+
+/**
+ * The complete content of a local directory, as read by
+ * csync_vio_local_opendir/readdir.
+ */
+struct OCSYNC_EXPORT LocalDirectoryListing
+{
+    /* The absolute path of the directory */
+    QByteArray path;
+    /* errno of the opendir call, 0 on success */
+    int error = 0;
+    std::deque<std::unique_ptr<csync_file_stat_t>> entries;
+};
+
+/**
+ * Reads local directories on a pool of threads ahead of the update phase.
+ *
+ * The update phase is walking the local tree depth first on a single thread,
+ * doing a readdir and a stat for every entry. When it enters a directory, it
+ * calls prefetch() for the sub directories it is going to visit later, and
+ * takes the listings out with take() once it gets there. The expensive file
+ * system calls thus run in parallel, while the update detection itself and the
+ * insertion into the file map stay on the discovery thread and need no locking.
+ *
+ * A directory that was scheduled but not picked up by a worker yet when it is
+ * needed is read directly by the calling thread instead of waiting. Listings
+ * the update phase did not take when it leaves their parent directory, because
+ * it skipped them, are dropped with dropBelow().
+ */
+class OCSYNC_EXPORT LocalDirectoryPrefetcher
+{
+public:
+    explicit LocalDirectoryPrefetcher(int threadCount);
+    ~LocalDirectoryPrefetcher();
+
+    /* Schedule reading the directory with the given absolute path */
+    void prefetch(const QByteArray &path);
+
+    /* Returns the listing of the directory, reading it now if needed. */
+    std::unique_ptr<LocalDirectoryListing> take(const QByteArray &path);
+
+    /* Forget the listings of all directories below the given one, as they won't be taken */
+    void dropBelow(const QByteArray &path);
+
+    /* The number of listings that are scheduled or finished but not taken */
+    int pendingCount();
+
+    /* Read a directory synchronously */
+    static std::unique_ptr<LocalDirectoryListing> readDirectory(const QByteArray &path);
+
+private:
+    enum class State {
+        Queued,
+        Running,
+        Done
+    };
+    struct Entry
+    {
+        State state = State::Queued;
+        std::unique_ptr<LocalDirectoryListing> listing;
+    };
+
+    void run(const QByteArray &path);
+
+    QThreadPool _pool;
+    QMutex _mutex;
+    QWaitCondition _finished;
+    QHash<QByteArray, std::shared_ptr<Entry>> _entries;
+    int _maxEntries;
+};
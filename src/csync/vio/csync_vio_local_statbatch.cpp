@@ -0,0 +1,329 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config_csync.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <vector>
+
+#include "vio/csync_vio_local_statbatch.h"
+
+#include <QLoggingCategory>
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(STATX_BASIC_STATS)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+// IORING_OP_STATX is an enum value, IORING_FEAT_RW_CUR_POS was added in the same kernel version
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(IORING_FEAT_RW_CUR_POS)
+#define CSYNC_USE_IO_URING 1
+#endif
+#endif
+
+Q_LOGGING_CATEGORY(lcCSyncVIOStatBatch, "sync.csync.vio_statbatch", QtInfoMsg)
+
+#ifdef CSYNC_USE_IO_URING
+
+#define STAT_RING_ENTRIES 256
+
+/*
+ * A minimal io_uring, without liburing: the submission and completion
+ * queues mapped from the kernel, only used from one thread.
+ */
+struct LocalStatBatch::Ring
+{
+    int fd = -1;
+
+    void *sqRing = MAP_FAILED;
+    size_t sqRingSize = 0;
+    void *cqRing = MAP_FAILED;
+    size_t cqRingSize = 0;
+    struct io_uring_sqe *sqes = static_cast<struct io_uring_sqe *>(MAP_FAILED);
+    size_t sqesSize = 0;
+
+    unsigned *sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned *sqArray = nullptr;
+    unsigned sqEntries = 0;
+
+    unsigned *cqHead = nullptr;
+    unsigned *cqTail = nullptr;
+    unsigned cqMask = 0;
+    struct io_uring_cqe *cqes = nullptr;
+
+    // Buffers the kernel writes the statx results to
+    std::vector<struct statx> results;
+
+    ~Ring()
+    {
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqesSize);
+        if (cqRing != MAP_FAILED && cqRing != sqRing)
+            munmap(cqRing, cqRingSize);
+        if (sqRing != MAP_FAILED)
+            munmap(sqRing, sqRingSize);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    bool setup()
+    {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, STAT_RING_ENTRIES, &params));
+        if (fd < 0)
+            return false;
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMmap)
+            sqRingSize = cqRingSize = qMax(sqRingSize, cqRingSize);
+
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED)
+            return false;
+        cqRing = singleMmap ? sqRing
+                            : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED)
+            return false;
+        sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqes = static_cast<struct io_uring_sqe *>(
+            mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED)
+            return false;
+
+        auto sq = static_cast<char *>(sqRing);
+        sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        sqEntries = params.sq_entries;
+
+        auto cq = static_cast<char *>(cqRing);
+        cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+        results.resize(sqEntries);
+        return true;
+    }
+
+    int enter(unsigned toSubmit, unsigned minComplete)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete,
+            IORING_ENTER_GETEVENTS, nullptr, 0));
+    }
+};
+
+static bool ioUringEnabled()
+{
+    static bool enabled = qgetenv("OWNCLOUD_LOCAL_IO_URING") == "1";
+    return enabled;
+}
+
+#else
+
+struct LocalStatBatch::Ring
+{
+};
+
+#endif
+
+LocalStatBatch::LocalStatBatch()
+#ifdef CSYNC_USE_IO_URING
+    : LocalStatBatch(ioUringEnabled())
+#else
+    : LocalStatBatch(false)
+#endif
+{
+}
+
+LocalStatBatch::LocalStatBatch(bool useIoUring)
+{
+#ifdef CSYNC_USE_IO_URING
+    if (useIoUring) {
+        _ring = new Ring;
+        if (!_ring->setup()) {
+            qCInfo(lcCSyncVIOStatBatch) << "io_uring not available, stat'ing synchronously:" << strerror(errno);
+            delete _ring;
+            _ring = nullptr;
+        }
+    }
+#else
+    Q_UNUSED(useIoUring)
+#endif
+}
+
+LocalStatBatch::~LocalStatBatch()
+{
+    delete _ring;
+}
+
+LocalStatBatch &LocalStatBatch::forCurrentThread()
+{
+    static thread_local LocalStatBatch batch;
+    return batch;
+}
+
+void LocalStatBatch::statAt(int dirfd, LocalStatRequest *requests, size_t count)
+{
+    if (_ring) {
+        statWithRing(dirfd, requests, count);
+        return;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+        statSync(dirfd, &requests[i]);
+}
+
+void LocalStatBatch::statSync(int dirfd, LocalStatRequest *request)
+{
+#ifdef STATX_BASIC_STATS
+    // statx needs Linux 4.11, and seccomp filters of container runtimes may
+    // reject it with EPERM. Remember when it is not available.
+    static std::atomic<bool> statxUnsupported(false);
+    if (!statxUnsupported) {
+        struct statx sx;
+        if (statx(dirfd, request->name, AT_SYMLINK_NOFOLLOW, STATX_TYPE | STATX_INO | STATX_MTIME | STATX_SIZE, &sx) == 0) {
+            request->error = 0;
+            request->mode = sx.stx_mode;
+            request->inode = sx.stx_ino;
+            request->modtime = sx.stx_mtime.tv_sec;
+            request->size = sx.stx_size;
+            return;
+        }
+        if (errno != ENOSYS && errno != EPERM) {
+            request->error = errno;
+            return;
+        }
+        statxUnsupported = true;
+    }
+#endif
+
+    struct stat sb;
+    if (fstatat(dirfd, request->name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+        request->error = errno;
+        return;
+    }
+    request->error = 0;
+    request->mode = sb.st_mode;
+    request->inode = sb.st_ino;
+    request->modtime = sb.st_mtime;
+    request->size = sb.st_size;
+}
+
+/*
+ * If the ring turns out to be unusable, it is dropped and the remaining
+ * entries are stat'ed synchronously.
+ */
+void LocalStatBatch::statWithRing(int dirfd, LocalStatRequest *requests, size_t count)
+{
+#ifdef CSYNC_USE_IO_URING
+    Ring &ring = *_ring;
+    size_t done = 0;
+    while (done < count) {
+        unsigned batchSize = static_cast<unsigned>(qMin<size_t>(count - done, ring.sqEntries));
+
+        unsigned tail = *ring.sqTail;
+        for (unsigned i = 0; i < batchSize; ++i) {
+            unsigned index = (tail + i) & ring.sqMask;
+            struct io_uring_sqe *sqe = &ring.sqes[index];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = dirfd;
+            sqe->addr = reinterpret_cast<uint64_t>(requests[done + i].name);
+            sqe->len = STATX_TYPE | STATX_INO | STATX_MTIME | STATX_SIZE;
+            sqe->off = reinterpret_cast<uint64_t>(&ring.results[i]);
+            sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+            sqe->user_data = i;
+            ring.sqArray[index] = index;
+        }
+        __atomic_store_n(ring.sqTail, tail + batchSize, __ATOMIC_RELEASE);
+
+        unsigned completed = 0;
+        unsigned toSubmit = batchSize;
+        bool unsupported = false;
+        while (completed < batchSize) {
+            unsigned head = *ring.cqHead;
+            unsigned cqTail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+            for (; head != cqTail; ++head, ++completed) {
+                const struct io_uring_cqe &cqe = ring.cqes[head & ring.cqMask];
+                auto i = static_cast<unsigned>(cqe.user_data);
+                LocalStatRequest &request = requests[done + i];
+                if (cqe.res == -ENOSYS || cqe.res == -EPERM) {
+                    statSync(dirfd, &request);
+                    continue;
+                }
+                if (cqe.res < 0) {
+                    // Kernels before 5.6 know io_uring but not IORING_OP_STATX
+                    if (cqe.res == -EINVAL)
+                        unsupported = true;
+                    request.error = -cqe.res;
+                    continue;
+                }
+                const struct statx &sx = ring.results[i];
+                request.error = 0;
+                request.mode = sx.stx_mode;
+                request.inode = sx.stx_ino;
+                request.modtime = sx.stx_mtime.tv_sec;
+                request.size = sx.stx_size;
+            }
+            __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+            if (completed == batchSize)
+                break;
+
+            int ret = ring.enter(toSubmit, batchSize - completed);
+            if (ret < 0) {
+                if (errno == EINTR)
+                    continue;
+                qCWarning(lcCSyncVIOStatBatch) << "io_uring_enter failed, stat'ing synchronously:" << strerror(errno);
+                // Requests that were already submitted may still write to the
+                // buffers of the ring, don't free it.
+                _ring = nullptr;
+                for (size_t i = done; i < count; ++i)
+                    statSync(dirfd, &requests[i]);
+                return;
+            }
+            toSubmit -= static_cast<unsigned>(ret);
+        }
+
+        if (unsupported) {
+            qCInfo(lcCSyncVIOStatBatch) << "io_uring does not support statx, stat'ing synchronously";
+            delete _ring;
+            _ring = nullptr;
+            for (size_t i = done; i < count; ++i)
+                statSync(dirfd, &requests[i]);
+            return;
+        }
+        done += batchSize;
+    }
+#else
+    Q_UNUSED(dirfd)
+    Q_UNUSED(requests)
+    Q_UNUSED(count)
+#endif
+}
@@ -0,0 +1,85 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include "ocsynclib.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * One entry to stat with LocalStatBatch.
+ */
+struct LocalStatRequest
+{
+    /* Name of the entry, relative to the directory */
+    const char *name = nullptr;
+
+    /* errno of the stat, 0 on success */
+    int error = 0;
+
+    mode_t mode = 0;
+    uint64_t inode = 0;
+    int64_t modtime = 0;
+    int64_t size = 0;
+};
+
+/**
+ * Stats the entries of a local directory in batches.
+ *
+ * With io_uring (Linux 5.6, enabled with OWNCLOUD_LOCAL_IO_URING=1) the
+ * statx calls for a whole batch are submitted with a single system call and
+ * run concurrently in the kernel, which mostly helps for network file systems
+ * mounted into the sync folder. Otherwise, or when setting up the ring fails,
+ * the entries are stat'ed one after the other.
+ *
+ * Every thread has its own ring, see forCurrentThread().
+ */
+class OCSYNC_EXPORT LocalStatBatch
+{
+public:
+    /* Uses io_uring if OWNCLOUD_LOCAL_IO_URING=1 */
+    LocalStatBatch();
+    /* Tries io_uring if useIoUring is set, see usesIoUring() */
+    explicit LocalStatBatch(bool useIoUring);
+    ~LocalStatBatch();
+
+    LocalStatBatch(const LocalStatBatch &) = delete;
+    LocalStatBatch &operator=(const LocalStatBatch &) = delete;
+
+    /* The batch of the calling thread */
+    static LocalStatBatch &forCurrentThread();
+
+    /* Stat the entries relative to the directory file descriptor dirfd, not following symlinks */
+    void statAt(int dirfd, LocalStatRequest *requests, size_t count);
+
+    /* Whether the requests are submitted through io_uring */
+    bool usesIoUring() const { return _ring != nullptr; }
+
+private:
+    static void statSync(int dirfd, LocalStatRequest *request);
+
+    struct Ring;
+    void statWithRing(int dirfd, LocalStatRequest *requests, size_t count);
+
+    Ring *_ring = nullptr;
+};
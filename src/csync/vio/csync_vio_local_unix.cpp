@@ -26,6 +26,14 @@
 #include <dirent.h>
 #include <stdio.h>
 
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <deque>
+#include <memory>
+#include <vector>
+#endif
+
 #include "c_private.h"
 #include "c_lib.h"
 #include "c_string.h"
@@ -34,6 +42,9 @@
 #include "csync_vio.h"
 
 #include "vio/csync_vio_local.h"
+#ifdef __linux__
+#include "vio/csync_vio_local_statbatch.h"
+#endif
 
 Q_LOGGING_CATEGORY(lcCSyncVIOLocal, "sync.csync.vio_local", QtInfoMsg)
 
@@ -41,13 +52,59 @@ Q_LOGGING_CATEGORY(lcCSyncVIOLocal, "sync.csync.vio_local", QtInfoMsg)
  * directory functions
  */
 
+#ifdef __linux__
+/*
+ * On Linux the directory is read with getdents64 into a large buffer and the
+ * entries are stat'ed relative to the directory fd, in one batch per
+ * directory (see LocalStatBatch). This avoids the kernel resolving the full
+ * path of every entry component by component.
+ */
+
+/* The directory entry as returned by getdents64 */
+struct linux_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+#define DIRENT_BUFFER_SIZE (64 * 1024)
+
+typedef struct dhandle_s {
+  int fd;
+  char *path;
+  /* The entries of the directory, read and stat'ed at the first readdir */
+  std::deque<std::unique_ptr<csync_file_stat_t>> *entries;
+} dhandle_t;
+#else
 typedef struct dhandle_s {
   DIR *dh;
   char *path;
 } dhandle_t;
+#endif
 
 static int _csync_vio_local_stat_mb(const mbchar_t *wuri, csync_file_stat_t *buf);
 
+static void _csync_vio_local_set_type(mode_t mode, csync_file_stat_t *buf)
+{
+    switch (mode & S_IFMT) {
+    case S_IFDIR:
+      buf->type = ItemTypeDirectory;
+      break;
+    case S_IFREG:
+      buf->type = ItemTypeFile;
+      break;
+    case S_IFLNK:
+    case S_IFSOCK:
+      buf->type = ItemTypeSoftLink;
+      break;
+    default:
+      buf->type = ItemTypeSkip;
+      break;
+  }
+}
+
 csync_vio_handle_t *csync_vio_local_opendir(const char *name) {
   dhandle_t *handle = NULL;
   mbchar_t *dirname = NULL;
@@ -56,13 +113,22 @@ csync_vio_handle_t *csync_vio_local_opendir(const char *name) {
 
   dirname = c_utf8_path_to_locale(name);
 
+#ifdef __linux__
+  handle->fd = open(dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (handle->fd < 0) {
+#else
   handle->dh = _topendir( dirname );
   if (handle->dh == NULL) {
+#endif
     c_free_locale_string(dirname);
     SAFE_FREE(handle);
     return NULL;
   }
 
+#ifdef __linux__
+  handle->entries = nullptr;
+#endif
+
   handle->path = c_strdup(name);
   c_free_locale_string(dirname);
 
@@ -79,7 +145,12 @@ int csync_vio_local_closedir(csync_vio_handle_t *dhandle) {
   }
 
   handle = (dhandle_t *) dhandle;
+#ifdef __linux__
+  rc = close(handle->fd);
+  delete handle->entries;
+#else
   rc = _tclosedir(handle->dh);
+#endif
 
   SAFE_FREE(handle->path);
   SAFE_FREE(handle);
@@ -87,6 +158,95 @@ int csync_vio_local_closedir(csync_vio_handle_t *dhandle) {
   return rc;
 }
 
+#ifdef __linux__
+/* Read all entries of the directory, and stat the ones that need it in one batch */
+static void _csync_vio_local_read_entries(dhandle_t *handle)
+{
+  // Shared by the directories the thread reads, and not initialized
+  static thread_local std::unique_ptr<char[]> buffer(new char[DIRENT_BUFFER_SIZE]);
+  std::vector<QByteArray> names;
+  std::vector<csync_file_stat_t *> to_stat;
+
+  handle->entries = new std::deque<std::unique_ptr<csync_file_stat_t>>;
+
+  long n;
+  while ((n = syscall(SYS_getdents64, handle->fd, buffer.get(), DIRENT_BUFFER_SIZE)) > 0) {
+    for (long pos = 0; pos < n;) {
+      auto dirent = reinterpret_cast<struct linux_dirent64 *>(buffer.get() + pos);
+      pos += dirent->d_reclen;
+
+      if (qstrcmp(dirent->d_name, ".") == 0 || qstrcmp(dirent->d_name, "..") == 0)
+        continue;
+
+      std::unique_ptr<csync_file_stat_t> file_stat(new csync_file_stat_t);
+      file_stat->path = c_utf8_from_locale(dirent->d_name);
+      if (file_stat->path.isNull()) {
+        file_stat->original_path = QByteArray() % const_cast<const char *>(handle->path) % '/' % QByteArray() % const_cast<const char *>(dirent->d_name);
+        qCWarning(lcCSyncVIOLocal) << "Invalid characters in file/directory name, please rename:" << dirent->d_name << handle->path;
+        handle->entries->push_back(std::move(file_stat));
+        continue;
+      }
+
+      switch (dirent->d_type) {
+      case DT_FIFO:
+      case DT_CHR:
+      case DT_BLK:
+        // Never synced, a stat would not change the type either
+        file_stat->type = ItemTypeSkip;
+        file_stat->inode = dirent->d_ino;
+        break;
+      case DT_LNK:
+      case DT_SOCK:
+        // Ignored by the update phase, the stat data is not needed
+        file_stat->type = ItemTypeSoftLink;
+        file_stat->inode = dirent->d_ino;
+        break;
+      default:
+        // DT_DIR, DT_REG and DT_UNKNOWN (file systems that don't provide d_type)
+        names.push_back(QByteArray(dirent->d_name));
+        to_stat.push_back(file_stat.get());
+        break;
+      }
+      handle->entries->push_back(std::move(file_stat));
+    }
+  }
+
+  std::vector<LocalStatRequest> requests(names.size());
+  for (size_t i = 0; i < names.size(); ++i) {
+    requests[i].name = names[i].constData();
+  }
+  LocalStatBatch::forCurrentThread().statAt(handle->fd, requests.data(), requests.size());
+
+  for (size_t i = 0; i < requests.size(); ++i) {
+    const auto &request = requests[i];
+    auto file_stat = to_stat[i];
+    if (request.error != 0) {
+      // Will get excluded by _csync_detect_update.
+      file_stat->type = ItemTypeSkip;
+      continue;
+    }
+    _csync_vio_local_set_type(request.mode, file_stat);
+    file_stat->inode = request.inode;
+    file_stat->modtime = request.modtime;
+    file_stat->size = request.size;
+  }
+}
+
+std::unique_ptr<csync_file_stat_t> csync_vio_local_readdir(csync_vio_handle_t *dhandle) {
+
+  dhandle_t *handle = (dhandle_t *) dhandle;
+
+  if (!handle->entries) {
+    _csync_vio_local_read_entries(handle);
+  }
+  if (handle->entries->empty()) {
+    return {};
+  }
+  auto file_stat = std::move(handle->entries->front());
+  handle->entries->pop_front();
+  return file_stat;
+}
+#else
 std::unique_ptr<csync_file_stat_t> csync_vio_local_readdir(csync_vio_handle_t *dhandle) {
 
   dhandle_t *handle = NULL;
@@ -139,6 +299,7 @@ std::unique_ptr<csync_file_stat_t> csync_vio_local_readdir(csync_vio_handle_t *d
   }
   return file_stat;
 }
+#endif
 
 
 int csync_vio_local_stat(const char *uri, csync_file_stat_t *buf)
@@ -158,21 +319,7 @@ static int _csync_vio_local_stat_mb(const mbchar_t *wuri, csync_file_stat_t *buf
         return -1;
     }
 
-    switch (sb.st_mode & S_IFMT) {
-    case S_IFDIR:
-      buf->type = ItemTypeDirectory;
-      break;
-    case S_IFREG:
-      buf->type = ItemTypeFile;
-      break;
-    case S_IFLNK:
-    case S_IFSOCK:
-      buf->type = ItemTypeSoftLink;
-      break;
-    default:
-      buf->type = ItemTypeSkip;
-      break;
-  }
+    _csync_vio_local_set_type(sb.st_mode, buf);
 
 #ifdef __APPLE__
   if (sb.st_flags & UF_HIDDEN) {
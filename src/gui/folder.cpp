@@ -35,6 +35,7 @@
 #include "creds/abstractcredentials.h"
 
 #include <QTimer>
+#include <QtConcurrent>
 #include <QUrl>
 #include <QDir>
 #include <QSettings>
@@ -46,6 +47,12 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcFolder, "gui.folder", QtInfoMsg)
 
+/* The journal maintenance starts once the folder was idle this long, and
+ * runs in steps of the given budget until there is no work left. */
+static const std::chrono::seconds journalMaintenanceIdleDelay(60);
+static const std::chrono::seconds journalMaintenanceStepInterval(1);
+static const std::chrono::milliseconds journalMaintenanceBudget(100);
+
 Folder::Folder(const FolderDefinition &definition,
     AccountState *accountState,
     QObject *parent)
@@ -109,6 +116,12 @@ Folder::Folder(const FolderDefinition &definition,
     connect(&_scheduleSelfTimer, &QTimer::timeout,
         this, &Folder::slotScheduleThisFolder);
 
+    _journalMaintenanceTimer.setSingleShot(true);
+    connect(&_journalMaintenanceTimer, &QTimer::timeout,
+        this, &Folder::slotRunJournalMaintenance);
+    connect(&_journalMaintenance, &QFutureWatcherBase::finished,
+        this, &Folder::slotJournalMaintenanceFinished);
+
     connect(ProgressDispatcher::instance(), &ProgressDispatcher::folderConflicts,
         this, &Folder::slotFolderConflicts);
 
@@ -121,6 +134,8 @@ Folder::Folder(const FolderDefinition &definition,
 
 Folder::~Folder()
 {
+    stopJournalMaintenance();
+
     // Reset then engine first as it will abort and try to access members of the Folder
     _engine.reset();
 }
@@ -432,9 +447,8 @@ int Folder::slotDiscardDownloadProgress()
 {
     // Delete from journal and from filesystem.
     QDir folderpath(_definition.localPath);
-    QSet<QString> keep_nothing;
     const QVector<SyncJournalDb::DownloadInfo> deleted_infos =
-        _journal.getAndDeleteStaleDownloadInfos(keep_nothing);
+        _journal.getAndDeleteStaleDownloadInfos(QVector<QString>());
     foreach (const SyncJournalDb::DownloadInfo &deleted_info, deleted_infos) {
         const QString tmppath = folderpath.filePath(deleted_info._tmpfile);
         qCInfo(lcFolder) << "Deleting temporary file: " << tmppath;
@@ -605,6 +619,7 @@ void Folder::wipe()
 
     //Unregister the socket API so it does not keep the ._sync_journal file open
     FolderMan::instance()->socketApi()->slotUnregisterPath(alias());
+    stopJournalMaintenance();
     _journal.close(); // close the sync journal
 
     QFile file(stateDbFile);
@@ -643,6 +658,12 @@ void Folder::startSync(const QStringList &pathList)
     }
     _csyncUnavail = false;
 
+    // The sync waits for the journal until the maintenance step returned
+    _journalMaintenanceTimer.stop();
+    if (_journalMaintenance.isRunning()) {
+        _journal.interruptMaintenance();
+    }
+
     _timeSinceLastSyncStart.start();
     _syncResult.setStatus(SyncResult::SyncPrepare);
     emit syncStateChange();
@@ -739,6 +760,25 @@ void Folder::setSyncOptions()
         opt._targetChunkUploadDuration = cfgFile.targetChunkUploadDuration();
     }
 
+    QByteArray parallelDiscoveryJobsEnv = qgetenv("OWNCLOUD_PARALLEL_DISCOVERY");
+    if (!parallelDiscoveryJobsEnv.isEmpty()) {
+        opt._parallelDiscoveryJobs = parallelDiscoveryJobsEnv.toInt();
+    } else {
+        opt._parallelDiscoveryJobs = cfgFile.parallelDiscoveryJobs();
+    }
+
+    QByteArray localDiscoveryThreadsEnv = qgetenv("OWNCLOUD_LOCAL_DISCOVERY_THREADS");
+    if (!localDiscoveryThreadsEnv.isEmpty()) {
+        opt._localDiscoveryThreads = localDiscoveryThreadsEnv.toInt();
+    }
+
+    opt._journalSnapshot = qgetenv("OWNCLOUD_JOURNAL_SNAPSHOT") == "1";
+    opt._reconcileDuringDiscovery = qgetenv("OWNCLOUD_RECONCILE_DURING_DISCOVERY") == "1";
+    opt._propagateDuringDiscovery = qgetenv("OWNCLOUD_PROPAGATE_DURING_DISCOVERY") == "1";
+    opt._asyncJournalWrites = qgetenv("OWNCLOUD_ASYNC_JOURNAL_WRITES") == "1";
+    opt._journalBulkLoad = qgetenv("OWNCLOUD_JOURNAL_BULK_LOAD") == "1";
+    opt._checksumWhileUploading = qgetenv("OWNCLOUD_CHECKSUM_WHILE_UPLOADING") == "1";
+
     _engine->setSyncOptions(opt);
 }
 
@@ -849,6 +889,7 @@ void Folder::slotSyncFinished(bool success)
 
     _lastSyncDuration = std::chrono::milliseconds(_timeSinceLastSyncStart.elapsed());
     _timeSinceLastSyncDone.start();
+    _journalMaintenanceTimer.start(std::chrono::milliseconds(journalMaintenanceIdleDelay).count());
 
     // Increment the follow-up sync counter if necessary.
     if (anotherSyncNeeded == ImmediateFollowUp) {
@@ -868,6 +909,33 @@ void Folder::slotSyncFinished(bool success)
     }
 }
 
+void Folder::slotRunJournalMaintenance()
+{
+    if (isBusy() || _journalMaintenance.isRunning())
+        return;
+
+    auto journal = &_journal;
+    _journalMaintenance.setFuture(QtConcurrent::run([journal] {
+        return journal->performMaintenance(journalMaintenanceBudget);
+    }));
+}
+
+void Folder::slotJournalMaintenanceFinished()
+{
+    if (_journalMaintenance.result() && !isBusy()) {
+        _journalMaintenanceTimer.start(std::chrono::milliseconds(journalMaintenanceStepInterval).count());
+    }
+}
+
+void Folder::stopJournalMaintenance()
+{
+    _journalMaintenanceTimer.stop();
+    if (_journalMaintenance.isRunning()) {
+        _journal.interruptMaintenance();
+        _journalMaintenance.waitForFinished();
+    }
+}
+
 void Folder::slotEmitFinishedDelayed()
 {
     emit syncFinished(_syncResult);
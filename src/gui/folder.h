@@ -24,6 +24,7 @@
 
 #include <csync.h>
 
+#include <QFutureWatcher>
 #include <QObject>
 #include <QStringList>
 #include <QUuid>
@@ -335,6 +336,10 @@ private slots:
     /** Warn users about an unreliable folder watcher */
     void slotWatcherUnreliable(const QString &message);
 
+    /** Runs a step of the journal maintenance in a worker thread, if the folder is idle */
+    void slotRunJournalMaintenance();
+    void slotJournalMaintenanceFinished();
+
 private:
     bool reloadExcludes();
 
@@ -344,6 +349,9 @@ private:
 
     void setSyncOptions();
 
+    /** Interrupts the journal maintenance and waits for it to return */
+    void stopJournalMaintenance();
+
     enum LogStatus {
         LogStatusRemove,
         LogStatusRename,
@@ -385,6 +393,10 @@ private:
 
     QTimer _scheduleSelfTimer;
 
+    /// Runs the journal maintenance once the folder was idle for a while
+    QTimer _journalMaintenanceTimer;
+    QFutureWatcher<bool> _journalMaintenance;
+
     /**
      * When the same local path is synced to multiple accounts, only one
      * of them can be stored in the settings in a way that's compatible
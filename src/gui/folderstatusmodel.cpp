@@ -19,6 +19,7 @@
 #include <theme.h>
 #include <account.h>
 #include "folderstatusdelegate.h"
+#include "progressdispatcher.h"
 
 #include <QFileIconProvider>
 #include <QVarLengthArray>
@@ -71,6 +72,8 @@ void FolderStatusModel::setAccountState(const AccountState *accountState)
         this, &FolderStatusModel::slotFolderSyncStateChange, Qt::UniqueConnection);
     connect(FolderMan::instance(), &FolderMan::scheduleQueueChanged,
         this, &FolderStatusModel::slotFolderScheduleQueueChanged, Qt::UniqueConnection);
+    connect(ProgressDispatcher::instance(), &ProgressDispatcher::itemCompleted,
+        this, &FolderStatusModel::slotItemCompleted, Qt::UniqueConnection);
 
     auto folders = FolderMan::instance()->map();
     foreach (auto f, folders) {
@@ -849,6 +852,21 @@ void FolderStatusModel::slotApplySelectiveSync()
     resetFolders();
 }
 
+// The progress is throttled and doesn't report every completed item, count the warnings here
+void FolderStatusModel::slotItemCompleted(const QString &folder, const SyncFileItemPtr &item)
+{
+    if (!Progress::isWarningKind(item->_status))
+        return;
+
+    for (int i = 0; i < _folders.count(); ++i) {
+        if (_folders.at(i)._folder && _folders.at(i)._folder->alias() == folder) {
+            _folders[i]._progress._warningCount++;
+            emit dataChanged(index(i), index(i), QVector<int>() << FolderStatusDelegate::WarningCount);
+            return;
+        }
+    }
+}
+
 void FolderStatusModel::slotSetProgress(const ProgressInfo &progress)
 {
     auto par = qobject_cast<QWidget *>(QObject::parent());
@@ -899,11 +917,6 @@ void FolderStatusModel::slotSetProgress(const ProgressInfo &progress)
 
     // Status is Starting, Propagation or Done
 
-    if (!progress._lastCompletedItem.isEmpty()
-        && Progress::isWarningKind(progress._lastCompletedItem._status)) {
-        pi->_warningCount++;
-    }
-
     // find the single item to display:  This is going to be the bigger item, or the last completed
     // item if no items are in progress.
     SyncFileItem curItem = progress._lastCompletedItem;
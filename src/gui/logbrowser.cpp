@@ -31,6 +31,7 @@
 #include <QAction>
 
 #include "configfile.h"
+#include "folderman.h"
 #include "logger.h"
 
 namespace OCC {
@@ -117,6 +118,13 @@ LogBrowser::LogBrowser(QWidget *parent)
     btnbox->addButton(_clearBtn, QDialogButtonBox::ActionRole);
     connect(_clearBtn, &QAbstractButton::clicked, this, &LogBrowser::slotClearLog);
 
+    // database statistics button
+    QPushButton *databaseStatisticsBtn = new QPushButton;
+    databaseStatisticsBtn->setText(tr("Database statistics"));
+    databaseStatisticsBtn->setToolTip(tr("Show statistics of the sync databases of all folders in the log."));
+    btnbox->addButton(databaseStatisticsBtn, QDialogButtonBox::ActionRole);
+    connect(databaseStatisticsBtn, &QAbstractButton::clicked, this, &LogBrowser::slotShowDatabaseStatistics);
+
     // save Button
     _saveBtn = new QPushButton;
     _saveBtn->setText(tr("S&ave"));
@@ -230,6 +238,13 @@ void LogBrowser::slotClearLog()
     _logWidget->clear();
 }
 
+void LogBrowser::slotShowDatabaseStatistics()
+{
+    foreach (Folder *folder, FolderMan::instance()->map()) {
+        _logWidget->appendPlainText(folder->journalDb()->statisticsReport());
+    }
+}
+
 void LogBrowser::togglePermanentLogging(bool enabled)
 {
     ConfigFile().setAutomaticLogDir(enabled);
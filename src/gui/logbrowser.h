@@ -66,6 +66,7 @@ protected slots:
     void search(const QString &);
     void slotSave();
     void slotClearLog();
+    void slotShowDatabaseStatistics();
     void togglePermanentLogging(bool enabled);
 
 private:
@@ -81,6 +81,8 @@ ownCloudGui::ownCloudGui(Application *parent)
     ProgressDispatcher *pd = ProgressDispatcher::instance();
     connect(pd, &ProgressDispatcher::progressInfo, this,
         &ownCloudGui::slotUpdateProgress);
+    connect(pd, &ProgressDispatcher::itemCompleted, this,
+        &ownCloudGui::slotItemCompleted);
 
     FolderMan *folderMan = FolderMan::instance();
     connect(folderMan, &FolderMan::folderSyncStateChange,
@@ -826,39 +828,43 @@ void ownCloudGui::slotUpdateProgress(const QString &folder, const ProgressInfo &
     }
 
     _actionRecent->setIcon(QIcon()); // Fixme: Set a "in-progress"-item eventually.
+}
 
-    if (!progress._lastCompletedItem.isEmpty()
-        && shouldShowInRecentsMenu(progress._lastCompletedItem)) {
-        if (Progress::isWarningKind(progress._lastCompletedItem._status)) {
-            // display a warn icon if warnings happened.
-            QIcon warnIcon(":/client/resources/warning");
-            _actionRecent->setIcon(warnIcon);
-        }
+// The progress is throttled and doesn't report every completed item, fill the recent items here
+void ownCloudGui::slotItemCompleted(const QString &folder, const SyncFileItemPtr &item)
+{
+    if (!shouldShowInRecentsMenu(*item))
+        return;
 
-        QString kindStr = Progress::asResultString(progress._lastCompletedItem);
-        QString timeStr = QTime::currentTime().toString("hh:mm");
-        QString actionText = tr("%1 (%2, %3)").arg(progress._lastCompletedItem._file, kindStr, timeStr);
-        QAction *action = new QAction(actionText, this);
-        Folder *f = FolderMan::instance()->folder(folder);
-        if (f) {
-            QString fullPath = f->path() + '/' + progress._lastCompletedItem._file;
-            if (QFile(fullPath).exists()) {
-                connect(action, &QAction::triggered, this, [this, fullPath] { this->slotOpenPath(fullPath); });
-            } else {
-                action->setEnabled(false);
-            }
-        }
-        if (_recentItemsActions.length() > 5) {
-            _recentItemsActions.takeFirst()->deleteLater();
-        }
-        _recentItemsActions.append(action);
+    if (Progress::isWarningKind(item->_status)) {
+        // display a warn icon if warnings happened.
+        QIcon warnIcon(":/client/resources/warning");
+        _actionRecent->setIcon(warnIcon);
+    }
 
-        // Update the "Recent" menu if the context menu is being shown,
-        // otherwise it'll be updated later, when the context menu is opened.
-        if (updateWhileVisible() && contextMenuVisible()) {
-            slotRebuildRecentMenus();
+    QString kindStr = Progress::asResultString(*item);
+    QString timeStr = QTime::currentTime().toString("hh:mm");
+    QString actionText = tr("%1 (%2, %3)").arg(item->_file, kindStr, timeStr);
+    QAction *action = new QAction(actionText, this);
+    Folder *f = FolderMan::instance()->folder(folder);
+    if (f) {
+        QString fullPath = f->path() + '/' + item->_file;
+        if (QFile(fullPath).exists()) {
+            connect(action, &QAction::triggered, this, [this, fullPath] { this->slotOpenPath(fullPath); });
+        } else {
+            action->setEnabled(false);
         }
     }
+    if (_recentItemsActions.length() > 5) {
+        _recentItemsActions.takeFirst()->deleteLater();
+    }
+    _recentItemsActions.append(action);
+
+    // Update the "Recent" menu if the context menu is being shown,
+    // otherwise it'll be updated later, when the context menu is opened.
+    if (updateWhileVisible() && contextMenuVisible()) {
+        slotRebuildRecentMenus();
+    }
 }
 
 void ownCloudGui::slotLogin()
@@ -1046,7 +1052,7 @@ void ownCloudGui::slotShowShareDialog(const QString &sharePath, const QString &l
     SyncJournalFileRecord fileRecord;
 
     bool resharingAllowed = true; // lets assume the good
-    if (folder->journalDb()->getFileRecord(file, &fileRecord) && fileRecord.isValid()) {
+    if (folder->journalDb()->getCommittedFileRecord(file, &fileRecord) && fileRecord.isValid()) {
         // check the permission: Is resharing allowed?
         if (!fileRecord._remotePerm.isNull() && !fileRecord._remotePerm.hasPermission(RemotePermissions::CanReshare)) {
             resharingAllowed = false;
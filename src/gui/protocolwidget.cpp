@@ -117,7 +117,7 @@ SyncJournalFileRecord ProtocolItem::syncJournalRecord(QTreeWidgetItem *item)
     auto f = folder(item);
     if (!f)
         return rec;
-    f->journalDb()->getFileRecord(extraData(item).path, &rec);
+    f->journalDb()->getCommittedFileRecord(extraData(item).path, &rec);
     return rec;
 }
 
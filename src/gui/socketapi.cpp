@@ -720,7 +720,7 @@ SyncJournalFileRecord SocketApi::FileData::journalRecord() const
     SyncJournalFileRecord record;
     if (!folder)
         return record;
-    folder->journalDb()->getFileRecord(folderRelativePath, &record);
+    folder->journalDb()->getCommittedFileRecord(folderRelativePath, &record);
     return record;
 }
 
@@ -64,6 +64,7 @@ static const char chunkSizeC[] = "chunkSize";
 static const char minChunkSizeC[] = "minChunkSize";
 static const char maxChunkSizeC[] = "maxChunkSize";
 static const char targetChunkUploadDurationC[] = "targetChunkUploadDuration";
+static const char parallelDiscoveryJobsC[] = "parallelDiscoveryJobs";
 static const char automaticLogDirC[] = "logToTemporaryLogDir";
 static const char showExperimentalOptionsC[] = "showExperimentalOptions";
 
@@ -187,6 +188,12 @@ chrono::milliseconds ConfigFile::targetChunkUploadDuration() const
     return millisecondsValue(settings, targetChunkUploadDurationC, chrono::minutes(1));
 }
 
+int ConfigFile::parallelDiscoveryJobs() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(parallelDiscoveryJobsC), 0).toInt();
+}
+
 void ConfigFile::setOptionalDesktopNotifications(bool show)
 {
     QSettings settings(configFile(), QSettings::IniFormat);
@@ -143,6 +143,9 @@ public:
     quint64 minChunkSize() const;
     std::chrono::milliseconds targetChunkUploadDuration() const;
 
+    /** Maximum number of concurrent directory listings during remote discovery, 0 for automatic */
+    int parallelDiscoveryJobs() const;
+
     void saveGeometry(QWidget *w);
     void restoreGeometry(QWidget *w);
 
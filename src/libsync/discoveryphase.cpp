@@ -17,6 +17,7 @@
 #include "account.h"
 #include "common/asserts.h"
 #include "common/checksums.h"
+#include "common/syncjournaldb.h"
 
 #include <csync_private.h>
 #include <csync_rename.h>
@@ -25,6 +26,7 @@
 #include <QLoggingCategory>
 #include <QUrl>
 #include <QFileInfo>
+#include <algorithm>
 #include <cstring>
 
 
@@ -473,10 +475,16 @@ void DiscoveryMainThread::setupHooks(DiscoveryJob *discoveryJob, const QString &
     connect(discoveryJob, &DiscoveryJob::doGetSizeSignal,
         this, &DiscoveryMainThread::doGetSizeSlot,
         Qt::QueuedConnection);
+
+    if (maximumActiveJobs() > 1) {
+        discoveryJob->_prefetchSubDirectories = true;
+        connect(discoveryJob, &DiscoveryJob::subDirectoriesToOpen,
+            this, &DiscoveryMainThread::enqueueSubDirectories,
+            Qt::QueuedConnection);
+    }
 }
 
-// Coming from owncloud_opendir -> DiscoveryJob::vio_opendir_hook -> doOpendirSignal
-void DiscoveryMainThread::doOpendirSlot(const QString &subPath, DiscoveryDirectoryResult *r)
+QString DiscoveryMainThread::fullRemotePath(const QString &subPath) const
 {
     QString fullPath = _pathPrefix;
     if (!_pathPrefix.endsWith('/')) {
@@ -487,71 +495,225 @@ void DiscoveryMainThread::doOpendirSlot(const QString &subPath, DiscoveryDirecto
     while (fullPath.endsWith('/')) {
         fullPath.chop(1);
     }
+    return fullPath;
+}
+
+int DiscoveryMainThread::maximumActiveJobs() const
+{
+    if (_maxActiveJobs > 0)
+        return _maxActiveJobs;
+    if (_account->isHttp2Supported())
+        return 20;
+    return 6; // (Qt cannot do more anyway)
+}
+
+int DiscoveryMainThread::activeJobCount() const
+{
+    int count = 0;
+    for (const auto &it : _prefetched) {
+        if (!it.second._finished)
+            ++count;
+    }
+    return count;
+}
 
+// Coming from owncloud_opendir -> DiscoveryJob::vio_opendir_hook -> doOpendirSignal
+void DiscoveryMainThread::doOpendirSlot(const QString &subPath, DiscoveryDirectoryResult *r)
+{
     _discoveryJob->update_job_update_callback(/*local=*/false, subPath.toUtf8(), _discoveryJob);
 
     // Result gets written in there
     _currentDiscoveryDirectoryResult = r;
-    _currentDiscoveryDirectoryResult->path = fullPath;
+    _currentDiscoveryDirectoryResult->path = fullRemotePath(subPath);
+    _currentSubPath = subPath;
+    _openedDirectories.insert(subPath);
+    dropSkippedDirectories(subPath);
+
+    auto it = _prefetched.find(subPath);
+    if (it == _prefetched.end()) {
+        startDirectoryJob(subPath);
+    } else if (it->second._finished) {
+        deliverResult(it->second);
+        _prefetched.erase(it);
+        startPrefetchJobs();
+    }
+    // Otherwise the listing is already running and is handed over when it finishes
+}
 
-    // Schedule the DiscoverySingleDirectoryJob
-    _singleDirJob = new DiscoverySingleDirectoryJob(_account, fullPath, this);
-    QObject::connect(_singleDirJob.data(), &DiscoverySingleDirectoryJob::finishedWithResult,
-        this, &DiscoveryMainThread::singleDirectoryJobResultSlot);
-    QObject::connect(_singleDirJob.data(), &DiscoverySingleDirectoryJob::finishedWithError,
-        this, &DiscoveryMainThread::singleDirectoryJobFinishedWithErrorSlot);
-    QObject::connect(_singleDirJob.data(), &DiscoverySingleDirectoryJob::firstDirectoryPermissions,
-        this, &DiscoveryMainThread::singleDirectoryJobFirstDirectoryPermissionsSlot);
-    QObject::connect(_singleDirJob.data(), &DiscoverySingleDirectoryJob::etagConcatenation,
-        this, &DiscoveryMainThread::etagConcatenation);
-    QObject::connect(_singleDirJob.data(), &DiscoverySingleDirectoryJob::etag,
-        this, &DiscoveryMainThread::etag);
+void DiscoveryMainThread::startDirectoryJob(const QString &subPath)
+{
+    auto job = new DiscoverySingleDirectoryJob(_account, fullRemotePath(subPath), this);
+    _prefetched[subPath]._job = job;
+
+    QObject::connect(job, &DiscoverySingleDirectoryJob::finishedWithResult,
+        this, [this, subPath] { singleDirectoryJobResultSlot(subPath); });
+    QObject::connect(job, &DiscoverySingleDirectoryJob::finishedWithError,
+        this, [this, subPath](int csyncErrnoCode, const QString &msg) {
+            singleDirectoryJobFinishedWithErrorSlot(subPath, csyncErrnoCode, msg);
+        });
 
     if (!_firstFolderProcessed) {
-        _singleDirJob->setIsRootPath();
+        // No prefetching happens before the root listing is done, so this is the root.
+        job->setIsRootPath();
+        QObject::connect(job, &DiscoverySingleDirectoryJob::firstDirectoryPermissions,
+            this, &DiscoveryMainThread::singleDirectoryJobFirstDirectoryPermissionsSlot);
+        QObject::connect(job, &DiscoverySingleDirectoryJob::etagConcatenation,
+            this, &DiscoveryMainThread::etagConcatenation);
+        QObject::connect(job, &DiscoverySingleDirectoryJob::etag,
+            this, &DiscoveryMainThread::etag);
     }
 
-    _singleDirJob->start();
+    job->start();
 }
 
+void DiscoveryMainThread::enqueueSubDirectories(const QString &subPath, const QStringList &subDirectories)
+{
+    if (!_discoveryJob)
+        return;
+
+    _subDirectories[subPath].assign(subDirectories.begin(), subDirectories.end());
+
+    // The sync thread walks the tree depth first: the children of this directory
+    // will be wanted before the siblings that were queued earlier.
+    _prefetchQueue.insert(_prefetchQueue.begin(), subDirectories.begin(), subDirectories.end());
+
+    // The directories far ahead are listed once the sync thread gets to them
+    const size_t maxQueued = 100 * static_cast<size_t>(maximumActiveJobs());
+    if (_prefetchQueue.size() > maxQueued)
+        _prefetchQueue.erase(_prefetchQueue.begin() + maxQueued, _prefetchQueue.end());
+
+    startPrefetchJobs();
+}
 
-void DiscoveryMainThread::singleDirectoryJobResultSlot()
+void DiscoveryMainThread::startPrefetchJobs()
 {
-    if (!_currentDiscoveryDirectoryResult) {
-        return; // possibly aborted
+    const int maxActive = maximumActiveJobs();
+    // Finished listings stay in memory until the sync thread gets to them,
+    // don't let the prefetching run too far ahead.
+    const size_t maxPrefetched = 10 * maxActive;
+
+    int active = activeJobCount();
+    while (active < maxActive && _prefetched.size() < maxPrefetched && !_prefetchQueue.empty()) {
+        QString subPath = _prefetchQueue.front();
+        _prefetchQueue.pop_front();
+        if (_openedDirectories.contains(subPath) || _prefetched.count(subPath))
+            continue;
+        qCDebug(lcDiscovery) << "Prefetching directory listing for" << subPath;
+        startDirectoryJob(subPath);
+        ++active;
     }
+}
+
+void DiscoveryMainThread::dropSkippedDirectories(const QString &subPath)
+{
+    if (subPath.isEmpty())
+        return;
 
-    _currentDiscoveryDirectoryResult->list = _singleDirJob->takeResults();
-    _currentDiscoveryDirectoryResult->code = 0;
+    // The sync thread walks the tree depth first, in the order of the listings: the
+    // directories before this one in its parent are done. What it did not open in
+    // them was skipped, for example because it is ignored, and won't be wanted.
+    const QString parent = subPath.left(qMax(0, subPath.lastIndexOf(QLatin1Char('/'))));
+    auto siblingsIt = _subDirectories.find(parent);
+    if (siblingsIt == _subDirectories.end())
+        return;
+    auto &siblings = siblingsIt->second;
+    auto current = std::find(siblings.begin(), siblings.end(), subPath);
+    if (current == siblings.end())
+        return;
+    for (auto it = siblings.begin(); it != current; ++it)
+        dropPrefetched(*it);
+    siblings.erase(siblings.begin(), current);
+}
 
-    qCDebug(lcDiscovery) << "Have" << _currentDiscoveryDirectoryResult->list.size() << "results for " << _currentDiscoveryDirectoryResult->path;
+void DiscoveryMainThread::dropPrefetched(const QString &subPath)
+{
+    const QString prefix = subPath + QLatin1Char('/');
+    auto isBelow = [&](const QString &path) { return path == subPath || path.startsWith(prefix); };
 
-    _currentDiscoveryDirectoryResult = 0; // the sync thread owns it now
+    auto drop = [this](std::map<QString, PrefetchedDirectory>::iterator it) {
+        if (auto job = it->second._job) {
+            disconnect(job.data(), nullptr, this, nullptr);
+            job->abort();
+        }
+        qCDebug(lcDiscovery) << "Dropping the unused listing of" << it->first;
+        return _prefetched.erase(it);
+    };
+    auto it = _prefetched.find(subPath);
+    if (it != _prefetched.end())
+        drop(it);
+    for (it = _prefetched.lower_bound(prefix); it != _prefetched.end() && it->first.startsWith(prefix);)
+        it = drop(it);
+
+    _subDirectories.erase(subPath);
+    for (auto dirIt = _subDirectories.lower_bound(prefix); dirIt != _subDirectories.end() && dirIt->first.startsWith(prefix);)
+        dirIt = _subDirectories.erase(dirIt);
+
+    _prefetchQueue.erase(std::remove_if(_prefetchQueue.begin(), _prefetchQueue.end(), isBelow),
+        _prefetchQueue.end());
+}
 
-    if (!_firstFolderProcessed) {
-        _firstFolderProcessed = true;
-        _dataFingerprint = _singleDirJob->_dataFingerprint;
+void DiscoveryMainThread::deliverResult(PrefetchedDirectory &entry)
+{
+    _currentDiscoveryDirectoryResult->code = entry._code;
+    _currentDiscoveryDirectoryResult->msg = entry._msg;
+    _currentDiscoveryDirectoryResult->list = std::move(entry._list);
+
+    if (entry._code == 0) {
+        qCDebug(lcDiscovery) << "Have" << _currentDiscoveryDirectoryResult->list.size() << "results for " << _currentDiscoveryDirectoryResult->path;
     }
 
+    _currentDiscoveryDirectoryResult = 0; // the sync thread owns it now
+    _currentSubPath.clear();
+
     _discoveryJob->_vioMutex.lock();
     _discoveryJob->_vioWaitCondition.wakeAll();
     _discoveryJob->_vioMutex.unlock();
 }
 
-void DiscoveryMainThread::singleDirectoryJobFinishedWithErrorSlot(int csyncErrnoCode, const QString &msg)
+void DiscoveryMainThread::singleDirectoryJobResultSlot(const QString &subPath)
 {
-    if (!_currentDiscoveryDirectoryResult) {
+    auto it = _prefetched.find(subPath);
+    if (it == _prefetched.end() || !it->second._job) {
         return; // possibly aborted
     }
-    qCDebug(lcDiscovery) << csyncErrnoCode << msg;
+    auto &entry = it->second;
 
-    _currentDiscoveryDirectoryResult->code = csyncErrnoCode;
-    _currentDiscoveryDirectoryResult->msg = msg;
-    _currentDiscoveryDirectoryResult = 0; // the sync thread owns it now
+    entry._finished = true;
+    entry._code = 0;
+    entry._list = entry._job->takeResults();
 
-    _discoveryJob->_vioMutex.lock();
-    _discoveryJob->_vioWaitCondition.wakeAll();
-    _discoveryJob->_vioMutex.unlock();
+    if (!_firstFolderProcessed) {
+        _firstFolderProcessed = true;
+        _dataFingerprint = entry._job->_dataFingerprint;
+    }
+
+    if (_currentDiscoveryDirectoryResult && _currentSubPath == subPath) {
+        deliverResult(entry);
+        _prefetched.erase(it);
+    }
+
+    startPrefetchJobs();
+}
+
+void DiscoveryMainThread::singleDirectoryJobFinishedWithErrorSlot(const QString &subPath, int csyncErrnoCode, const QString &msg)
+{
+    auto it = _prefetched.find(subPath);
+    if (it == _prefetched.end()) {
+        return; // possibly aborted
+    }
+    qCDebug(lcDiscovery) << subPath << csyncErrnoCode << msg;
+
+    auto &entry = it->second;
+    entry._finished = true;
+    entry._code = csyncErrnoCode;
+    entry._msg = msg;
+
+    if (_currentDiscoveryDirectoryResult && _currentSubPath == subPath) {
+        deliverResult(entry);
+        _prefetched.erase(it);
+    }
+
+    startPrefetchJobs();
 }
 
 void DiscoveryMainThread::singleDirectoryJobFirstDirectoryPermissionsSlot(RemotePermissions p)
@@ -618,12 +780,15 @@ void DiscoveryMainThread::slotGetSizeResult(const QVariantMap &map)
 // called from SyncEngine
 void DiscoveryMainThread::abort()
 {
-    if (_singleDirJob) {
-        disconnect(_singleDirJob.data(), &DiscoverySingleDirectoryJob::finishedWithError, this, nullptr);
-        disconnect(_singleDirJob.data(), &DiscoverySingleDirectoryJob::firstDirectoryPermissions, this, nullptr);
-        disconnect(_singleDirJob.data(), &DiscoverySingleDirectoryJob::finishedWithResult, this, nullptr);
-        _singleDirJob->abort();
+    for (auto &it : _prefetched) {
+        if (auto job = it.second._job) {
+            disconnect(job.data(), nullptr, this, nullptr);
+            job->abort();
+        }
     }
+    _prefetched.clear();
+    _prefetchQueue.clear();
+    _subDirectories.clear();
     if (_currentDiscoveryDirectoryResult) {
         if (_discoveryJob->_vioMutex.tryLock()) {
             _currentDiscoveryDirectoryResult->msg = tr("Aborted by the user"); // Actually also created somewhere else by sync engine
@@ -667,11 +832,51 @@ csync_vio_handle_t *DiscoveryJob::remote_vio_opendir_hook(const char *url,
             return NULL;
         }
 
+        if (discoveryJob->_prefetchSubDirectories) {
+            emit discoveryJob->subDirectoriesToOpen(qurl, discoveryJob->findSubDirectoriesToOpen(qurl, directoryResult->list));
+        }
         return directoryResult.take();
     }
     return NULL;
 }
 
+QStringList DiscoveryJob::findSubDirectoriesToOpen(const QString &subPath,
+    const std::deque<std::unique_ptr<csync_file_stat_t>> &list) const
+{
+    QStringList subDirs;
+    for (const auto &fs : list) {
+        if (fs->type != ItemTypeDirectory)
+            continue;
+
+        QString path = QString::fromUtf8(fs->path);
+        if (!subPath.isEmpty())
+            path = subPath + QLatin1Char('/') + path;
+
+        // The same checks as in _csync_detect_update, excluded directories are not opened
+        if (_csync_ctx->ignore_hidden_files && fs->path.startsWith('.'))
+            continue;
+        if (_csync_ctx->exclude_traversal_fn
+            && _csync_ctx->exclude_traversal_fn(path.toUtf8(), ItemTypeDirectory) != CSYNC_NOT_EXCLUDED) {
+            continue;
+        }
+        if (!_selectiveSyncBlackList.isEmpty() && findPathInList(_selectiveSyncBlackList, path))
+            continue;
+
+        // Directories that did not change are read from the database
+        if (_csync_ctx->read_remote_from_db && _csync_ctx->statedb) {
+            SyncJournalFileRecord rec;
+            if (_csync_ctx->statedb->getFileRecord(path.toUtf8(), &rec) && rec.isValid()
+                && rec._etag == fs->etag
+                && rec._fileId == fs->file_id
+                && rec._remotePerm == fs->remotePerm) {
+                continue;
+            }
+        }
+        subDirs.append(path);
+    }
+    return subDirs;
+}
+
 
 std::unique_ptr<csync_file_stat_t> DiscoveryJob::remote_vio_readdir_hook(csync_vio_handle_t *dhandle,
     void *userdata)
@@ -700,6 +905,14 @@ void DiscoveryJob::remote_vio_closedir_hook(csync_vio_handle_t *dhandle, void *u
     }
 }
 
+void DiscoveryJob::propagate_early_callback(void *userdata, const csync_file_stat_t *file)
+{
+    DiscoveryJob *discoveryJob = static_cast<DiscoveryJob *>(userdata);
+    if (discoveryJob) {
+        emit discoveryJob->readyForEarlyPropagation(QSharedPointer<csync_file_stat_t>::create(*file));
+    }
+}
+
 void DiscoveryJob::start()
 {
     _selectiveSyncBlackList.sort();
@@ -708,6 +921,9 @@ void DiscoveryJob::start()
     _csync_ctx->callbacks.update_callback = update_job_update_callback;
     _csync_ctx->callbacks.checkSelectiveSyncBlackListHook = isInSelectiveSyncBlackListCallback;
     _csync_ctx->callbacks.checkSelectiveSyncNewFolderHook = checkSelectiveSyncNewFolderCallback;
+    if (_syncOptions._propagateDuringDiscovery) {
+        _csync_ctx->callbacks.propagate_early_hook = propagate_early_callback;
+    }
 
     _csync_ctx->callbacks.remote_opendir_hook = remote_vio_opendir_hook;
     _csync_ctx->callbacks.remote_readdir_hook = remote_vio_readdir_hook;
@@ -721,6 +937,7 @@ void DiscoveryJob::start()
     _csync_ctx->callbacks.checkSelectiveSyncBlackListHook = 0;
     _csync_ctx->callbacks.update_callback = 0;
     _csync_ctx->callbacks.update_callback_userdata = 0;
+    _csync_ctx->callbacks.propagate_early_hook = 0;
 
     emit finished(ret);
     deleteLater();
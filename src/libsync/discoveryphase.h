@@ -19,16 +19,20 @@
 #include <QStringList>
 #include <csync.h>
 #include <QMap>
+#include <QSet>
+#include <QSharedPointer>
 #include "networkjobs.h"
 #include <QMutex>
 #include <QWaitCondition>
 #include <QLinkedList>
 #include <deque>
+#include <map>
 #include "syncoptions.h"
 
 namespace OCC {
 
 class Account;
+class SyncJournalDb;
 
 /**
  * The Discovery Phase was once called "update" phase in csync terms.
@@ -105,13 +109,49 @@ class DiscoveryMainThread : public QObject
 {
     Q_OBJECT
 
+    /**
+     * A directory listing that was requested ahead of the sync thread asking for it.
+     *
+     * While the job is running, _job is set. Once it finished, the results (or the
+     * error) are kept here until the sync thread opens that directory.
+     */
+    struct PrefetchedDirectory
+    {
+        QPointer<DiscoverySingleDirectoryJob> _job;
+        bool _finished = false;
+        int _code = EIO;
+        QString _msg;
+        std::deque<std::unique_ptr<csync_file_stat_t>> _list;
+    };
+
     QPointer<DiscoveryJob> _discoveryJob;
-    QPointer<DiscoverySingleDirectoryJob> _singleDirJob;
     QString _pathPrefix; // remote path
     AccountPtr _account;
     DiscoveryDirectoryResult *_currentDiscoveryDirectoryResult;
+    QString _currentSubPath; // the directory the sync thread is waiting for
     qint64 *_currentGetSizeResult;
     bool _firstFolderProcessed;
+    int _maxActiveJobs;
+
+    // Keyed by the path relative to _pathPrefix, as passed to doOpendirSlot
+    std::map<QString, PrefetchedDirectory> _prefetched;
+    // Directories that will likely be opened by the sync thread, in the order it will want them.
+    // Only the first ones are kept, see enqueueSubDirectories().
+    std::deque<QString> _prefetchQueue;
+    // Directories the sync thread already asked for, they must not be prefetched again
+    QSet<QString> _openedDirectories;
+    // The sub directories the sync thread will open, by opened directory, in the order
+    // it walks them: the ones before the directory it opens are done
+    std::map<QString, std::deque<QString>> _subDirectories;
+
+    QString fullRemotePath(const QString &subPath) const;
+    void startDirectoryJob(const QString &subPath);
+    void enqueueSubDirectories(const QString &subPath, const QStringList &subDirectories);
+    void startPrefetchJobs();
+    void dropSkippedDirectories(const QString &subPath);
+    void dropPrefetched(const QString &subPath);
+    int activeJobCount() const;
+    void deliverResult(PrefetchedDirectory &entry);
 
 public:
     DiscoveryMainThread(AccountPtr account)
@@ -120,10 +160,21 @@ public:
         , _currentDiscoveryDirectoryResult(0)
         , _currentGetSizeResult(0)
         , _firstFolderProcessed(false)
+        , _maxActiveJobs(0)
     {
     }
     void abort();
 
+    /**
+     * Maximum number of directory listings that may be running at the same time.
+     *
+     * Listings beyond the one the sync thread waits for are speculative: they are
+     * started for sub directories that are likely to be opened next. 1 disables
+     * that prefetching, 0 (the default) picks a value depending on HTTP/2 support.
+     */
+    void setMaximumActiveJobs(int max) { _maxActiveJobs = max; }
+    int maximumActiveJobs() const;
+
     QByteArray _dataFingerprint;
 
 
@@ -133,8 +184,8 @@ public slots:
     void doGetSizeSlot(const QString &path, qint64 *result);
 
     // From Job:
-    void singleDirectoryJobResultSlot();
-    void singleDirectoryJobFinishedWithErrorSlot(int csyncErrnoCode, const QString &msg);
+    void singleDirectoryJobResultSlot(const QString &subPath);
+    void singleDirectoryJobFinishedWithErrorSlot(const QString &subPath, int csyncErrnoCode, const QString &msg);
     void singleDirectoryJobFirstDirectoryPermissionsSlot(RemotePermissions);
 
     void slotGetSizeFinishedWithError();
@@ -175,6 +226,9 @@ class DiscoveryJob : public QObject
         const char *dirname,
         void *userdata);
 
+    // Hands entries that can be propagated during the discovery to the main thread
+    static void propagate_early_callback(void *userdata, const csync_file_stat_t *file);
+
     // For using QNAM to get the directory listings
     static csync_vio_handle_t *remote_vio_opendir_hook(const char *url,
         void *userdata);
@@ -185,6 +239,12 @@ class DiscoveryJob : public QObject
     QMutex _vioMutex;
     QWaitCondition _vioWaitCondition;
 
+    // The sub directories of a listing that the sync thread will open, in its order.
+    // Called by the sync thread, which owns the exclude list and the csync context.
+    QStringList findSubDirectoriesToOpen(const QString &subPath,
+        const std::deque<std::unique_ptr<csync_file_stat_t>> &list) const;
+    bool _prefetchSubDirectories = false; // set up before start()
+
 
 public:
     explicit DiscoveryJob(CSYNC *ctx, QObject *parent = 0)
@@ -204,7 +264,17 @@ signals:
     void doOpendirSignal(QString url, DiscoveryDirectoryResult *);
     void doGetSizeSignal(const QString &path, qint64 *result);
 
+    // The sub directories of an opened directory that are likely opened next,
+    // see DiscoveryMainThread::setMaximumActiveJobs()
+    void subDirectoriesToOpen(const QString &subPath, const QStringList &subDirectories);
+
     // A new folder was discovered and was not synced because of the confirmation feature
     void newBigFolder(const QString &folder, bool isExternal);
+
+    // A copy of a new remote entry that can be propagated before the discovery is done,
+    // see SyncOptions::_propagateDuringDiscovery
+    void readyForEarlyPropagation(QSharedPointer<csync_file_stat_t> file);
 };
 }
+
+Q_DECLARE_METATYPE(QSharedPointer<csync_file_stat_t>)
@@ -25,6 +25,7 @@
 #include "filesystem.h"
 #include "common/utility.h"
 #include "account.h"
+#include "abstractnetworkjob.h"
 #include "common/asserts.h"
 
 #ifdef Q_OS_WIN
@@ -86,7 +87,42 @@ int OwncloudPropagator::maximumActiveTransferJob()
         // disable parallelism when there is a network limit.
         return 1;
     }
-    return qMin(3, qCeil(hardMaximumActiveJob() / 2.));
+    return _transferConcurrency.window();
+}
+
+void OwncloudPropagator::reportTransferRequest(AbstractNetworkJob *job, qint64 bytes, std::chrono::milliseconds duration)
+{
+    if (_abortRequested.fetchAndAddRelaxed(0))
+        return;
+
+    QNetworkReply *reply = job->reply();
+    auto outcome = TransferConcurrency::Outcome::Success;
+    switch (reply->error()) {
+    case QNetworkReply::NoError:
+        break;
+    case QNetworkReply::OperationCanceledError:
+        // Only timeouts hint at an overloaded connection, not jobs that were aborted
+        outcome = job->timedOut()
+            ? TransferConcurrency::Outcome::Congestion
+            : TransferConcurrency::Outcome::Failure;
+        break;
+    // Overloaded connections or servers tend to drop requests
+    case QNetworkReply::TimeoutError:
+    case QNetworkReply::RemoteHostClosedError:
+    case QNetworkReply::TemporaryNetworkFailureError:
+    case QNetworkReply::ProxyTimeoutError:
+    case QNetworkReply::ServiceUnavailableError:
+        outcome = TransferConcurrency::Outcome::Congestion;
+        break;
+    default: {
+        const int httpCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        outcome = httpCode == 429 || httpCode == 503
+            ? TransferConcurrency::Outcome::Congestion
+            : TransferConcurrency::Outcome::Failure;
+        break;
+    }
+    }
+    _transferConcurrency.addSample(bytes, duration, outcome);
 }
 
 /* The maximum number of active jobs in parallel  */
@@ -374,7 +410,9 @@ void OwncloudPropagator::start(const SyncFileItemVector &items)
      * In order to do that we loop over the items. (which are sorted by destination)
      * When we enter a directory, we can create the directory job and push it on the stack. */
 
-    _rootJob.reset(new PropagateDirectory(this));
+    // With startEarly() the root job is running already
+    if (!_rootJob)
+        _rootJob.reset(new PropagateDirectory(this));
     QStack<QPair<QString /* directory name */, PropagateDirectory * /* job */>> directories;
     directories.push(qMakePair(QString(), _rootJob.data()));
     QVector<PropagatorJob *> directoriesToRemove;
@@ -491,9 +529,65 @@ void OwncloudPropagator::start(const SyncFileItemVector &items)
 
     connect(_rootJob.data(), &PropagatorJob::finished, this, &OwncloudPropagator::emitFinished);
 
+    if (_earlyItemsJob) {
+        // Items below a directory that was created early are propagated after
+        // it, see PropagateDirectory::slotSubJobsFinished()
+        foreach (const SyncFileItemPtr &item, items) {
+            QString directory = item->destination();
+            int slash;
+            while ((slash = directory.lastIndexOf(QLatin1Char('/'))) > 0) {
+                directory.truncate(slash);
+                if (_earlyItemsJob->hasDirectory(directory))
+                    _earlyDirectoriesWithLaterItems.insert(directory);
+            }
+        }
+        _earlyItemsJob->close();
+        _rootJob->_subJobs.stopWaitingForMoreJobs();
+    }
+
+    scheduleNextJob();
+}
+
+void OwncloudPropagator::startEarly()
+{
+    ASSERT(!_rootJob);
+    _rootJob.reset(new PropagateDirectory(this));
+    // Don't finish before start() appended the other items
+    _rootJob->_subJobs._waitForMoreJobs = true;
+    _earlyItemsJob = new PropagateEarlyItems(this);
+    _rootJob->appendJob(_earlyItemsJob);
+
+    connect(this, &OwncloudPropagator::itemCompleted, this, &OwncloudPropagator::slotEarlyItemCompleted);
+}
+
+void OwncloudPropagator::appendEarlyItem(const SyncFileItemPtr &item)
+{
+    ASSERT(_earlyItemsJob);
+    _earlyItemsJob->appendItem(item);
     scheduleNextJob();
 }
 
+void OwncloudPropagator::slotEarlyItemCompleted(const SyncFileItemPtr &item)
+{
+    switch (item->_status) {
+    case SyncFileItem::FatalError:
+    case SyncFileItem::NormalError:
+    case SyncFileItem::SoftError:
+    case SyncFileItem::DetailError:
+    case SyncFileItem::BlacklistedError:
+        break;
+    default:
+        return;
+    }
+
+    QString directory = item->destination();
+    int slash;
+    while ((slash = directory.lastIndexOf(QLatin1Char('/'))) > 0) {
+        directory.truncate(slash);
+        _directoriesWithFailedEarlyItems.insert(directory);
+    }
+}
+
 const SyncOptions &OwncloudPropagator::syncOptions() const
 {
     return _syncOptions;
@@ -503,6 +597,9 @@ void OwncloudPropagator::setSyncOptions(const SyncOptions &syncOptions)
 {
     _syncOptions = syncOptions;
     _chunkSize = syncOptions._initialChunkSize;
+
+    const int maximum = hardMaximumActiveJob();
+    _transferConcurrency.setLimits(1, maximum, qMin(3, qCeil(maximum / 2.)));
 }
 
 bool OwncloudPropagator::localFileNameClash(const QString &relFile)
@@ -601,9 +698,7 @@ void OwncloudPropagator::scheduleNextJob()
 
 void OwncloudPropagator::scheduleNextJobImpl()
 {
-    // TODO: If we see that the automatic up-scaling has a bad impact we
-    // need to check how to avoid this.
-    // Down-scaling on slow networks? https://github.com/owncloud/client/issues/3382
+    // maximumActiveTransferJob() is adapted to the network by _transferConcurrency.
     // Making sure we do up/down at same time? https://github.com/owncloud/client/issues/1633
 
     if (_activeJobList.count() < maximumActiveTransferJob()) {
@@ -820,7 +915,7 @@ bool PropagatorCompositeJob::scheduleSelfOrChild()
 
     // If neither us or our children had stuff left to do we could hang. Make sure
     // we mark this job as finished so that the propagator can schedule a new one.
-    if (_jobsToDo.isEmpty() && _tasksToDo.isEmpty() && _runningJobs.isEmpty()) {
+    if (_jobsToDo.isEmpty() && _tasksToDo.isEmpty() && _runningJobs.isEmpty() && !_waitForMoreJobs) {
         // Our parent jobs are already iterating over their running jobs, post to the event loop
         // to avoid removing ourself from that list while they iterate.
         QMetaObject::invokeMethod(this, "finalize", Qt::QueuedConnection);
@@ -849,13 +944,21 @@ void PropagatorCompositeJob::slotSubJobFinished(SyncFileItem::Status status)
         _hasError = status;
     }
 
-    if (_jobsToDo.isEmpty() && _tasksToDo.isEmpty() && _runningJobs.isEmpty()) {
+    if (_jobsToDo.isEmpty() && _tasksToDo.isEmpty() && _runningJobs.isEmpty() && !_waitForMoreJobs) {
         finalize();
     } else {
         propagator()->scheduleNextJob();
     }
 }
 
+void PropagatorCompositeJob::stopWaitingForMoreJobs()
+{
+    _waitForMoreJobs = false;
+    if (_state == Running && _jobsToDo.isEmpty() && _tasksToDo.isEmpty() && _runningJobs.isEmpty()) {
+        QMetaObject::invokeMethod(this, "finalize", Qt::QueuedConnection);
+    }
+}
+
 void PropagatorCompositeJob::finalize()
 {
     // The propagator will do parallel scheduling and this could be posted
@@ -947,6 +1050,23 @@ void PropagateDirectory::slotFirstJobFinished(SyncFileItem::Status status)
 
 void PropagateDirectory::slotSubJobsFinished(SyncFileItem::Status status)
 {
+    if (!_item->isEmpty() && status == SyncFileItem::Success
+        && propagator()->hasFailedEarlyItemBelow(_item->destination())) {
+        // The failed item was propagated outside of this job, see PropagateEarlyItems
+        qCInfo(lcDirectory) << "Not storing the etag of" << _item->destination() << "because of failed items below";
+        status = SyncFileItem::SoftError;
+    }
+
+    if (!_item->isEmpty() && status == SyncFileItem::Success
+        && propagator()->hasLaterItemBelow(_item->destination())) {
+        // Ignored items, and items like renames that are only propagated after
+        // the discovery, are only found again if the etag isn't stored
+        qCInfo(lcDirectory) << "Not storing the etag of" << _item->destination() << "because of items propagated later";
+        _state = Finished;
+        emit finished(status);
+        return;
+    }
+
     if (!_item->isEmpty() && status == SyncFileItem::Success) {
         if (!_item->_renameTarget.isEmpty()) {
             if (_item->_instruction == CSYNC_INSTRUCTION_RENAME
@@ -985,6 +1105,50 @@ void PropagateDirectory::slotSubJobsFinished(SyncFileItem::Status status)
 
 // ================================================================================
 
+PropagateEarlyItems::PropagateEarlyItems(OwncloudPropagator *propagator)
+    : PropagateDirectory(propagator)
+{
+    _subJobs._waitForMoreJobs = true;
+}
+
+void PropagateEarlyItems::appendItem(const SyncFileItemPtr &item)
+{
+    PropagateDirectory *parentJob = this;
+    const int slash = item->destination().lastIndexOf(QLatin1Char('/'));
+    if (slash > 0) {
+        auto it = _directories.constFind(item->destination().left(slash));
+        if (it != _directories.constEnd()) {
+            parentJob = it.value();
+            if (!parentJob || parentJob->_state == Finished) {
+                // Creating the directory failed, the item is discovered again in the next sync
+                qCInfo(lcDirectory) << "Skipping" << item->destination() << "in a failed directory";
+                return;
+            }
+        }
+    }
+
+    if (item->isDirectory()) {
+        auto dir = new PropagateDirectory(propagator(), item);
+        dir->_subJobs._waitForMoreJobs = true;
+        parentJob->appendJob(dir);
+        _directories.insert(item->destination(), dir);
+    } else {
+        parentJob->appendTask(item);
+    }
+}
+
+void PropagateEarlyItems::close()
+{
+    foreach (const QPointer<PropagateDirectory> &dir, _directories) {
+        if (dir)
+            dir->_subJobs.stopWaitingForMoreJobs();
+    }
+    _directories.clear();
+    _subJobs.stopWaitingForMoreJobs();
+}
+
+// ================================================================================
+
 CleanupPollsJob::~CleanupPollsJob()
 {
 }
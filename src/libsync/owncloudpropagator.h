@@ -22,6 +22,7 @@
 #include <QElapsedTimer>
 #include <QTimer>
 #include <QPointer>
+#include <QSet>
 #include <QIODevice>
 #include <QMutex>
 
@@ -31,6 +32,7 @@
 #include "bandwidthmanager.h"
 #include "accountfwd.h"
 #include "syncoptions.h"
+#include "transferconcurrency.h"
 
 namespace OCC {
 
@@ -48,6 +50,7 @@ qint64 criticalFreeSpaceLimit();
 qint64 freeSpaceLimit();
 
 class SyncJournalDb;
+class AbstractNetworkJob;
 class OwncloudPropagator;
 class PropagatorCompositeJob;
 
@@ -219,9 +222,13 @@ public:
     SyncFileItem::Status _hasError; // NoStatus,  or NormalError / SoftError if there was an error
     quint64 _abortsCount;
 
+    /** While set, the job doesn't finish when it runs out of jobs because more
+     * are going to be appended, see OwncloudPropagator::startEarly() */
+    bool _waitForMoreJobs;
+
     explicit PropagatorCompositeJob(OwncloudPropagator *propagator)
         : PropagatorJob(propagator)
-        , _hasError(SyncFileItem::NoStatus), _abortsCount(0)
+        , _hasError(SyncFileItem::NoStatus), _abortsCount(0), _waitForMoreJobs(false)
     {
     }
 
@@ -241,6 +248,9 @@ public:
     virtual bool scheduleSelfOrChild() Q_DECL_OVERRIDE;
     virtual JobParallelism parallelism() Q_DECL_OVERRIDE;
 
+    /** Clears _waitForMoreJobs, the job finishes once its jobs are done */
+    void stopWaitingForMoreJobs();
+
     /*
      * Abort synchronously or asynchronously - some jobs
      * require to be finished without immediete abort (abort on job might
@@ -338,6 +348,40 @@ private slots:
 };
 
 
+/**
+ * @brief Propagates the items that are handed over while the discovery is still running
+ * @ingroup libsync
+ *
+ * New directories get their own PropagateDirectory job, and items below
+ * them are appended to it. All other items are expected to be in a directory
+ * that already exists locally.
+ *
+ * The job, and the directory jobs in it, keep running until close() was
+ * called. The jobs after it in the root job are only started once it is
+ * done, so that removals and renames see the new files.
+ */
+class PropagateEarlyItems : public PropagateDirectory
+{
+    Q_OBJECT
+public:
+    explicit PropagateEarlyItems(OwncloudPropagator *propagator);
+
+    JobParallelism parallelism() Q_DECL_OVERRIDE { return WaitForFinished; }
+
+    void appendItem(const SyncFileItemPtr &item);
+
+    /** Whether a job for the new directory was created */
+    bool hasDirectory(const QString &path) const { return _directories.contains(path); }
+
+    /** No more items are going to be appended */
+    void close();
+
+private:
+    // The jobs of the new directories, by path
+    QHash<QString, QPointer<PropagateDirectory>> _directories;
+};
+
+
 /**
  * @brief Dummy job that just mark it as completed and ignored
  * @ingroup libsync
@@ -386,6 +430,41 @@ public:
 
     void start(const SyncFileItemVector &_syncedItems);
 
+    /** Starts the propagation before the discovery is done.
+     *
+     * Items are handed over with appendEarlyItem() and are propagated
+     * before the ones passed to start(), which must still be called.
+     */
+    void startEarly();
+
+    /** Propagates a new remote item during the discovery.
+     *
+     * The parent directory must exist locally, or must have been appended
+     * before.
+     */
+    void appendEarlyItem(const SyncFileItemPtr &item);
+
+    /** Whether an item in the given directory, or below, was propagated
+     * early and failed.
+     *
+     * The etag of such a directory must not be stored, so that the failed
+     * item is discovered again.
+     */
+    bool hasFailedEarlyItemBelow(const QString &directory) const
+    {
+        return _directoriesWithFailedEarlyItems.contains(directory);
+    }
+
+    /** Whether the directory was created early and items below it were only
+     * passed to start(), including the ignored ones.
+     *
+     * The etag of such a directory must not be stored either.
+     */
+    bool hasLaterItemBelow(const QString &directory) const
+    {
+        return _earlyDirectoriesWithLaterItems.contains(directory);
+    }
+
     const SyncOptions &syncOptions() const;
     void setSyncOptions(const SyncOptions &syncOptions);
 
@@ -422,6 +501,14 @@ public:
     /* the maximum number of jobs using bandwidth (uploads or downloads, in parallel) */
     int maximumActiveTransferJob();
 
+    /** Adapts maximumActiveTransferJob() to the measured throughput, latency and errors */
+    const TransferConcurrency &transferConcurrency() const { return _transferConcurrency; }
+
+    /** Reports a finished upload or download request to the transfer concurrency
+     *  controller. bytes is the amount of data that was transferred by it.
+     */
+    void reportTransferRequest(AbstractNetworkJob *job, qint64 bytes, std::chrono::milliseconds duration);
+
     /** The size to use for upload chunks.
      *
      * Will be dynamically adjusted after each chunk upload finishes
@@ -525,6 +612,8 @@ private slots:
 
     void scheduleNextJobImpl();
 
+    void slotEarlyItemCompleted(const SyncFileItemPtr &item);
+
 signals:
     void newItem(const SyncFileItemPtr &);
     void itemCompleted(const SyncFileItemPtr &);
@@ -547,7 +636,11 @@ signals:
 private:
     AccountPtr _account;
     QScopedPointer<PropagateDirectory> _rootJob;
+    QPointer<PropagateEarlyItems> _earlyItemsJob;
+    QSet<QString> _directoriesWithFailedEarlyItems;
+    QSet<QString> _earlyDirectoriesWithLaterItems;
     SyncOptions _syncOptions;
+    TransferConcurrency _transferConcurrency;
 };
 
 
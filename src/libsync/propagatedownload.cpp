@@ -138,6 +138,7 @@ void GETFileJob::start()
 
     connect(this, &AbstractNetworkJob::networkActivity, account().data(), &Account::propagatorNetworkActivity);
 
+    _requestTimer.start();
     AbstractNetworkJob::start();
 }
 
@@ -226,9 +227,47 @@ void GETFileJob::slotMetaDataChanged()
         _lastModified = Utility::qDateTimeToTime_t(lastModified.toDateTime());
     }
 
+    // The start of a resumed file is not hashed, its checksums are computed
+    // from the file when the download is done.
+    if (_computeChecksums && !_saveBodyToFile && _resumeStart == 0) {
+        auto addChecksumCalculator = [this](const QByteArray &type) {
+            std::unique_ptr<ChecksumCalculator> calculator(new ChecksumCalculator(type));
+            if (calculator->isValid())
+                _checksumCalculators.push_back(std::move(calculator));
+        };
+        const QByteArray expectedType = parseChecksumHeaderType(expectedChecksumHeader(reply()));
+        addChecksumCalculator(expectedType);
+        if (_computeChecksumType != expectedType)
+            addChecksumCalculator(_computeChecksumType);
+    }
+
     _saveBodyToFile = true;
 }
 
+void GETFileJob::setComputeChecksums(const QByteArray &checksumType)
+{
+    _computeChecksums = true;
+    _computeChecksumType = checksumType;
+}
+
+QMap<QByteArray, QByteArray> GETFileJob::computedChecksums() const
+{
+    QMap<QByteArray, QByteArray> checksums;
+    for (const auto &calculator : _checksumCalculators) {
+        checksums[calculator->checksumType()] = calculator->result();
+    }
+    return checksums;
+}
+
+QByteArray GETFileJob::expectedChecksumHeader(QNetworkReply *reply)
+{
+    auto checksumHeader = findBestChecksum(reply->rawHeader(checkSumHeaderC));
+    auto contentMd5Header = reply->rawHeader(contentMd5HeaderC);
+    if (checksumHeader.isEmpty() && !contentMd5Header.isEmpty())
+        checksumHeader = "MD5:" + contentMd5Header;
+    return checksumHeader;
+}
+
 void GETFileJob::setBandwidthManager(BandwidthManager *bwm)
 {
     _bandwidthManager = bwm;
@@ -301,6 +340,9 @@ void GETFileJob::slotReadyRead()
                 reply()->abort();
                 return;
             }
+            for (const auto &calculator : _checksumCalculators) {
+                calculator->addData(buffer.constData(), r);
+            }
         }
     }
 
@@ -392,6 +434,7 @@ void PropagateDownloadFile::start()
         qCDebug(lcPropagateDownload) << _item->_file << "may not need download, computing checksum";
         auto computeChecksum = new ComputeChecksum(this);
         computeChecksum->setChecksumType(parseChecksumHeaderType(_item->_checksumHeader));
+        computeChecksum->setJournal(propagator()->_journal);
         connect(computeChecksum, &ComputeChecksum::done,
             this, &PropagateDownloadFile::conflictChecksumComputed);
         computeChecksum->start(propagator()->getFilePath(_item->_file));
@@ -523,6 +566,7 @@ void PropagateDownloadFile::startDownload()
             &_tmpFile, headers, expectedEtagForResume, _resumeStart, this);
     }
     _job->setBandwidthManager(&propagator()->_bandwidthManager);
+    _job->setComputeChecksums(contentChecksumType());
     connect(_job.data(), &GETFileJob::finishedSignal, this, &PropagateDownloadFile::slotGetFinished);
     connect(_job.data(), &GETFileJob::downloadProgress, this, &PropagateDownloadFile::slotDownloadProgress);
     propagator()->_activeJobList.append(this);
@@ -550,6 +594,8 @@ void PropagateDownloadFile::slotGetFinished()
     GETFileJob *job = _job;
     ASSERT(job);
 
+    propagator()->reportTransferRequest(job, job->currentDownloadPosition() - job->resumeStart(), job->msSinceStart());
+
     QNetworkReply::NetworkError err = job->reply()->error();
     if (err != QNetworkReply::NoError) {
         _item->_httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
@@ -684,16 +730,16 @@ void PropagateDownloadFile::slotGetFinished()
     // Do checksum validation for the download. If there is no checksum header, the validator
     // will also emit the validated() signal to continue the flow in slot transmissionChecksumValidated()
     // as this is (still) also correct.
+    // The checksums that were computed while the data was written spare
+    // reading the file again.
+    _computedChecksums = job->computedChecksums();
     ValidateChecksumHeader *validator = new ValidateChecksumHeader(this);
+    validator->setComputedChecksums(_computedChecksums);
     connect(validator, &ValidateChecksumHeader::validated,
         this, &PropagateDownloadFile::transmissionChecksumValidated);
     connect(validator, &ValidateChecksumHeader::validationFailed,
         this, &PropagateDownloadFile::slotChecksumFail);
-    auto checksumHeader = findBestChecksum(job->reply()->rawHeader(checkSumHeaderC));
-    auto contentMd5Header = job->reply()->rawHeader(contentMd5HeaderC);
-    if (checksumHeader.isEmpty() && !contentMd5Header.isEmpty())
-        checksumHeader = "MD5:" + contentMd5Header;
-    validator->start(_tmpFile.fileName(), checksumHeader);
+    validator->start(_tmpFile.fileName(), GETFileJob::expectedChecksumHeader(job->reply()));
 }
 
 void PropagateDownloadFile::slotChecksumFail(const QString &errMsg)
@@ -808,6 +854,10 @@ void PropagateDownloadFile::transmissionChecksumValidated(const QByteArray &chec
     if (theContentChecksumType == checksumType || theContentChecksumType.isEmpty()) {
         return contentChecksumComputed(checksumType, checksum);
     }
+    const QByteArray computedChecksum = _computedChecksums.value(theContentChecksumType);
+    if (!computedChecksum.isEmpty()) {
+        return contentChecksumComputed(theContentChecksumType, computedChecksum);
+    }
 
     // Compute the content checksum.
     auto computeChecksum = new ComputeChecksum(this);
@@ -15,10 +15,14 @@
 
 #include "owncloudpropagator.h"
 #include "networkjobs.h"
+#include "common/checksums.h"
 
 #include <QBuffer>
 #include <QFile>
 
+#include <memory>
+#include <vector>
+
 namespace OCC {
 
 /**
@@ -42,10 +46,16 @@ class GETFileJob : public AbstractNetworkJob
     QPointer<BandwidthManager> _bandwidthManager;
     bool _hasEmittedFinishedSignal;
     time_t _lastModified;
+    QElapsedTimer _requestTimer;
 
     /// Will be set to true once we've seen a 2xx response header
     bool _saveBodyToFile = false;
 
+    /// See setComputeChecksums()
+    bool _computeChecksums = false;
+    QByteArray _computeChecksumType;
+    std::vector<std::unique_ptr<ChecksumCalculator>> _checksumCalculators;
+
 public:
     // DOES NOT take ownership of the device.
     explicit GETFileJob(AccountPtr account, const QString &path, QFile *device,
@@ -99,6 +109,23 @@ public:
     quint64 resumeStart() { return _resumeStart; }
     time_t lastModified() { return _lastModified; }
 
+    std::chrono::milliseconds msSinceStart() const
+    {
+        return std::chrono::milliseconds(_requestTimer.elapsed());
+    }
+
+    /**
+     * Makes the job hash the body while it is written to the device, with
+     * the type of the checksum the server sends and with \a checksumType.
+     * That is only done if the whole file is written, not when resuming.
+     */
+    void setComputeChecksums(const QByteArray &checksumType);
+
+    /// The checksums of the written data by type, empty if none were computed
+    QMap<QByteArray, QByteArray> computedChecksums() const;
+
+    /// The checksum header the downloaded data has to match, empty if there is none
+    static QByteArray expectedChecksumHeader(QNetworkReply *reply);
 
 signals:
     void finishedSignal();
@@ -131,10 +158,12 @@ private slots:
       done?-> slotGetFinished()                    |
                 |                                  |
                 +-> validate checksum header       |
+                    (computed while downloading)   |
                                                    |
       done?-> transmissionChecksumValidated()      |
                 |                                  |
                 +-> compute the content checksum   |
+                    (unless computed already)      |
                                                    |
       done?-> contentChecksumComputed()            |
                 |                                  |
@@ -203,6 +232,8 @@ private:
     QFile _tmpFile;
     bool _deleteExisting;
     ConflictRecord _conflictRecord;
+    // Checksums of the downloaded data computed by the GETFileJob
+    QMap<QByteArray, QByteArray> _computedChecksums;
 
     QElapsedTimer _stopwatch;
 };
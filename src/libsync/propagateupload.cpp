@@ -33,7 +33,6 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <cmath>
-#include <cstring>
 
 namespace OCC {
 
@@ -224,9 +223,19 @@ void PropagateUploadFileCommon::slotComputeContentChecksum()
         return;
     }
 
+    // Compute the checksums from the data that is sent instead of reading
+    // the whole file before the upload, see slotStartUpload()
+    if (propagator()->syncOptions()._checksumWhileUploading && canComputeChecksumsWhileUploading()) {
+        _item->_checksumHeader.clear();
+        _checksumWhileUploading = true;
+        slotStartUpload(QByteArray(), QByteArray());
+        return;
+    }
+
     // Compute the content checksum.
     auto computeChecksum = new ComputeChecksum(this);
     computeChecksum->setChecksumType(checksumType);
+    computeChecksum->setJournal(propagator()->_journal);
 
     connect(computeChecksum, &ComputeChecksum::done,
         this, &PropagateUploadFileCommon::slotComputeTransmissionChecksum);
@@ -240,20 +249,16 @@ void PropagateUploadFileCommon::slotComputeTransmissionChecksum(const QByteArray
     _item->_checksumHeader = makeChecksumHeader(contentChecksumType, contentChecksum);
 
     // Reuse the content checksum as the transmission checksum if possible
-    const auto supportedTransmissionChecksums =
-        propagator()->account()->capabilities().supportedChecksumTypes();
-    if (supportedTransmissionChecksums.contains(contentChecksumType)) {
+    const QByteArray checksumType = transmissionChecksumType(contentChecksumType);
+    if (checksumType == contentChecksumType) {
         slotStartUpload(contentChecksumType, contentChecksum);
         return;
     }
 
     // Compute the transmission checksum.
     auto computeChecksum = new ComputeChecksum(this);
-    if (uploadChecksumEnabled()) {
-        computeChecksum->setChecksumType(propagator()->account()->capabilities().uploadChecksumType());
-    } else {
-        computeChecksum->setChecksumType(QByteArray());
-    }
+    computeChecksum->setChecksumType(checksumType);
+    computeChecksum->setJournal(propagator()->_journal);
 
     connect(computeChecksum, &ComputeChecksum::done,
         this, &PropagateUploadFileCommon::slotStartUpload);
@@ -263,6 +268,29 @@ void PropagateUploadFileCommon::slotComputeTransmissionChecksum(const QByteArray
     computeChecksum->start(filePath);
 }
 
+QByteArray PropagateUploadFileCommon::transmissionChecksumType(const QByteArray &contentChecksumType)
+{
+    const auto &capabilities = propagator()->account()->capabilities();
+    if (capabilities.supportedChecksumTypes().contains(contentChecksumType)) {
+        return contentChecksumType;
+    }
+    if (uploadChecksumEnabled()) {
+        return capabilities.uploadChecksumType();
+    }
+    return QByteArray();
+}
+
+void PropagateUploadFileCommon::takeUploadChecksums()
+{
+    ASSERT(_uploadChecksums && _uploadChecksums->isComplete());
+    _transmissionChecksumHeader = _uploadChecksums->transmissionChecksumHeader();
+    _item->_checksumHeader = _uploadChecksums->contentChecksumHeader();
+    if (_item->_checksumHeader.isEmpty()) {
+        _item->_checksumHeader = _transmissionChecksumHeader;
+    }
+    _uploadChecksums.reset();
+}
+
 void PropagateUploadFileCommon::slotStartUpload(const QByteArray &transmissionChecksumType, const QByteArray &transmissionChecksum)
 {
     // Remove ourselfs from the list of active job, before any posible call to done()
@@ -296,6 +324,11 @@ void PropagateUploadFileCommon::slotStartUpload(const QByteArray &transmissionCh
     quint64 fileSize = FileSystem::getSize(fullFilePath);
     _item->_size = fileSize;
 
+    if (_checksumWhileUploading) {
+        const QByteArray checksumType = contentChecksumType();
+        _uploadChecksums.reset(new UploadChecksums(checksumType, transmissionChecksumType(checksumType), fileSize));
+    }
+
     // But skip the file if the mtime is too close to 'now'!
     // That usually indicates a file that is still being changed
     // or not yet fully copied to the destination.
@@ -308,8 +341,83 @@ void PropagateUploadFileCommon::slotStartUpload(const QByteArray &transmissionCh
     doStartUpload();
 }
 
+UploadChecksums::UploadChecksums(const QByteArray &contentChecksumType, const QByteArray &transmissionChecksumType, qint64 size)
+    : _content(contentChecksumType)
+    , _transmissionType(transmissionChecksumType)
+    , _size(size)
+{
+    if (!transmissionChecksumType.isEmpty() && transmissionChecksumType != contentChecksumType) {
+        _transmission.reset(new ChecksumCalculator(transmissionChecksumType));
+    }
+}
+
+void UploadChecksums::addData(qint64 offset, const char *data, qint64 length)
+{
+    // Skip what was hashed already, and data after a gap
+    if (_finished || offset > _hashed || offset + length <= _hashed) {
+        return;
+    }
+    const qint64 skip = _hashed - offset;
+    length = qMin(length - skip, _size - _hashed);
+    _content.addData(data + skip, length);
+    if (_transmission) {
+        _transmission->addData(data + skip, length);
+    }
+    _hashed += length;
+}
+
+bool UploadChecksums::addDataFromFile(const QString &fileName)
+{
+    QFile file(fileName);
+    QString openError;
+    if (!FileSystem::openAndSeekFileSharedRead(&file, &openError, _hashed)) {
+        qCWarning(lcPropagateUpload) << "Could not read" << fileName << "for the checksums:" << openError;
+        return false;
+    }
+    QByteArray buffer(int(qMin<qint64>(_size - _hashed, 500 * 1024)), Qt::Uninitialized);
+    while (!isComplete()) {
+        const auto read = file.read(buffer.data(), qMin<qint64>(buffer.size(), _size - _hashed));
+        if (read <= 0) {
+            qCWarning(lcPropagateUpload) << "Could not read" << fileName << "for the checksums:" << file.errorString();
+            return false;
+        }
+        addData(_hashed, buffer.constData(), read);
+    }
+    return true;
+}
+
+QByteArray UploadChecksums::contentChecksumHeader()
+{
+    finish();
+    return _contentHeader;
+}
+
+QByteArray UploadChecksums::transmissionChecksumHeader()
+{
+    finish();
+    return _transmissionHeader;
+}
+
+void UploadChecksums::finish()
+{
+    if (_finished) {
+        return;
+    }
+    _finished = true;
+    _contentHeader = makeChecksumHeader(_content.checksumType(), _content.result());
+    if (_transmission) {
+        _transmissionHeader = makeChecksumHeader(_transmissionType, _transmission->result());
+    } else if (_transmissionType == _content.checksumType()) {
+        _transmissionHeader = _contentHeader;
+    }
+}
+
 UploadDevice::UploadDevice(BandwidthManager *bwm)
-    : _read(0)
+    : _start(0)
+    , _size(0)
+    , _fileSize(0)
+    , _fileModtime(0)
+    , _read(0)
     , _bandwidthManager(bwm)
     , _bandwidthQuota(0)
     , _readWithProgress(0)
@@ -329,23 +437,20 @@ UploadDevice::~UploadDevice()
 
 bool UploadDevice::prepareAndOpen(const QString &fileName, qint64 start, qint64 size)
 {
-    _data.clear();
+    _file.close();
     _read = 0;
 
-    QFile file(fileName);
+    _file.setFileName(fileName);
     QString openError;
-    if (!FileSystem::openAndSeekFileSharedRead(&file, &openError, start)) {
+    if (!FileSystem::openAndSeekFileSharedRead(&_file, &openError, start)) {
         setErrorString(openError);
         return false;
     }
 
-    size = qBound(0ll, size, FileSystem::getSize(fileName) - start);
-    _data.resize(size);
-    auto read = file.read(_data.data(), size);
-    if (read != size) {
-        setErrorString(file.errorString());
-        return false;
-    }
+    _fileSize = FileSystem::getSize(fileName);
+    _fileModtime = FileSystem::getModTime(fileName);
+    _start = start;
+    _size = qBound(0ll, size, _fileSize - start);
 
     return QIODevice::open(QIODevice::ReadOnly);
 }
@@ -359,14 +464,14 @@ qint64 UploadDevice::writeData(const char *, qint64)
 
 qint64 UploadDevice::readData(char *data, qint64 maxlen)
 {
-    if (_data.size() - _read <= 0) {
+    if (_size - _read <= 0) {
         // at end
         if (_bandwidthManager) {
             _bandwidthManager->unregisterUploadDevice(this);
         }
         return -1;
     }
-    maxlen = qMin(maxlen, _data.size() - _read);
+    maxlen = qMin(maxlen, _size - _read);
     if (maxlen == 0) {
         return 0;
     }
@@ -378,11 +483,34 @@ qint64 UploadDevice::readData(char *data, qint64 maxlen)
         if (maxlen <= 0) { // no quota
             return 0;
         }
-        _bandwidthQuota -= maxlen;
     }
-    std::memcpy(data, _data.data() + _read, maxlen);
-    _read += maxlen;
-    return maxlen;
+
+    // The position of the file differs after Qt seeked back to resend
+    if (_file.pos() != _start + _read && !_file.seek(_start + _read)) {
+        setErrorString(_file.errorString());
+        return -1;
+    }
+    auto read = _file.read(data, maxlen);
+    if (read <= 0) {
+        // The file was truncated while being uploaded
+        setErrorString(read < 0 ? _file.errorString() : tr("Local file changed during sync."));
+        return -1;
+    }
+    if (isBandwidthLimited()) {
+        _bandwidthQuota -= read;
+    }
+    if (_checksums) {
+        _checksums->addData(_start + _read, data, read);
+    }
+    _read += read;
+
+    // Don't let the end of the data go out if the file was modified while
+    // it was read: the server would get a mix of the old and new content.
+    if (_read == _size && FileSystem::fileChanged(_file.fileName(), _fileSize, _fileModtime)) {
+        setErrorString(tr("Local file changed during sync."));
+        return -1;
+    }
+    return read;
 }
 
 void UploadDevice::slotJobUploadProgress(qint64 sent, qint64 t)
@@ -395,17 +523,17 @@ void UploadDevice::slotJobUploadProgress(qint64 sent, qint64 t)
 
 bool UploadDevice::atEnd() const
 {
-    return _read >= _data.size();
+    return _read >= _size;
 }
 
 qint64 UploadDevice::size() const
 {
-    return _data.size();
+    return _size;
 }
 
 qint64 UploadDevice::bytesAvailable() const
 {
-    return _data.size() - _read + QIODevice::bytesAvailable();
+    return _size - _read + QIODevice::bytesAvailable();
 }
 
 // random access, we can seek
@@ -419,7 +547,7 @@ bool UploadDevice::seek(qint64 pos)
     if (!QIODevice::seek(pos)) {
         return false;
     }
-    if (pos < 0 || pos > _data.size()) {
+    if (pos < 0 || pos > _size) {
         return false;
     }
     _read = pos;
@@ -510,6 +638,15 @@ void PropagateUploadFileCommon::commonErrorHandling(AbstractNetworkJob *job)
     QString errorString = job->errorStringParsingBody(&replyContent);
     qCDebug(lcPropagateUpload) << replyContent; // display the XML error in the debug
 
+    // The upload device stops sending when the file changes underneath it,
+    // report that instead of the resulting network error.
+    const QString fullFilePath = propagator()->getFilePath(_item->_file);
+    if (!FileSystem::verifyFileUnchanged(fullFilePath, _item->_size, _item->_modtime)) {
+        propagator()->_anotherSyncNeeded = true;
+        abortWithError(SyncFileItem::SoftError, tr("Local file changed during sync."));
+        return;
+    }
+
     if (_item->_httpErrorCode == 412) {
         // Precondition Failed: Either an etag or a checksum mismatch.
 
@@ -566,6 +703,9 @@ void PropagateUploadFileCommon::abort(PropagatorJob::AbortType abortType)
 // This function is used whenever there is an error occuring and jobs might be in progress
 void PropagateUploadFileCommon::abortWithError(SyncFileItem::Status status, const QString &error)
 {
+    // The replies of the other running jobs finish while they are aborted,
+    // their handlers must not report the error again
+    _finished = true;
     abort(AbortType::Synchronous);
     done(status, error);
 }
@@ -632,6 +772,20 @@ void PropagateUploadFileCommon::finalize()
     done(SyncFileItem::Success);
 }
 
+bool PropagateUploadFileCommon::isParallelChunkUploadEnabled()
+{
+    if (_uploadChecksums) {
+        // The checksums can only be computed from chunks sent in order
+        return false;
+    }
+    if (propagator()->account()->capabilities().chunkingParallelUploadDisabled()) {
+        // Server may also disable parallel chunked upload for any higher version
+        return false;
+    }
+    QByteArray env = qgetenv("OWNCLOUD_PARALLEL_CHUNK");
+    return env.isEmpty() || (env != "false" && env != "0");
+}
+
 void PropagateUploadFileCommon::prepareAbort(PropagatorJob::AbortType abortType) {
     if (!_jobs.empty()) {
         // Count number of jobs to be aborted asynchronously
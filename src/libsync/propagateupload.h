@@ -15,6 +15,7 @@
 
 #include "owncloudpropagator.h"
 #include "networkjobs.h"
+#include "common/checksums.h"
 
 #include <QBuffer>
 #include <QFile>
@@ -28,8 +29,61 @@ Q_DECLARE_LOGGING_CATEGORY(lcPropagateUpload)
 
 class BandwidthManager;
 
+/**
+ * @brief Computes the checksums of a file from the data its uploads send
+ *
+ * Used instead of reading the file for the checksums before the upload,
+ * see SyncOptions::_checksumWhileUploading. Data is only hashed when it
+ * continues the data hashed so far: data that is sent again after a seek is
+ * skipped, and data that is sent before the data in front of it can't be
+ * hashed. What was not hashed while it was sent, for example the chunks of
+ * a resumed upload, is read from the file with addDataFromFile().
+ *
+ * @ingroup libsync
+ */
+class UploadChecksums
+{
+public:
+    /** The transmission checksum is the content checksum if the types match */
+    UploadChecksums(const QByteArray &contentChecksumType, const QByteArray &transmissionChecksumType, qint64 size);
+
+    /** Called by the upload devices with the data read at \a offset of the file */
+    void addData(qint64 offset, const char *data, qint64 length);
+
+    /** Hashes the rest of the file, returns false if it can't be read */
+    bool addDataFromFile(const QString &fileName);
+
+    /** Whether all the data of the file was hashed */
+    bool isComplete() const { return _hashed == _size; }
+
+    /** The checksum headers, no data may be added afterwards */
+    QByteArray contentChecksumHeader();
+    QByteArray transmissionChecksumHeader();
+
+private:
+    void finish();
+
+    ChecksumCalculator _content;
+    // Only set if it differs from the content checksum
+    std::unique_ptr<ChecksumCalculator> _transmission;
+    QByteArray _transmissionType;
+    QByteArray _contentHeader;
+    QByteArray _transmissionHeader;
+    qint64 _size;
+    qint64 _hashed = 0;
+    bool _finished = false;
+};
+
 /**
  * @brief The UploadDevice class
+ *
+ * Streams a range of a local file to the network. The data is read from the
+ * file when the network asks for it, so only the read-ahead of QIODevice and
+ * QNAM is held in memory instead of the whole chunk.
+ *
+ * If the file changes while it is being sent, reading fails with an error so
+ * the changed data is not uploaded.
+ *
  * @ingroup libsync
  */
 class UploadDevice : public QIODevice
@@ -39,9 +93,12 @@ public:
     UploadDevice(BandwidthManager *bwm);
     ~UploadDevice();
 
-    /** Reads the data from the file and opens the device */
+    /** Opens the file and the device, the data is read when it is uploaded */
     bool prepareAndOpen(const QString &fileName, qint64 start, qint64 size);
 
+    /** Passes the data that is read to \a checksums */
+    void setChecksums(const QSharedPointer<UploadChecksums> &checksums) { _checksums = checksums; }
+
     qint64 writeData(const char *, qint64) Q_DECL_OVERRIDE;
     qint64 readData(char *data, qint64 maxlen) Q_DECL_OVERRIDE;
     bool atEnd() const Q_DECL_OVERRIDE;
@@ -59,11 +116,19 @@ public:
 signals:
 
 private:
-    // The file data
-    QByteArray _data;
+    // The file the data is read from
+    QFile _file;
+    // Offset and size of the uploaded range in the file
+    qint64 _start;
+    qint64 _size;
+    // Size and mtime of the file when it was opened, to detect changes
+    qint64 _fileSize;
+    time_t _fileModtime;
     // Position in the data
     qint64 _read;
 
+    QSharedPointer<UploadChecksums> _checksums;
+
     // Bandwidth manager related
     QPointer<BandwidthManager> _bandwidthManager;
     qint64 _bandwidthQuota;
@@ -143,6 +208,9 @@ public:
         return std::chrono::milliseconds(_requestTimer.elapsed());
     }
 
+    /** The size of the data that is uploaded */
+    qint64 size() const { return _device->size(); }
+
 signals:
     void finishedSignal();
     void uploadProgress(qint64, qint64);
@@ -196,6 +264,10 @@ signals:
  *         |
  *         v
  *    slotStartUpload()  -> doStartUpload()
+ *
+ * With SyncOptions::_checksumWhileUploading the checksums are not computed
+ * before slotStartUpload(); the upload devices feed _uploadChecksums instead
+ * and the headers are set with takeUploadChecksums() when all data is sent.
  *                                  .
  *                                  .
  *                                  v
@@ -211,6 +283,8 @@ protected:
     bool _deleteExisting BITFIELD(1);
     quint64 _abortCount; /// Keep track of number of aborted items
     QByteArray _transmissionChecksumHeader;
+    bool _checksumWhileUploading = false; /// The checksums are computed from the sent data
+    QSharedPointer<UploadChecksums> _uploadChecksums; /// Set from slotStartUpload() until takeUploadChecksums()
 
 public:
     PropagateUploadFileCommon(OwncloudPropagator *propagator, const SyncFileItemPtr &item)
@@ -278,6 +352,20 @@ protected:
 
     // Bases headers that need to be sent with every chunk
     QMap<QByteArray, QByteArray> headers();
+
+    /** Whether the server and the OWNCLOUD_PARALLEL_CHUNK environment variable
+     *  allow uploading several chunks of a file at the same time
+     */
+    bool isParallelChunkUploadEnabled();
+
+    /** Whether the checksum headers are sent after all the data, so they can be computed while uploading */
+    virtual bool canComputeChecksumsWhileUploading() const { return false; }
+
+    /** The checksum type sent to the server, given the content checksum type */
+    QByteArray transmissionChecksumType(const QByteArray &contentChecksumType);
+
+    /** Sets the checksum headers from the complete _uploadChecksums */
+    void takeUploadChecksums();
 };
 
 /**
@@ -337,10 +425,9 @@ class PropagateUploadFileNG : public PropagateUploadFileCommon
 {
     Q_OBJECT
 private:
-    quint64 _sent = 0; /// amount of data (bytes) that was already sent
+    quint64 _sent = 0; /// amount of data (bytes) of the chunks that were started or are on the server
     uint _transferId = 0; /// transfer id (part of the url)
     int _currentChunk = 0; /// Id of the next chunk that will be sent
-    quint64 _currentChunkSize = 0; /// current chunk size
     bool _removeJobError = false; /// If not null, there was an error removing the job
 
     // Map chunk number with its size  from the PROPFIND on resume.
@@ -366,9 +453,14 @@ public:
 
     void doStartUpload() Q_DECL_OVERRIDE;
 
+protected:
+    // The checksum header is sent with the final MOVE
+    bool canComputeChecksumsWhileUploading() const Q_DECL_OVERRIDE { return true; }
+
 private:
     void startNewUpload();
     void startNextChunk();
+    void readUploadChecksumsFromFile();
 public slots:
     void abort(AbortType abortType) Q_DECL_OVERRIDE;
 private slots:
@@ -380,5 +472,6 @@ private slots:
     void slotPutFinished();
     void slotMoveJobFinished();
     void slotUploadProgress(qint64, qint64);
+    void slotUploadChecksumsRead();
 };
 }
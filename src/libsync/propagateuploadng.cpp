@@ -30,6 +30,8 @@
 #include <QNetworkAccessManager>
 #include <QFileInfo>
 #include <QDir>
+#include <QFutureWatcher>
+#include <qtconcurrentrun.h>
 #include <cmath>
 #include <cstring>
 
@@ -75,6 +77,11 @@ QUrl PropagateUploadFileNG::chunkUrl(int chunk)
     |
     +-> MOVE ------> moveJobFinished() ---> finalize()
 
+  Several chunks may be uploaded at the same time, startNextChunk() starts
+  as many as the propagator has room for. The MOVE is only sent once all of
+  them are finished. If the upload is interrupted, the server may have a few
+  chunks after a hole; resuming uploads again from the first missing chunk
+  and deletes the later ones.
 
  */
 
@@ -275,10 +282,22 @@ void PropagateUploadFileNG::startNextChunk()
     ENFORCE(fileSize >= _sent, "Sent data exceeds file size");
 
     // prevent situation that chunk size is bigger then required one to send
-    _currentChunkSize = qMin(propagator()->_chunkSize, fileSize - _sent);
+    const quint64 currentChunkSize = qMin(propagator()->_chunkSize, fileSize - _sent);
 
-    if (_currentChunkSize == 0) {
-        Q_ASSERT(_jobs.isEmpty()); // There should be no running job anymore
+    if (currentChunkSize == 0) {
+        if (!_jobs.isEmpty()) {
+            // Wait for the other chunks to be uploaded, and let other items
+            // use the free slot in the meantime
+            propagator()->scheduleNextJob();
+            return;
+        }
+        if (_uploadChecksums) {
+            if (!_uploadChecksums->isComplete()) {
+                readUploadChecksumsFromFile();
+                return;
+            }
+            takeUploadChecksums();
+        }
         _finished = true;
 
         // Finish with a MOVE
@@ -310,7 +329,7 @@ void PropagateUploadFileNG::startNextChunk()
     auto device = new UploadDevice(&propagator()->_bandwidthManager);
     const QString fileName = propagator()->getFilePath(_item->_file);
 
-    if (!device->prepareAndOpen(fileName, _sent, _currentChunkSize)) {
+    if (!device->prepareAndOpen(fileName, _sent, currentChunkSize)) {
         qCWarning(lcPropagateUpload) << "Could not prepare upload device: " << device->errorString();
 
         // If the file is currently locked, we want to retry the sync
@@ -322,11 +341,12 @@ void PropagateUploadFileNG::startNextChunk()
         abortWithError(SyncFileItem::SoftError, device->errorString());
         return;
     }
+    device->setChecksums(_uploadChecksums);
 
     QMap<QByteArray, QByteArray> headers;
     headers["OC-Chunk-Offset"] = QByteArray::number(_sent);
 
-    _sent += _currentChunkSize;
+    _sent += currentChunkSize;
     QUrl url = chunkUrl(_currentChunk);
 
     // job takes ownership of device via a QScopedPointer. Job deletes itself when finishing
@@ -341,6 +361,50 @@ void PropagateUploadFileNG::startNextChunk()
     job->start();
     propagator()->_activeJobList.append(this);
     _currentChunk++;
+
+    // Upload the next chunk at the same time if the propagator has room for it
+    if (_sent < fileSize && isParallelChunkUploadEnabled()
+        && propagator()->_activeJobList.count() < propagator()->maximumActiveTransferJob()) {
+        startNextChunk();
+    }
+}
+
+static bool addUploadChecksumsFromFile(QSharedPointer<UploadChecksums> checksums, const QString &fileName)
+{
+    return checksums->addDataFromFile(fileName);
+}
+
+void PropagateUploadFileNG::readUploadChecksumsFromFile()
+{
+    // Chunks that were uploaded by a previous sync were not hashed
+    qCInfo(lcPropagateUpload) << "Reading" << _item->_file << "for the checksums of the uploaded data";
+
+    auto watcher = new QFutureWatcher<bool>(this);
+    connect(watcher, &QFutureWatcher<bool>::finished, this, &PropagateUploadFileNG::slotUploadChecksumsRead);
+    propagator()->_activeJobList.append(this);
+    // The thread keeps the checksums alive if this job is deleted meanwhile
+    watcher->setFuture(QtConcurrent::run(addUploadChecksumsFromFile, _uploadChecksums,
+        propagator()->getFilePath(_item->_file)));
+}
+
+void PropagateUploadFileNG::slotUploadChecksumsRead()
+{
+    auto watcher = static_cast<QFutureWatcher<bool> *>(sender());
+    watcher->deleteLater();
+    propagator()->_activeJobList.removeOne(this);
+
+    if (propagator()->_abortRequested.fetchAndAddRelaxed(0)) {
+        return;
+    }
+
+    // The data read now must be what was uploaded before
+    const QString fullFilePath = propagator()->getFilePath(_item->_file);
+    if (!watcher->result() || !FileSystem::verifyFileUnchanged(fullFilePath, _item->_size, _item->_modtime)) {
+        propagator()->_anotherSyncNeeded = true;
+        abortWithError(SyncFileItem::SoftError, tr("Local file changed during sync."));
+        return;
+    }
+    startNextChunk();
 }
 
 void PropagateUploadFileNG::slotPutFinished()
@@ -351,6 +415,7 @@ void PropagateUploadFileNG::slotPutFinished()
     slotJobDestroyed(job); // remove it from the _jobs list
 
     propagator()->_activeJobList.removeOne(this);
+    propagator()->reportTransferRequest(job, job->size(), job->msSinceStart());
 
     if (_finished) {
         // We have sent the finished signal already. We don't need to handle any remaining jobs
@@ -366,6 +431,7 @@ void PropagateUploadFileNG::slotPutFinished()
     }
 
     ENFORCE(_sent <= _item->_size, "can't send more than size");
+    const quint64 chunkSize = job->size();
 
     // Adjust the chunk size for the time taken.
     //
@@ -374,7 +440,7 @@ void PropagateUploadFileNG::slotPutFinished()
     auto targetDuration = propagator()->syncOptions()._targetChunkUploadDuration;
     if (targetDuration.count() > 0) {
         auto uploadTime = ++job->msSinceStart(); // add one to avoid div-by-zero
-        qint64 predictedGoodSize = (_currentChunkSize * targetDuration) / uploadTime;
+        qint64 predictedGoodSize = (chunkSize * targetDuration) / uploadTime;
 
         // The whole targeting is heuristic. The predictedGoodSize will fluctuate
         // quite a bit because of external factors (like available bandwidth)
@@ -390,18 +456,19 @@ void PropagateUploadFileNG::slotPutFinished()
             targetSize,
             propagator()->syncOptions()._maxChunkSize);
 
-        qCInfo(lcPropagateUpload) << "Chunked upload of" << _currentChunkSize << "bytes took" << uploadTime.count()
+        qCInfo(lcPropagateUpload) << "Chunked upload of" << chunkSize << "bytes took" << uploadTime.count()
                                   << "ms, desired is" << targetDuration.count() << "ms, expected good chunk size is"
                                   << predictedGoodSize << "bytes and nudged next chunk size to "
                                   << propagator()->_chunkSize << "bytes";
     }
 
-    _finished = _sent == _item->_size;
+    // Whether all the data is on the server now
+    const bool allChunksUploaded = _sent == _item->_size && _jobs.isEmpty();
 
     // Check if the file still exists
     const QString fullFilePath(propagator()->getFilePath(_item->_file));
     if (!FileSystem::fileExists(fullFilePath)) {
-        if (!_finished) {
+        if (!allChunksUploaded) {
             abortWithError(SyncFileItem::SoftError, tr("The local file was removed during sync."));
             return;
         } else {
@@ -412,13 +479,13 @@ void PropagateUploadFileNG::slotPutFinished()
     // Check whether the file changed since discovery.
     if (!FileSystem::verifyFileUnchanged(fullFilePath, _item->_size, _item->_modtime)) {
         propagator()->_anotherSyncNeeded = true;
-        if (!_finished) {
+        if (!allChunksUploaded) {
             abortWithError(SyncFileItem::SoftError, tr("Local file changed during sync."));
             return;
         }
     }
 
-    if (!_finished) {
+    if (!allChunksUploaded) {
         // Deletes an existing blacklist entry on successful chunk upload
         if (_item->_hasBlacklistEntry) {
             propagator()->_journal->wipeErrorBlacklistEntry(_item->_file);
@@ -484,7 +551,16 @@ void PropagateUploadFileNG::slotUploadProgress(qint64 sent, qint64 total)
     if (sent == 0 && total == 0) {
         return;
     }
-    propagator()->reportProgress(*_item, _sent + sent - total);
+
+    // _sent includes all the chunks that were started, subtract what the
+    // running ones did not send yet
+    sender()->setProperty("byteWritten", sent);
+    quint64 amount = _sent;
+    foreach (AbstractNetworkJob *j, _jobs) {
+        if (auto putJob = qobject_cast<PUTFileJob *>(j))
+            amount -= putJob->size() - putJob->property("byteWritten").toLongLong();
+    }
+    propagator()->reportProgress(*_item, amount);
 }
 
 void PropagateUploadFileNG::abort(PropagatorJob::AbortType abortType)
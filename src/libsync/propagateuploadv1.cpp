@@ -148,26 +148,15 @@ void PropagateUploadFileV1::startNextChunk()
     propagator()->_activeJobList.append(this);
     _currentChunk++;
 
-    bool parallelChunkUpload = true;
+    bool parallelChunkUpload = isParallelChunkUploadEnabled();
 
-    if (propagator()->account()->capabilities().chunkingParallelUploadDisabled()) {
-        // Server may also disable parallel chunked upload for any higher version
+    if (parallelChunkUpload && qEnvironmentVariableIsEmpty("OWNCLOUD_PARALLEL_CHUNK")
+        && propagator()->account()->serverVersionInt() < Account::makeServerVersion(8, 0, 3)) {
+        // Disable parallel chunk upload severs older than 8.0.3 to avoid too many
+        // internal sever errors (#2743, #2938)
         parallelChunkUpload = false;
-    } else {
-        QByteArray env = qgetenv("OWNCLOUD_PARALLEL_CHUNK");
-        if (!env.isEmpty()) {
-            parallelChunkUpload = env != "false" && env != "0";
-        } else {
-            int versionNum = propagator()->account()->serverVersionInt();
-            if (versionNum < Account::makeServerVersion(8, 0, 3)) {
-                // Disable parallel chunk upload severs older than 8.0.3 to avoid too many
-                // internal sever errors (#2743, #2938)
-                parallelChunkUpload = false;
-            }
-        }
     }
 
-
     if (_currentChunk + _startChunk >= _chunkCount - 1) {
         // Don't do parallel upload of chunk if this might be the last chunk because the server cannot handle that
         // https://github.com/owncloud/core/issues/11106
@@ -191,6 +180,7 @@ void PropagateUploadFileV1::slotPutFinished()
     slotJobDestroyed(job); // remove it from the _jobs list
 
     propagator()->_activeJobList.removeOne(this);
+    propagator()->reportTransferRequest(job, job->size(), job->msSinceStart());
 
     if (_finished) {
         // We have sent the finished signal already. We don't need to handle any remaining jobs
@@ -59,6 +59,7 @@ static const int s_touchedFilesMaxAgeMs = 15 * 1000;
 bool SyncEngine::s_anySyncRunning = false;
 
 qint64 SyncEngine::minimumFileAgeForUpload = 2000;
+qint64 SyncEngine::minimumProgressInterval = 250;
 
 SyncEngine::SyncEngine(AccountPtr account, const QString &localPath,
     const QString &remotePath, OCC::SyncJournalDb *journal)
@@ -75,6 +76,7 @@ SyncEngine::SyncEngine(AccountPtr account, const QString &localPath,
     , _backInTimeFiles(0)
     , _uploadLimit(0)
     , _downloadLimit(0)
+    , _checksum_hook(journal)
     , _anotherSyncNeeded(NoFollowUpSync)
 {
     qRegisterMetaType<SyncFileItem>("SyncFileItem");
@@ -83,6 +85,7 @@ SyncEngine::SyncEngine(AccountPtr account, const QString &localPath,
     qRegisterMetaType<SyncFileStatus>("SyncFileStatus");
     qRegisterMetaType<SyncFileItemVector>("SyncFileItemVector");
     qRegisterMetaType<SyncFileItem::Direction>("SyncFileItem::Direction");
+    qRegisterMetaType<QSharedPointer<csync_file_stat_t>>();
 
     // Everything in the SyncEngine expects a trailing slash for the localPath.
     ASSERT(localPath.endsWith(QLatin1Char('/')));
@@ -98,6 +101,9 @@ SyncEngine::SyncEngine(AccountPtr account, const QString &localPath,
     _clearTouchedFilesTimer.setInterval(30 * 1000);
     connect(&_clearTouchedFilesTimer, &QTimer::timeout, this, &SyncEngine::slotClearTouchedFiles);
 
+    _progressIntervalTimer.setSingleShot(true);
+    connect(&_progressIntervalTimer, &QTimer::timeout, this, &SyncEngine::slotProgressIntervalElapsed);
+
     _thread.setObjectName("SyncEngine_Thread");
 }
 
@@ -266,12 +272,12 @@ static bool isFileModifyingInstruction(csync_instructions_e instruction)
 void SyncEngine::deleteStaleDownloadInfos(const SyncFileItemVector &syncItems)
 {
     // Find all downloadinfo paths that we want to preserve.
-    QSet<QString> download_file_paths;
+    QVector<QString> download_file_paths;
     foreach (const SyncFileItemPtr &it, syncItems) {
         if (it->_direction == SyncFileItem::Down
             && it->_type == ItemTypeFile
             && isFileTransferInstruction(it->_instruction)) {
-            download_file_paths.insert(it->_file);
+            download_file_paths.append(it->_file);
         }
     }
 
@@ -288,12 +294,12 @@ void SyncEngine::deleteStaleDownloadInfos(const SyncFileItemVector &syncItems)
 void SyncEngine::deleteStaleUploadInfos(const SyncFileItemVector &syncItems)
 {
     // Find all blacklisted paths that we want to preserve.
-    QSet<QString> upload_file_paths;
+    QVector<QString> upload_file_paths;
     foreach (const SyncFileItemPtr &it, syncItems) {
         if (it->_direction == SyncFileItem::Up
             && it->_type == ItemTypeFile
             && isFileTransferInstruction(it->_instruction)) {
-            upload_file_paths.insert(it->_file);
+            upload_file_paths.append(it->_file);
         }
     }
 
@@ -314,10 +320,10 @@ void SyncEngine::deleteStaleUploadInfos(const SyncFileItemVector &syncItems)
 void SyncEngine::deleteStaleErrorBlacklistEntries(const SyncFileItemVector &syncItems)
 {
     // Find all blacklisted paths that we want to preserve.
-    QSet<QString> blacklist_file_paths;
+    QVector<QString> blacklist_file_paths;
     foreach (const SyncFileItemPtr &it, syncItems) {
         if (it->_hasBlacklistEntry)
-            blacklist_file_paths.insert(it->_file);
+            blacklist_file_paths.append(it->_file);
     }
 
     // Delete from journal.
@@ -812,6 +818,18 @@ void SyncEngine::startSync()
     _syncItemMap.clear();
     _needsUpdate = false;
 
+    // Reset here rather than after the discovery: items can be propagated during it
+    _hasNoneFiles = false;
+    _hasRemoveFile = false;
+    _hasForwardInTimeFiles = false;
+    _backInTimeFiles = 0;
+    _seenFiles.clear();
+    _temporarilyUnavailablePaths.clear();
+    _renamedFolders.clear();
+    _propagatingEarly = false;
+    _earlyItems.clear();
+    _rejectedEarlyDirectories.clear();
+
     csync_resume(_csync_ctx.data());
 
     if (!_journal->exists()) {
@@ -846,11 +864,21 @@ void SyncEngine::startSync()
 
     _csync_ctx->read_remote_from_db = true;
 
+    if (_syncOptions._journalSnapshot && !_journal->createMetadataSnapshot()) {
+        qCWarning(lcEngine) << "Could not load the journal snapshot, using the database directly";
+    }
+
+    _csync_ctx->local.prefetch_threads = _syncOptions._localDiscoveryThreads > 0
+        ? _syncOptions._localDiscoveryThreads
+        : QThread::idealThreadCount();
+
     _lastLocalDiscoveryStyle = _localDiscoveryStyle;
     _csync_ctx->should_discover_locally_fn = [this](const QByteArray &path) {
         return shouldDiscoverLocally(path);
     };
 
+    _csync_ctx->reconcile_during_discovery = _syncOptions._reconcileDuringDiscovery
+        || _syncOptions._propagateDuringDiscovery;
     _csync_ctx->new_files_are_placeholders = _syncOptions._newFilesArePlaceholders;
     _csync_ctx->placeholder_suffix = _syncOptions._placeholderSuffix.toUtf8();
     if (_csync_ctx->new_files_are_placeholders && _csync_ctx->placeholder_suffix.isEmpty()) {
@@ -891,6 +919,8 @@ void SyncEngine::startSync()
 
     _discoveryMainThread = new DiscoveryMainThread(account());
     _discoveryMainThread->setParent(this);
+    _discoveryMainThread->setMaximumActiveJobs(
+        _syncOptions._parallelNetworkJobs ? _syncOptions._parallelDiscoveryJobs : 1);
     connect(this, &SyncEngine::finished, _discoveryMainThread.data(), &QObject::deleteLater);
     qCInfo(lcEngine) << "Server" << account()->serverVersion()
                      << (account()->isHttp2Supported() ? "Using HTTP/2" : "");
@@ -920,6 +950,8 @@ void SyncEngine::startSync()
 
     connect(discoveryJob, &DiscoveryJob::newBigFolder,
         this, &SyncEngine::newBigFolder);
+    connect(discoveryJob, &DiscoveryJob::readyForEarlyPropagation,
+        this, &SyncEngine::slotReadyForEarlyPropagation);
 
 
     // This is used for the DiscoveryJob to be able to request the main thread/
@@ -930,6 +962,50 @@ void SyncEngine::startSync()
     QMetaObject::invokeMethod(discoveryJob, "start", Qt::QueuedConnection);
 }
 
+void SyncEngine::slotReadyForEarlyPropagation(QSharedPointer<csync_file_stat_t> file)
+{
+    const QString path = QString::fromUtf8(file->path);
+    const int slash = path.lastIndexOf('/');
+    const bool parentRejected = slash > 0 && _rejectedEarlyDirectories.contains(path.left(slash));
+
+    treewalkFile(file.data(), nullptr, true);
+
+    // Anything but a plain download, e.g. because of the error blacklist, is
+    // left in the map and propagated after the discovery.
+    auto it = _syncItemMap.find(path);
+    if (parentRejected || it == _syncItemMap.end()
+        || (*it)->_instruction != CSYNC_INSTRUCTION_NEW || (*it)->_direction != SyncFileItem::Down) {
+        if (file->type == ItemTypeDirectory)
+            _rejectedEarlyDirectories.insert(path);
+        return;
+    }
+    SyncFileItemPtr item = *it;
+    _syncItemMap.erase(it);
+
+    if (!_propagatingEarly) {
+        qCInfo(lcEngine) << "#### Starting propagation during the discovery";
+        createPropagator();
+        connect(_propagator.data(), &OwncloudPropagator::finished, this, &SyncEngine::slotEarlyPropagationFinished, Qt::QueuedConnection);
+        _propagator->startEarly();
+        _propagatingEarly = true;
+        emit started();
+    }
+
+    _earlyItems.insert(path, item);
+    _propagator->appendEarlyItem(item);
+}
+
+void SyncEngine::slotEarlyPropagationFinished()
+{
+    if (!_propagatingEarly)
+        return;
+    qCWarning(lcEngine) << "Propagation was aborted during the discovery, aborting the discovery";
+    csync_request_abort(_csync_ctx.data());
+    if (_discoveryMainThread) {
+        _discoveryMainThread->abort();
+    }
+}
+
 void SyncEngine::slotFolderDiscovered(bool local, const QString &folder)
 {
     // Currently remote and local discovery never run in parallel
@@ -967,6 +1043,11 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     }
     qCInfo(lcEngine) << "#### Discovery end #################################################### " << _stopWatch.addLapTime(QLatin1String("Discovery Finished")) << "ms";
 
+    // Drop directory listings that were prefetched but not needed after all
+    if (_discoveryMainThread) {
+        _discoveryMainThread->abort();
+    }
+
     // Sanity check
     if (!_journal->isConnected()) {
         qCWarning(lcEngine) << "Bailing out, DB failure";
@@ -990,20 +1071,25 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
 
     qCInfo(lcEngine) << "#### Reconcile end #################################################### " << _stopWatch.addLapTime(QLatin1String("Reconcile Finished")) << "ms";
 
-    _hasNoneFiles = false;
-    _hasRemoveFile = false;
-    _hasForwardInTimeFiles = false;
-    _backInTimeFiles = 0;
-    bool walkOk = true;
-    _seenFiles.clear();
-    _temporarilyUnavailablePaths.clear();
-    _renamedFolders.clear();
+    // The propagation writes to the journal, release the memory of the snapshot
+    _journal->dropMetadataSnapshot();
 
+    bool walkOk = true;
     if (csync_walk_local_tree(_csync_ctx.data(), [this](csync_file_stat_t *f, csync_file_stat_t *o) { return treewalkFile(f, o, false); } ) < 0) {
         qCWarning(lcEngine) << "Error in local treewalk.";
         walkOk = false;
     }
-    if (walkOk && csync_walk_remote_tree(_csync_ctx.data(), [this](csync_file_stat_t *f, csync_file_stat_t *o) { return treewalkFile(f, o, true); } ) < 0) {
+    auto remoteVisitor = [this](csync_file_stat_t *f, csync_file_stat_t *o) {
+        if (f->propagated_early) {
+            // Already walked, see slotReadyForEarlyPropagation(). Only the ignored files
+            // below a directory are known once its discovery is done.
+            if (SyncFileItemPtr item = _earlyItems.value(QString::fromUtf8(f->path)))
+                item->_serverHasIgnoredFiles = f->has_ignored_files;
+            return 0;
+        }
+        return treewalkFile(f, o, true);
+    };
+    if (walkOk && csync_walk_remote_tree(_csync_ctx.data(), remoteVisitor) < 0) {
         qCWarning(lcEngine) << "Error in remote treewalk.";
     }
 
@@ -1090,7 +1176,7 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
 
     // it's important to do this before ProgressInfo::start(), to announce start of new sync
     _progressInfo->_status = ProgressInfo::Propagation;
-    emit transmissionProgress(*_progressInfo);
+    emitProgress();
     _progressInfo->startEstimateUpdates();
 
     // post update phase script: allow to tweak stuff by a custom script in debug mode.
@@ -1108,14 +1194,52 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     // do a database commit
     _journal->commit("post treewalk");
 
+    const bool propagatingEarly = _propagatingEarly;
+    if (propagatingEarly) {
+        if (_propagator->_finishedEmited) {
+            // Aborted in the meantime, see slotEarlyPropagationFinished()
+            finalize(false);
+            return;
+        }
+        disconnect(_propagator.data(), &OwncloudPropagator::finished, this, &SyncEngine::slotEarlyPropagationFinished);
+        _propagatingEarly = false;
+    } else {
+        createPropagator();
+    }
+    connect(_propagator.data(), &OwncloudPropagator::finished, this, &SyncEngine::slotFinished, Qt::QueuedConnection);
+
+    // The items that are propagated already must keep their journal entries
+    SyncFileItemVector knownItems = syncItems;
+    foreach (const SyncFileItemPtr &item, _earlyItems) {
+        knownItems.append(item);
+    }
+    deleteStaleDownloadInfos(knownItems);
+    deleteStaleUploadInfos(knownItems);
+    deleteStaleErrorBlacklistEntries(knownItems);
+    _journal->commit("post stale entry removal");
+
+    // Emit the started signal only after the propagator has been set up.
+    if (_needsUpdate && !propagatingEarly)
+        emit(started());
+
+    _propagator->start(syncItems);
+
+    qCInfo(lcEngine) << "#### Post-Reconcile end #################################################### " << _stopWatch.addLapTime(QLatin1String("Post-Reconcile Finished")) << "ms";
+}
+
+void SyncEngine::createPropagator()
+{
     _propagator = QSharedPointer<OwncloudPropagator>(
         new OwncloudPropagator(_account, _localPath, _remotePath, _journal));
     _propagator->setSyncOptions(_syncOptions);
+    if (_syncOptions._asyncJournalWrites)
+        _journal->setAsyncWritesEnabled(true);
+    if (_syncOptions._journalBulkLoad && _journal->startBulkLoad())
+        qCInfo(lcEngine) << "Writing the journal records of the initial sync in bulk";
     connect(_propagator.data(), &OwncloudPropagator::itemCompleted,
         this, &SyncEngine::slotItemCompleted);
     connect(_propagator.data(), &OwncloudPropagator::progress,
         this, &SyncEngine::slotProgress);
-    connect(_propagator.data(), &OwncloudPropagator::finished, this, &SyncEngine::slotFinished, Qt::QueuedConnection);
     connect(_propagator.data(), &OwncloudPropagator::seenLockedFile, this, &SyncEngine::seenLockedFile);
     connect(_propagator.data(), &OwncloudPropagator::touchedFile, this, &SyncEngine::slotAddTouchedFile);
     connect(_propagator.data(), &OwncloudPropagator::insufficientLocalStorage, this, &SyncEngine::slotInsufficientLocalStorage);
@@ -1124,19 +1248,6 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
 
     // apply the network limits to the propagator
     setNetworkLimits(_uploadLimit, _downloadLimit);
-
-    deleteStaleDownloadInfos(syncItems);
-    deleteStaleUploadInfos(syncItems);
-    deleteStaleErrorBlacklistEntries(syncItems);
-    _journal->commit("post stale entry removal");
-
-    // Emit the started signal only after the propagator has been set up.
-    if (_needsUpdate)
-        emit(started());
-
-    _propagator->start(syncItems);
-
-    qCInfo(lcEngine) << "#### Post-Reconcile end #################################################### " << _stopWatch.addLapTime(QLatin1String("Post-Reconcile Finished")) << "ms";
 }
 
 void SyncEngine::slotCleanPollsJobAborted(const QString &error)
@@ -1172,7 +1283,7 @@ void SyncEngine::slotItemCompleted(const SyncFileItemPtr &item)
         csyncError(item->_errorString);
     }
 
-    emit transmissionProgress(*_progressInfo);
+    emitThrottledProgress();
     emit itemCompleted(item);
 }
 
@@ -1182,6 +1293,18 @@ void SyncEngine::slotFinished(bool success)
         _anotherSyncNeeded = ImmediateFollowUp;
     }
 
+    // The journal must contain the records of all propagated items before
+    // the cleanup, and before the sync is reported as finished
+    if (!_journal->flushWrites()) {
+        csyncError(tr("Error writing metadata to the database"));
+        success = false;
+    }
+    _journal->setAsyncWritesEnabled(false);
+    if (!_journal->finishBulkLoad()) {
+        csyncError(tr("Error writing metadata to the database"));
+        success = false;
+    }
+
     if (success) {
         _journal->setDataFingerprint(_discoveryMainThread->_dataFingerprint);
     }
@@ -1200,12 +1323,25 @@ void SyncEngine::slotFinished(bool success)
     _progressInfo->_lastCompletedItem = SyncFileItem();
     _progressInfo->_status = ProgressInfo::Done;
     emit transmissionProgress(*_progressInfo);
+    _progressIntervalTimer.stop();
+    _progressPending = false;
 
     finalize(success);
 }
 
 void SyncEngine::finalize(bool success)
 {
+    if (_propagatingEarly) {
+        _propagatingEarly = false;
+        disconnect(_propagator.data(), &OwncloudPropagator::finished, this, &SyncEngine::slotEarlyPropagationFinished);
+        if (!_propagator->_finishedEmited) {
+            // The sync failed while items were propagated already, wait until they are aborted
+            connect(_propagator.data(), &OwncloudPropagator::finished, this, [this] { finalize(false); }, Qt::QueuedConnection);
+            _propagator->abort();
+            return;
+        }
+    }
+
     _thread.quit();
     _thread.wait();
 
@@ -1224,9 +1360,13 @@ void SyncEngine::finalize(bool success)
     _seenFiles.clear();
     _temporarilyUnavailablePaths.clear();
     _renamedFolders.clear();
+    _earlyItems.clear();
+    _rejectedEarlyDirectories.clear();
     _uniqueErrors.clear();
     _localDiscoveryPaths.clear();
     _localDiscoveryStyle = LocalDiscoveryStyle::FilesystemOnly;
+    _progressIntervalTimer.stop();
+    _progressPending = false;
 
     _clearTouchedFilesTimer.start();
 }
@@ -1234,7 +1374,30 @@ void SyncEngine::finalize(bool success)
 void SyncEngine::slotProgress(const SyncFileItem &item, quint64 current)
 {
     _progressInfo->setProgressItem(item, current);
+    emitThrottledProgress();
+}
+
+void SyncEngine::emitThrottledProgress()
+{
+    if (_progressIntervalTimer.isActive()) {
+        _progressPending = true;
+        return;
+    }
+    emitProgress();
+}
+
+void SyncEngine::emitProgress()
+{
+    _progressPending = false;
     emit transmissionProgress(*_progressInfo);
+    if (minimumProgressInterval > 0)
+        _progressIntervalTimer.start(minimumProgressInterval);
+}
+
+void SyncEngine::slotProgressIntervalElapsed()
+{
+    if (_progressPending && _syncRunning)
+        emitProgress();
 }
 
 
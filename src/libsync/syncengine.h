@@ -23,6 +23,7 @@
 #include <QString>
 #include <QSet>
 #include <QMap>
+#include <QHash>
 #include <QStringList>
 #include <QSharedPointer>
 #include <set>
@@ -101,6 +102,16 @@ public:
      */
     static qint64 minimumFileAgeForUpload; // in ms
 
+    /**
+     * Minimum time, in milliseconds, between two transmissionProgress signals
+     * caused by transfer progress or completed items.
+     *
+     * Status changes are always reported immediately, the latest progress of
+     * a throttled period is sent when it ends. Every completed item is
+     * reported through itemCompleted.
+     */
+    static qint64 minimumProgressInterval; // in ms
+
     /**
      * Control whether local discovery should read from filesystem or db.
      *
@@ -183,9 +194,19 @@ private slots:
     void slotItemCompleted(const SyncFileItemPtr &item);
     void slotFinished(bool success);
     void slotProgress(const SyncFileItem &item, quint64 curent);
+    void slotProgressIntervalElapsed();
     void slotDiscoveryJobFinished(int updateResult);
     void slotCleanPollsJobAborted(const QString &error);
 
+    /** Hands a new remote item to the propagator while the discovery is running.
+     *
+     * See SyncOptions::_propagateDuringDiscovery.
+     */
+    void slotReadyForEarlyPropagation(QSharedPointer<csync_file_stat_t> file);
+
+    /** The propagator finished during the discovery: it was aborted */
+    void slotEarlyPropagationFinished();
+
     /** Records that a file was touched by a job. */
     void slotAddTouchedFile(const QString &fn);
 
@@ -205,6 +226,9 @@ private:
     QString journalDbFilePath() const;
 
     int treewalkFile(csync_file_stat_t *file, csync_file_stat_t *other, bool);
+
+    // Creates _propagator and connects to it
+    void createPropagator();
     bool checkErrorBlacklisting(SyncFileItem &item);
 
     // Cleans up unnecessary downloadinfo entries in the journal as well
@@ -223,6 +247,12 @@ private:
     // cleanup and emit the finished signal
     void finalize(bool success);
 
+    /** Emits transmissionProgress, unless it was emitted within minimumProgressInterval */
+    void emitThrottledProgress();
+
+    /** Emits transmissionProgress now and starts a new throttling period */
+    void emitProgress();
+
     static bool s_anySyncRunning; //true when one sync is running somewhere (for debugging)
 
     // Must only be acessed during update and reconcile
@@ -305,6 +335,12 @@ private:
     /** For clearing the _touchedFiles variable after sync finished */
     QTimer _clearTouchedFilesTimer;
 
+    /** Runs while progress is throttled, see minimumProgressInterval */
+    QTimer _progressIntervalTimer;
+
+    /** Whether progress changed since transmissionProgress was last emitted */
+    bool _progressPending = false;
+
     /** List of unique errors that occurred in a sync run. */
     QSet<QString> _uniqueErrors;
 
@@ -312,6 +348,16 @@ private:
     LocalDiscoveryStyle _lastLocalDiscoveryStyle = LocalDiscoveryStyle::FilesystemOnly;
     LocalDiscoveryStyle _localDiscoveryStyle = LocalDiscoveryStyle::FilesystemOnly;
     std::set<QByteArray> _localDiscoveryPaths;
+
+    /** Whether items are propagated while the discovery is still running */
+    bool _propagatingEarly = false;
+
+    /** The items that were handed to the propagator during the discovery, by path */
+    QHash<QString, SyncFileItemPtr> _earlyItems;
+
+    /** New remote directories that were not propagated during the discovery,
+     * their content isn't either */
+    QSet<QString> _rejectedEarlyDirectories;
 };
 }
 
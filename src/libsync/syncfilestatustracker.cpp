@@ -146,7 +146,7 @@ SyncFileStatus SyncFileStatusTracker::fileStatus(const QString &relativePath)
 
     // First look it up in the database to know if it's shared
     SyncJournalFileRecord rec;
-    if (_syncEngine->journal()->getFileRecord(relativePath, &rec) && rec.isValid()) {
+    if (_syncEngine->journal()->getCommittedFileRecord(relativePath, &rec) && rec.isValid()) {
         return resolveSyncAndErrorStatus(relativePath, rec._remotePerm.hasPermission(RemotePermissions::IsShared) ? Shared : NotShared);
     }
 
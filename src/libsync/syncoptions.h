@@ -63,6 +63,66 @@ struct SyncOptions
 
     /** Whether parallel network jobs are allowed. */
     bool _parallelNetworkJobs = true;
+
+    /** The maximum number of remote directory listings running at the same time
+     * during discovery.
+     *
+     * 0 picks a default depending on whether HTTP/2 is used, 1 disables the
+     * prefetching of sub directory listings.
+     */
+    int _parallelDiscoveryJobs = 0;
+
+    /** The number of threads reading local directories during discovery.
+     *
+     * 0 uses one thread per core, 1 reads every directory on the discovery
+     * thread when it is entered.
+     */
+    int _localDiscoveryThreads = 0;
+
+    /** Whether the journal's metadata table is loaded into memory for the
+     * discovery and reconcile phases.
+     *
+     * Avoids a database query per journal lookup at the cost of memory.
+     * See SyncJournalDb::createMetadataSnapshot().
+     */
+    bool _journalSnapshot = false;
+
+    /** Whether remote subtrees are reconciled while the remote discovery is
+     * still running, as soon as they were discovered completely.
+     *
+     * See csync_reconcile_discovered().
+     */
+    bool _reconcileDuringDiscovery = false;
+
+    /** Whether new remote files and directories are downloaded while the
+     * discovery is still running, as soon as their parent directory exists
+     * locally.
+     *
+     * Implies _reconcileDuringDiscovery. See OwncloudPropagator::startEarly().
+     */
+    bool _propagateDuringDiscovery = false;
+
+    /** Whether the journal writes of the propagation are queued and committed
+     * in batches by a separate thread.
+     *
+     * See SyncJournalDb::setAsyncWritesEnabled().
+     */
+    bool _asyncJournalWrites = false;
+
+    /** Whether the journal records of the initial sync of a folder are
+     * written without maintaining the indexes, in large transactions.
+     *
+     * See SyncJournalDb::startBulkLoad().
+     */
+    bool _journalBulkLoad = false;
+
+    /** Whether the checksums of files uploaded with chunking NG are computed
+     * from the data while it is sent, instead of reading the file before.
+     *
+     * The chunks of such a file are uploaded one after the other. See
+     * UploadChecksums.
+     */
+    bool _checksumWhileUploading = false;
 };
 
 
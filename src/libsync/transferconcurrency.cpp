@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "transferconcurrency.h"
+
+#include <QLoggingCategory>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcTransferConcurrency, "sync.propagator.concurrency", QtInfoMsg)
+
+// A round has at least that many samples, to smooth out single slow requests
+static const int minimumRoundSamples = 4;
+
+// The rate must grow by that factor for a larger window to be kept
+static const double requiredGain = 1.1;
+
+// The window shrinks when the rate drops below that factor
+static const double dropThreshold = 0.75;
+
+// After that many rounds without change a larger window is probed again
+static const int probeInterval = 3;
+
+TransferConcurrency::TransferConcurrency()
+{
+}
+
+void TransferConcurrency::setLimits(int minimum, int maximum, int initial)
+{
+    _minimum = qMax(1, minimum);
+    _maximum = qMax(_minimum, maximum);
+    _window = qBound(_minimum, initial, _maximum);
+    _lastRate = Rate();
+    _latency = 0;
+    _stableRounds = 0;
+    _probing = false;
+    _congestionGrace = 0;
+    startRound();
+}
+
+void TransferConcurrency::addSample(qint64 bytes, std::chrono::milliseconds duration, Outcome outcome)
+{
+    if (outcome == Outcome::Failure)
+        return;
+
+    if (outcome == Outcome::Congestion) {
+        // The requests that were running together with the failed one
+        // will likely fail too, they must not shrink the window again
+        if (_congestionGrace > 0) {
+            --_congestionGrace;
+            return;
+        }
+        _congestionGrace = _window - 1;
+        _probing = false;
+        _stableRounds = 0;
+        setWindow(_window / 2, "request failed");
+        return;
+    }
+
+    if (_congestionGrace > 0)
+        --_congestionGrace;
+
+    auto msecs = qMax<qint64>(1, duration.count());
+    _latency = _latency == 0 ? msecs : (7 * _latency + msecs) / 8;
+
+    ++_samples;
+    _bytes += bytes;
+    _durationMsecs += msecs;
+    if (_samples >= qMax(_window, minimumRoundSamples))
+        finishRound();
+}
+
+void TransferConcurrency::finishRound()
+{
+    // Every request took _durationMsecs / _samples on average, with _window
+    // of them running at the same time
+    Rate rate;
+    rate.bytes = 1000. * _window * _bytes / _durationMsecs;
+    rate.requests = 1000. * _window * _samples / _durationMsecs;
+
+    const Rate last = _lastRate;
+    _lastRate = rate;
+
+    if (last.requests == 0) {
+        _probing = true;
+        setWindow(_window + 1, "first round");
+        return;
+    }
+
+    double gain = rate.requests / last.requests;
+    if (last.bytes > 0)
+        gain = qMax(gain, rate.bytes / last.bytes);
+
+    if (gain <= dropThreshold) {
+        _probing = false;
+        _stableRounds = 0;
+        setWindow(_window - qMax(1, _window / 4), "rate dropped");
+    } else if (gain >= requiredGain) {
+        _probing = true;
+        _stableRounds = 0;
+        setWindow(_window + 1, "rate grew");
+    } else if (_probing) {
+        _probing = false;
+        setWindow(_window - 1, "larger window did not help");
+    } else if (++_stableRounds >= probeInterval) {
+        _probing = true;
+        _stableRounds = 0;
+        setWindow(_window + 1, "probing");
+    } else {
+        startRound();
+    }
+}
+
+void TransferConcurrency::setWindow(int window, const char *reason)
+{
+    window = qBound(_minimum, window, _maximum);
+    if (window != _window) {
+        qCInfo(lcTransferConcurrency) << "Transfer window" << _window << "->" << window << reason
+                                      << "rate:" << qRound64(_lastRate.bytes) << "B/s"
+                                      << _lastRate.requests << "requests/s"
+                                      << "latency:" << qRound64(_latency) << "ms";
+        _window = window;
+    } else {
+        _probing = false;
+    }
+    startRound();
+}
+
+void TransferConcurrency::startRound()
+{
+    _samples = 0;
+    _bytes = 0;
+    _durationMsecs = 0;
+}
+
+} // namespace OCC
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include "owncloudlib.h"
+
+#include <QtGlobal>
+#include <chrono>
+
+namespace OCC {
+
+/**
+ * @brief Adapts the number of parallel transfers to the network
+ *
+ * The propagator reports every finished upload or download request with
+ * addSample(). The samples are grouped into rounds of window() requests.
+ * At the end of each round the aggregate rate is estimated from the bytes
+ * and the request latencies (Little's law: window / latency), in bytes and
+ * in requests per second, so that both large and small files count.
+ *
+ * The window is adjusted additive-increase/multiplicative-decrease style:
+ *  - it grows by one as long as a larger window yields a higher rate,
+ *  - it shrinks by a quarter when the rate drops because the latency grew
+ *    faster than the window,
+ *  - it is halved when requests fail with errors that hint at an
+ *    overloaded connection or server (timeouts, 429, 503).
+ * When the rate neither grows nor drops the window is kept, and a larger
+ * one is probed again after a few rounds.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT TransferConcurrency
+{
+public:
+    enum class Outcome {
+        Success,
+        /** The request failed in a way that hints at too many requests */
+        Congestion,
+        /** The request failed for a reason unrelated to the concurrency */
+        Failure
+    };
+
+    TransferConcurrency();
+
+    /** Sets the range of the window and restarts the adaptation at initial */
+    void setLimits(int minimum, int maximum, int initial);
+
+    /** The number of transfers that should run in parallel */
+    int window() const { return _window; }
+
+    /** Records a finished transfer request */
+    void addSample(qint64 bytes, std::chrono::milliseconds duration, Outcome outcome);
+
+    /** The aggregate rate estimated for the last completed round, in bytes per second */
+    double bytesPerSecond() const { return _lastRate.bytes; }
+
+    /** The smoothed latency of successful requests */
+    std::chrono::milliseconds latency() const { return std::chrono::milliseconds(qRound64(_latency)); }
+
+private:
+    struct Rate
+    {
+        double bytes = 0;
+        double requests = 0;
+    };
+
+    void finishRound();
+    void setWindow(int window, const char *reason);
+    void startRound();
+
+    int _minimum = 1;
+    int _maximum = 1;
+    int _window = 1;
+
+    // Samples of the current round
+    int _samples = 0;
+    qint64 _bytes = 0;
+    qint64 _durationMsecs = 0;
+
+    Rate _lastRate;
+    double _latency = 0;
+    int _stableRounds = 0;
+
+    // Whether the window was just increased to see if that helps
+    bool _probing = false;
+
+    // Number of congestion samples to ignore after the window was halved
+    int _congestionGrace = 0;
+};
+
+} // namespace OCC
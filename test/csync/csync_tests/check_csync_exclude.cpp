@@ -530,6 +530,82 @@ static void check_csync_bname_trigger(void **)
     assert_string_equal(translate("a/abc*/foo*"), "foo*");
 }
 
+static void check_csync_name_matcher(void **)
+{
+    ExcludeNameMatcher matcher;
+    auto matches = [&matcher](const char *name) { return matcher.matches(name, strlen(name)); };
+
+    assert_true(matcher.add("exact"));
+    assert_true(matcher.add("*.tmp"));
+    assert_true(matcher.add("*~"));
+    assert_true(matcher.add(".~lock.*"));
+    assert_true(matcher.add(".~lo*"));
+    assert_false(matcher.add(""));
+    assert_false(matcher.add("*.~*"));
+    assert_false(matcher.add("a?c"));
+    assert_false(matcher.add("[ab]c"));
+    assert_false(matcher.add("a\\*"));
+
+    assert_true(matches("exact"));
+    assert_false(matches("exac"));
+    assert_false(matches("exactly"));
+    assert_true(matches("foo.tmp"));
+    assert_true(matches(".tmp"));
+    assert_false(matches("foo.tmpx"));
+    assert_true(matches("foo~"));
+    assert_true(matches(".~lock.file#"));
+    assert_true(matches(".~loc"));
+    assert_false(matches(".~l"));
+    assert_false(matches(""));
+    assert_false(matches("EXACT"));
+
+    matcher.clear();
+    matcher.setCaseInsensitive(true);
+    assert_true(matcher.add("Exact"));
+    assert_true(matcher.add("*.TMP"));
+    assert_false(matcher.add("*.💩"));
+    assert_true(matches("eXACT"));
+    assert_true(matches("foo.tmp"));
+    assert_false(ExcludeNameMatcher::canMatch("É", strlen("É"), true));
+    assert_true(ExcludeNameMatcher::canMatch("É", strlen("É"), false));
+    assert_false(ExcludeNameMatcher::canMatch("a\nb", 3, false));
+}
+
+static void check_csync_traversal_matches_full(void **)
+{
+    excludedFiles->addManualExclude("exact");
+    excludedFiles->addManualExclude("*.tmp");
+    excludedFiles->addManualExclude("pre*");
+    excludedFiles->addManualExclude("]*.bak");
+    excludedFiles->addManualExclude("]junk");
+    excludedFiles->addManualExclude("*.both");
+    excludedFiles->addManualExclude("]*.both");
+    excludedFiles->addManualExclude("dironly/");
+    excludedFiles->addManualExclude("]*.rdir/");
+    excludedFiles->addManualExclude("a?c");
+    excludedFiles->addManualExclude("]x[yz]");
+    excludedFiles->addManualExclude("*.💩");
+    excludedFiles->addManualExclude("foo/*.out");
+
+    // Without a slash, the traversal match must agree with the full match
+    const char *names[] = { "exact", "exactly", "file.tmp", "file.tmpx", "prefix", "pr", "file.bak",
+        "junk", "junky", "file.both", "dironly", "dironly2", "d.rdir", "abc", "xy", "xa",
+        "中文.💩", "file.out", "" };
+    for (const char *name : names) {
+        assert_int_equal(check_file_traversal(name), check_file_full(name));
+        assert_int_equal(check_dir_traversal(name), check_dir_full(name));
+    }
+
+    assert_int_equal(check_file_traversal("file.both"), CSYNC_FILE_EXCLUDE_LIST);
+    assert_int_equal(check_file_traversal("file.bak"), CSYNC_FILE_EXCLUDE_AND_REMOVE);
+    assert_int_equal(check_file_traversal("dironly"), CSYNC_NOT_EXCLUDED);
+    assert_int_equal(check_dir_traversal("dironly"), CSYNC_FILE_EXCLUDE_LIST);
+    assert_int_equal(check_dir_traversal("d.rdir"), CSYNC_FILE_EXCLUDE_AND_REMOVE);
+    assert_int_equal(check_file_traversal("sub/prefix"), CSYNC_FILE_EXCLUDE_LIST);
+    assert_int_equal(check_file_traversal("foo/file.out"), CSYNC_FILE_EXCLUDE_LIST);
+    assert_int_equal(check_file_traversal("bar/file.out"), CSYNC_NOT_EXCLUDED);
+}
+
 static void check_csync_is_windows_reserved_word(void **)
 {
     assert_true(csync_is_windows_reserved_word("CON"));
@@ -717,6 +793,8 @@ int torture_run_tests(void)
         cmocka_unit_test_setup_teardown(T::check_csync_wildcards, T::setup, T::teardown),
         cmocka_unit_test_setup_teardown(T::check_csync_regex_translation, T::setup, T::teardown),
         cmocka_unit_test_setup_teardown(T::check_csync_bname_trigger, T::setup, T::teardown),
+        cmocka_unit_test(T::check_csync_name_matcher),
+        cmocka_unit_test_setup_teardown(T::check_csync_traversal_matches_full, T::setup, T::teardown),
         cmocka_unit_test_setup_teardown(T::check_csync_is_windows_reserved_word, T::setup_init, T::teardown),
         cmocka_unit_test_setup_teardown(T::check_csync_excluded_performance, T::setup_init, T::teardown),
         cmocka_unit_test(T::check_csync_exclude_expand_escapes),
@@ -27,12 +27,20 @@
 #include "csync_private.h"
 #include "std/c_utf8.h"
 #include "vio/csync_vio.h"
+#include "vio/csync_vio_local.h"
+#include "vio/csync_vio_local_prefetch.h"
+#ifdef __linux__
+#include "vio/csync_vio_local_statbatch.h"
+#include <vector>
+#endif
 
 #ifdef _WIN32
 #include <windows.h>
 
 #define CSYNC_TEST_DIR "C:/tmp/csync_test"
 #else
+#include <unistd.h>
+
 #define CSYNC_TEST_DIR "/tmp/csync_test"
 #endif
 #define MKDIR_MASK (S_IRWXU |S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH)
@@ -421,6 +429,52 @@ static void check_readdir_longtree(void **state)
     assert_string_equal( sv->result, result);
 }
 
+static void check_readdir_with_prefetcher(void **state)
+{
+    statevar *sv = (statevar*) *state;
+    CSYNC *csync = sv->csync;
+
+    create_dirs( "a/aa/aaa/" );
+    create_dirs( "b/ba/" );
+    create_dirs( "c/" );
+    create_file( "a/aa/", "file1.txt", "one");
+    create_file( "b/ba/", "file2.txt", "two");
+
+    /* sub directories are only prefetched below the sync root */
+    SAFE_FREE(csync->local.uri);
+    csync->local.uri = c_strdup(CSYNC_TEST_DIR);
+
+    LocalDirectoryPrefetcher prefetcher(4);
+    csync->local.prefetcher = &prefetcher;
+
+    int files_cnt = 0;
+    traverse_dir(state, CSYNC_TEST_DIR, &files_cnt);
+    csync->local.prefetcher = nullptr;
+
+    /* the order of the entries depends on the file system, only check for completeness */
+    assert_non_null(strstr(sv->result, "<DIR> C:/tmp/csync_test/a/aa/aaa"));
+    assert_non_null(strstr(sv->result, "<DIR> C:/tmp/csync_test/b/ba"));
+    assert_non_null(strstr(sv->result, "<DIR> C:/tmp/csync_test/c"));
+    assert_int_equal(files_cnt, 2);
+    assert_int_equal(prefetcher.pendingCount(), 0);
+
+    /* listings of skipped sub directories are dropped when their parent is closed */
+    csync->local.prefetcher = &prefetcher;
+    csync_vio_handle_t *dh = csync_vio_opendir(csync, CSYNC_TEST_DIR "/a");
+    assert_non_null(dh);
+    assert_int_equal(prefetcher.pendingCount(), 1);
+    csync_vio_closedir(csync, dh);
+    assert_int_equal(prefetcher.pendingCount(), 0);
+    csync->local.prefetcher = nullptr;
+
+    /* opendir errors are reported through errno */
+    csync->local.prefetcher = &prefetcher;
+    errno = 0;
+    assert_null(csync_vio_opendir(csync, CSYNC_TEST_DIR "/does_not_exist"));
+    assert_int_equal(errno, ENOENT);
+    csync->local.prefetcher = nullptr;
+}
+
 // https://github.com/owncloud/client/issues/3128 https://github.com/owncloud/client/issues/2777
 static void check_readdir_bigunicode(void **state)
 {
@@ -453,6 +507,122 @@ static void check_readdir_bigunicode(void **state)
     assert_int_equal(files_cnt, 0);
 }
 
+#ifndef _WIN32
+static void check_readdir_entry_types(void **state)
+{
+    (void) state; /* unused */
+
+    create_dirs( "dir/" );
+    create_file( "", "file.txt", "content");
+    assert_int_equal(symlink(CSYNC_TEST_DIR "/file.txt", CSYNC_TEST_DIR "/link"), 0);
+
+    csync_vio_handle_t *dh = csync_vio_local_opendir(CSYNC_TEST_DIR);
+    assert_non_null(dh);
+
+    int found = 0;
+    while (auto dirent = csync_vio_local_readdir(dh)) {
+        struct stat sb;
+        QByteArray fullPath = QByteArray(CSYNC_TEST_DIR "/") + dirent->path;
+        assert_int_equal(lstat(fullPath.constData(), &sb), 0);
+        assert_int_equal(dirent->inode, sb.st_ino);
+
+        if (dirent->path == "dir") {
+            assert_int_equal(dirent->type, ItemTypeDirectory);
+        } else if (dirent->path == "file.txt") {
+            assert_int_equal(dirent->type, ItemTypeFile);
+            assert_int_equal(dirent->size, sb.st_size);
+            assert_true(dirent->size > 0);
+            assert_int_equal(dirent->modtime, sb.st_mtime);
+        } else if (dirent->path == "link") {
+            assert_int_equal(dirent->type, ItemTypeSoftLink);
+        } else {
+            continue;
+        }
+        ++found;
+    }
+    assert_int_equal(csync_vio_local_closedir(dh), 0);
+    assert_int_equal(found, 3);
+
+    errno = 0;
+    assert_null(csync_vio_local_opendir(CSYNC_TEST_DIR "/does_not_exist"));
+    assert_int_equal(errno, ENOENT);
+}
+#endif
+
+#ifdef __linux__
+static void check_stat_batch(void **state)
+{
+    (void) state; /* unused */
+
+    create_dirs( "dir/" );
+    create_file( "", "file.txt", "content");
+
+    const char *names[] = { "dir", "file.txt", "does_not_exist" };
+    LocalStatRequest requests[3];
+    for (int i = 0; i < 3; ++i) {
+        requests[i].name = names[i];
+    }
+
+    int dirfd = open(CSYNC_TEST_DIR, O_RDONLY | O_DIRECTORY);
+    assert_true(dirfd >= 0);
+    LocalStatBatch::forCurrentThread().statAt(dirfd, requests, 3);
+
+    for (int i = 0; i < 2; ++i) {
+        struct stat sb;
+        assert_int_equal(fstatat(dirfd, names[i], &sb, AT_SYMLINK_NOFOLLOW), 0);
+        assert_int_equal(requests[i].error, 0);
+        assert_int_equal(requests[i].mode, sb.st_mode);
+        assert_int_equal(requests[i].inode, sb.st_ino);
+        assert_int_equal(requests[i].modtime, sb.st_mtime);
+        assert_int_equal(requests[i].size, sb.st_size);
+    }
+    assert_int_equal(requests[2].error, ENOENT);
+    close(dirfd);
+}
+
+static void check_stat_batch_io_uring(void **state)
+{
+    (void) state; /* unused */
+
+    LocalStatBatch batch(true);
+    if (!batch.usesIoUring()) {
+        skip();
+    }
+
+    /* More entries than the ring has, so the batch is submitted in parts,
+     * and failing entries in between */
+    const int count = 600;
+    std::vector<QByteArray> names;
+    for (int i = 0; i < count; ++i) {
+        names.push_back(QByteArray("file" + QByteArray::number(i)));
+        if (i % 3 != 2)
+            create_file( "", names.back().constData(), "content");
+    }
+    std::vector<LocalStatRequest> requests(count);
+    for (int i = 0; i < count; ++i) {
+        requests[i].name = names[i].constData();
+    }
+
+    int dirfd = open(CSYNC_TEST_DIR, O_RDONLY | O_DIRECTORY);
+    assert_true(dirfd >= 0);
+    batch.statAt(dirfd, requests.data(), requests.size());
+
+    for (int i = 0; i < count; ++i) {
+        if (i % 3 == 2) {
+            assert_int_equal(requests[i].error, ENOENT);
+            continue;
+        }
+        struct stat sb;
+        assert_int_equal(fstatat(dirfd, requests[i].name, &sb, AT_SYMLINK_NOFOLLOW), 0);
+        assert_int_equal(requests[i].error, 0);
+        assert_int_equal(requests[i].mode, sb.st_mode);
+        assert_int_equal(requests[i].inode, sb.st_ino);
+        assert_int_equal(requests[i].size, sb.st_size);
+    }
+    close(dirfd);
+}
+#endif
+
 int torture_run_tests(void)
 {
     const struct CMUnitTest tests[] = {
@@ -460,6 +630,14 @@ int torture_run_tests(void)
         cmocka_unit_test_setup_teardown(check_readdir_with_content, setup_testenv, teardown),
         cmocka_unit_test_setup_teardown(check_readdir_longtree, setup_testenv, teardown),
         cmocka_unit_test_setup_teardown(check_readdir_bigunicode, setup_testenv, teardown),
+        cmocka_unit_test_setup_teardown(check_readdir_with_prefetcher, setup_testenv, teardown),
+#ifndef _WIN32
+        cmocka_unit_test_setup_teardown(check_readdir_entry_types, setup_testenv, teardown),
+#endif
+#ifdef __linux__
+        cmocka_unit_test_setup_teardown(check_stat_batch, setup_testenv, teardown),
+        cmocka_unit_test_setup_teardown(check_stat_batch_io_uring, setup_testenv, teardown),
+#endif
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -422,9 +422,20 @@ public:
         setOperation(op);
         open(QIODevice::ReadOnly);
 
+        fileInfo = perform(remoteRootFileInfo, request, putPayload);
+        if (!fileInfo) {
+            abort();
+            return;
+        }
+        QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+    }
+
+    static FileInfo *perform(FileInfo &remoteRootFileInfo, const QNetworkRequest &request, const QByteArray &putPayload)
+    {
         QString fileName = getFilePathFromUrl(request.url());
         Q_ASSERT(!fileName.isEmpty());
-        if ((fileInfo = remoteRootFileInfo.find(fileName))) {
+        FileInfo *fileInfo = remoteRootFileInfo.find(fileName);
+        if (fileInfo) {
             fileInfo->size = putPayload.size();
             fileInfo->contentChar = putPayload.at(0);
         } else {
@@ -432,13 +443,11 @@ public:
             fileInfo = remoteRootFileInfo.create(fileName, putPayload.size(), putPayload.at(0));
         }
 
-        if (!fileInfo) {
-            abort();
-            return;
-        }
+        if (!fileInfo)
+            return nullptr;
         fileInfo->lastModified = OCC::Utility::qDateTimeFromTime_t(request.rawHeader("X-OC-Mtime").toLongLong());
         remoteRootFileInfo.find(fileName, /*invalidate_etags=*/true);
-        QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+        return fileInfo;
     }
 
     Q_INVOKABLE virtual void respond()
@@ -460,6 +469,50 @@ public:
     qint64 readData(char *, qint64) override { return 0; }
 };
 
+// Uploads a chunk. Unlike FakePutReply the chunk is only stored once the
+// upload is complete, so aborted chunk uploads leave nothing behind.
+class FakeChunkPutReply : public QNetworkReply
+{
+    Q_OBJECT
+    FileInfo &_uploadsFileInfo;
+    QByteArray _putPayload;
+    bool _aborted = false;
+public:
+    FakeChunkPutReply(FileInfo &uploadsFileInfo, QNetworkAccessManager::Operation op, const QNetworkRequest &request, const QByteArray &putPayload, QObject *parent)
+    : QNetworkReply{parent}, _uploadsFileInfo{uploadsFileInfo}, _putPayload{putPayload} {
+        setRequest(request);
+        setUrl(request.url());
+        setOperation(op);
+        open(QIODevice::ReadOnly);
+        QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+    }
+
+    Q_INVOKABLE virtual void respond()
+    {
+        if (_aborted)
+            return;
+        FileInfo *fileInfo = FakePutReply::perform(_uploadsFileInfo, request(), _putPayload);
+        if (!fileInfo) {
+            abort();
+            return;
+        }
+        emit uploadProgress(fileInfo->size, fileInfo->size);
+        setRawHeader("OC-ETag", fileInfo->etag.toLatin1());
+        setRawHeader("ETag", fileInfo->etag.toLatin1());
+        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 201);
+        emit metaDataChanged();
+        emit finished();
+    }
+
+    void abort() override
+    {
+        _aborted = true;
+        setError(OperationCanceledError, "abort");
+        emit finished();
+    }
+    qint64 readData(char *, qint64) override { return 0; }
+};
+
 class FakeMkcolReply : public QNetworkReply
 {
     Q_OBJECT
@@ -826,6 +879,8 @@ protected:
             return new FakePropfindReply{info, op, request, this};
         else if (verb == QLatin1String("GET") || op == QNetworkAccessManager::GetOperation)
             return new FakeGetReply{info, op, request, this};
+        else if ((verb == QLatin1String("PUT") || op == QNetworkAccessManager::PutOperation) && isUpload)
+            return new FakeChunkPutReply{info, op, request, outgoingData->readAll(), this};
         else if (verb == QLatin1String("PUT") || op == QNetworkAccessManager::PutOperation)
             return new FakePutReply{info, op, request, outgoingData->readAll(), this};
         else if (verb == QLatin1String("MKCOL"))
@@ -876,6 +931,7 @@ public:
     {
         // Needs to be done once
         OCC::SyncEngine::minimumFileAgeForUpload = 0;
+        OCC::SyncEngine::minimumProgressInterval = 0;
         OCC::Logger::instance()->setLogFile("-");
 
         QDir rootDir{_tempDir.path()};
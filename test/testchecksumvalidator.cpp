@@ -10,10 +10,12 @@
 #include <QString>
 
 #include "common/checksums.h"
+#include "common/syncjournaldb.h"
 #include "networkjobs.h"
 #include "common/utility.h"
 #include "filesystem.h"
 #include "propagatorjobs.h"
+#include "csync/vio/csync_vio_local.h"
 
 
 using namespace OCC;
@@ -146,6 +148,59 @@ using namespace OCC;
 #endif
     }
 
+    void testChecksumCache() {
+        SyncJournalDb journal(_root + "/checksumcache.db");
+        const QString file = _root + "/cachedFile";
+        Utility::writeRandomFile(file);
+        csync_file_stat_t stat;
+        QCOMPARE(csync_vio_local_stat(file.toUtf8().constData(), &stat), 0);
+        const quint64 inode = stat.inode;
+
+        // Recently modified files are not cached
+        const QByteArray sha1 = FileSystem::calcSha1(file);
+        QCOMPARE(ComputeChecksum::computeNowCached(file, checkSumSHA1C, &journal), sha1);
+        QVERIFY(journal.getCachedChecksum(inode, FileSystem::getModTime(file), FileSystem::getSize(file), checkSumSHA1C).isEmpty());
+
+        const time_t modtime = FileSystem::getModTime(file) - 60;
+        QVERIFY(FileSystem::setModTime(file, modtime));
+        QCOMPARE(ComputeChecksum::computeNowCached(file, checkSumSHA1C, &journal), sha1);
+        QCOMPARE(journal.getCachedChecksum(inode, modtime, FileSystem::getSize(file), checkSumSHA1C), sha1);
+
+        // The cached value is used instead of reading the file
+        journal.setCachedChecksum(inode, modtime, FileSystem::getSize(file), checkSumSHA1C, "cached");
+        QCOMPARE(ComputeChecksum::computeNowCached(file, checkSumSHA1C, &journal), QByteArray("cached"));
+        QCOMPARE(ComputeChecksum::computeNowCached(file, checkSumMD5C, &journal), FileSystem::calcMd5(file));
+
+        // Any change of the modtime invalidates it
+        QVERIFY(FileSystem::setModTime(file, modtime - 1));
+        QCOMPARE(ComputeChecksum::computeNowCached(file, checkSumSHA1C, &journal), sha1);
+    }
+
+    void testChecksumCalculator() {
+        QFile file(_testfile);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        const QByteArray data = file.readAll();
+
+        QList<QByteArray> types = { checkSumMD5C, checkSumSHA1C };
+#ifdef ZLIB_FOUND
+        types.append(checkSumAdlerC);
+#endif
+        for (const auto &type : types) {
+            // Pieces of different sizes give the checksum of the whole file
+            ChecksumCalculator calculator(type);
+            QVERIFY(calculator.isValid());
+            qint64 pos = 0;
+            for (int size = 1; pos < data.size(); size *= 3) {
+                const qint64 length = qMin<qint64>(size, data.size() - pos);
+                calculator.addData(data.constData() + pos, length);
+                pos += length;
+            }
+            QCOMPARE(calculator.result(), ComputeChecksum::computeNow(_testfile, type));
+        }
+
+        QVERIFY(!ChecksumCalculator("Klaas32").isValid());
+        QVERIFY(ChecksumCalculator("Klaas32").result().isEmpty());
+    }
 
     void cleanupTestCase() {
     }
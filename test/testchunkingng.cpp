@@ -64,6 +64,98 @@ private slots:
         QCOMPARE(fakeFolder.uploadState().children.count(), 2); // the transfer was done with chunking
     }
 
+    // Several chunks of a file are uploaded at the same time, unless the server disables it
+    void testParallelChunkUpload_data()
+    {
+        QTest::addColumn<bool>("parallelUploadDisabled");
+        QTest::newRow("parallel") << false;
+        QTest::newRow("disabled") << true;
+    }
+    void testParallelChunkUpload()
+    {
+        QFETCH(bool, parallelUploadDisabled);
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{
+            { "chunking", "1.0" }, { "chunkingParallelUploadDisabled", parallelUploadDisabled } } } });
+        SyncOptions options;
+        options._maxChunkSize = 10 * 1000 * 1000;
+        fakeFolder.syncEngine().setSyncOptions(options);
+
+        int runningPuts = 0;
+        int maxRunningPuts = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *outgoingData) -> QNetworkReply * {
+            if (op != QNetworkAccessManager::PutOperation)
+                return nullptr;
+            auto reply = new FakeChunkPutReply(fakeFolder.uploadState(), op, request, outgoingData->readAll(), &fakeFolder.syncEngine());
+            maxRunningPuts = qMax(maxRunningPuts, ++runningPuts);
+            connect(reply, &QNetworkReply::finished, [&] { --runningPuts; });
+            return reply;
+        });
+
+        const int size = 100 * 1000 * 1000; // 100 MB
+        fakeFolder.localModifier().insert("A/a0", size);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(fakeFolder.currentRemoteState().find("A/a0")->size, size);
+        QCOMPARE(runningPuts, 0);
+        if (parallelUploadDisabled)
+            QCOMPARE(maxRunningPuts, 1);
+        else
+            QVERIFY(maxRunningPuts > 1);
+    }
+
+    // The checksums are computed from the uploaded data, or from the file for resumed uploads
+    void testChecksumWhileUploading_data()
+    {
+        QTest::addColumn<bool>("resume");
+        QTest::newRow("new") << false;
+        QTest::newRow("resumed") << true;
+    }
+    void testChecksumWhileUploading()
+    {
+        QFETCH(bool, resume);
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ { "chunking", "1.0" } } }, { "checksums", QVariantMap{ { "supportedTypes", QStringList() << "SHA1" } } } });
+        SyncOptions options;
+        options._maxChunkSize = 10 * 1000 * 1000;
+        options._checksumWhileUploading = true;
+        fakeFolder.syncEngine().setSyncOptions(options);
+
+        const int size = 100 * 1000 * 1000; // 100 MB
+        if (resume)
+            partialUpload(fakeFolder, "A/a0", size);
+        else
+            fakeFolder.localModifier().insert("A/a0", size);
+
+        QByteArray moveChecksumHeader;
+        int runningPuts = 0;
+        int maxRunningPuts = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *outgoingData) -> QNetworkReply * {
+            if (request.attribute(QNetworkRequest::CustomVerbAttribute) == "MOVE") {
+                moveChecksumHeader = request.rawHeader("OC-Checksum");
+            } else if (op == QNetworkAccessManager::PutOperation) {
+                auto reply = new FakeChunkPutReply(fakeFolder.uploadState(), op, request, outgoingData->readAll(), &fakeFolder.syncEngine());
+                maxRunningPuts = qMax(maxRunningPuts, ++runningPuts);
+                connect(reply, &QNetworkReply::finished, [&] { --runningPuts; });
+                return reply;
+            }
+            return nullptr;
+        });
+
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(fakeFolder.currentRemoteState().find("A/a0")->size, size);
+        QCOMPARE(maxRunningPuts, 1);
+
+        QFile file(fakeFolder.localPath() + "A/a0");
+        QVERIFY(file.open(QFile::ReadOnly));
+        const QByteArray expected = "SHA1:" + QCryptographicHash::hash(file.readAll(), QCryptographicHash::Sha1).toHex();
+        QCOMPARE(moveChecksumHeader, expected);
+        SyncJournalFileRecord record;
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArray("A/a0"), &record));
+        QCOMPARE(record._checksumHeader, expected);
+    }
+
     // Test resuming when there's a confusing chunk added
     void testResume1() {
         FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
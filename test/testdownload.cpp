@@ -89,6 +89,78 @@ private slots:
         QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
     }
 
+    // The checksums are computed while the file is written
+    void testChecksumWhileDownloading_data()
+    {
+        QTest::addColumn<bool>("restart");
+        QTest::newRow("new") << false;
+        QTest::newRow("range ignored") << true;
+    }
+    void testChecksumWhileDownloading()
+    {
+        QFETCH(bool, restart);
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItemPtr &)));
+        const int size = 30 * 1000 * 1000;
+        fakeFolder.remoteModifier().insert("A/a0", size);
+        const QByteArray content(size, 'W');
+        const QByteArray md5 = QCryptographicHash::hash(content, QCryptographicHash::Md5).toHex();
+        const QByteArray sha1 = QCryptographicHash::hash(content, QCryptographicHash::Sha1).toHex();
+
+        if (restart) {
+            // A partial download, the server ignores the range when resuming
+            fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+                if (op == QNetworkAccessManager::GetOperation && request.url().path().endsWith("A/a0"))
+                    return new BrokenFakeGetReply(fakeFolder.remoteModifier(), op, request, this);
+                return nullptr;
+            });
+            QVERIFY(!fakeFolder.syncOnce());
+            completeSpy.clear();
+        }
+
+        // Once the last byte is written, a byte in the middle of the temporary
+        // file is changed. The checksums match only if they are computed from
+        // the received data and the file isn't read again.
+        const qint64 tamperedOffset = size / 2;
+        auto tamperTemporaryFile = [&]() {
+            QDir dir(fakeFolder.localPath() + "A");
+            const auto tmpFiles = dir.entryInfoList(QStringList(".a0.~*"), QDir::Files | QDir::Hidden);
+            QCOMPARE(tmpFiles.size(), 1);
+            QFile tmpFile(tmpFiles.first().filePath());
+            QVERIFY(tmpFile.open(QIODevice::ReadWrite));
+            QCOMPARE(tmpFile.size(), qint64(size));
+            QVERIFY(tmpFile.seek(tamperedOffset));
+            QCOMPARE(tmpFile.write("X", 1), qint64(1));
+        };
+
+        QByteArray contentMd5 = "bad";
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation && request.url().path().endsWith("A/a0")) {
+                auto reply = new FakeGetReply(fakeFolder.remoteModifier(), op, request, this);
+                reply->setRawHeader("Content-MD5", contentMd5);
+                // Connected before GETFileJob, so it runs before the validation
+                connect(reply, &QNetworkReply::finished, this, tamperTemporaryFile);
+                return reply;
+            }
+            return nullptr;
+        });
+        QVERIFY(!fakeFolder.syncOnce());
+        QCOMPARE(getItem(completeSpy, "A/a0")->_status, SyncFileItem::SoftError);
+        QCOMPARE(getItem(completeSpy, "A/a0")->_errorString, QString("The downloaded file does not match the checksum, it will be resumed."));
+
+        // The content checksum is computed along with the MD5 of the transmission
+        contentMd5 = md5;
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        SyncJournalFileRecord record;
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArray("A/a0"), &record));
+        QCOMPARE(record._checksumHeader, QByteArray("SHA1:" + sha1));
+        QFile localFile(fakeFolder.localPath() + "A/a0");
+        QVERIFY(localFile.open(QIODevice::ReadOnly));
+        QVERIFY(localFile.seek(tamperedOffset));
+        QCOMPARE(localFile.read(1), QByteArray("X"));
+    }
+
     void testErrorMessage () {
         // This test's main goal is to test that the error string from the server is shown in the UI
 
@@ -9,6 +9,7 @@
 
 #include "propagatedownload.h"
 #include "owncloudpropagator_p.h"
+#include "transferconcurrency.h"
 
 using namespace OCC;
 namespace OCC {
@@ -76,6 +77,53 @@ private slots:
             QCOMPARE(parseEtag(test.first), QByteArray(test.second));
         }
     }
+
+    void testTransferConcurrency()
+    {
+        TransferConcurrency concurrency;
+        concurrency.setLimits(1, 6, 3);
+        QCOMPARE(concurrency.window(), 3);
+
+        // Feeds one round of requests that each take latencyPerWindow * window ms
+        auto round = [&](int latencyPerWindow) {
+            const int samples = qMax(concurrency.window(), 4);
+            const std::chrono::milliseconds latency(latencyPerWindow * concurrency.window());
+            for (int i = 0; i < samples; ++i)
+                concurrency.addSample(1000 * 1000, latency, TransferConcurrency::Outcome::Success);
+        };
+
+        // The link is saturated: a larger window only increases the latency
+        for (int i = 0; i < 20; ++i) {
+            round(100);
+            QVERIFY(concurrency.window() >= 3);
+            QVERIFY(concurrency.window() <= 4);
+        }
+
+        // The latency doesn't depend on the window: grow up to the maximum
+        for (int i = 0; i < 10; ++i)
+            round(0);
+        QCOMPARE(concurrency.window(), 6);
+        QVERIFY(concurrency.bytesPerSecond() > 0);
+
+        // A sudden increase of the latency shrinks the window
+        round(1000);
+        QVERIFY(concurrency.window() < 6);
+
+        // Errors unrelated to the concurrency are ignored
+        const int window = concurrency.window();
+        for (int i = 0; i < 10; ++i)
+            concurrency.addSample(0, std::chrono::milliseconds(10), TransferConcurrency::Outcome::Failure);
+        QCOMPARE(concurrency.window(), window);
+
+        // Congestion halves the window, once for the requests that ran together
+        concurrency.addSample(0, std::chrono::milliseconds(10), TransferConcurrency::Outcome::Congestion);
+        QCOMPARE(concurrency.window(), window / 2);
+        for (int i = 0; i < window - 1; ++i)
+            concurrency.addSample(0, std::chrono::milliseconds(10), TransferConcurrency::Outcome::Congestion);
+        QCOMPARE(concurrency.window(), window / 2);
+        concurrency.addSample(0, std::chrono::milliseconds(10), TransferConcurrency::Outcome::Congestion);
+        QCOMPARE(concurrency.window(), 1);
+    }
 };
 
 QTEST_APPLESS_MAIN(TestOwncloudPropagator)
@@ -126,6 +126,102 @@ private slots:
         }
     }
 
+    void testTypedBindings()
+    {
+        SqlQuery q(_db);
+        q.prepare("INSERT INTO addresses (id, name, address, entered) VALUES (?1, ?2, ?3, ?4);");
+        QByteArray name("Kermit");
+        q.bindValue(1, 4);
+        q.bindValue(2, name);
+        q.bindValue(3, QString());
+        q.bindValue(4, Q_INT64_C(5000000000));
+        // The bound data is kept alive by the query
+        name = "Piggy";
+        QVERIFY(q.exec());
+
+        q.prepare("SELECT name, address, entered FROM addresses WHERE id=?1");
+        q.bindValue(1, 4);
+        QVERIFY(q.next());
+        QCOMPARE(q.baValueView(0), QByteArray("Kermit"));
+        QVERIFY(q.nullValue(1));
+        QCOMPARE(q.int64Value(2), quint64(5000000000));
+    }
+
+    void testCachedQuery()
+    {
+        const QByteArray sql = "SELECT name FROM addresses WHERE id=?1";
+        auto q = _db.cachedQuery(sql);
+        QVERIFY(q);
+        q->bindValue(1, 1);
+        QVERIFY(q->next());
+        QCOMPARE(q->stringValue(0), QStringLiteral("Gonzo Alberto"));
+
+        // The same statement, reset and without bindings
+        QCOMPARE(_db.cachedQuery(sql), q);
+        QVERIFY(!q->next());
+        q->bindValue(1, 2);
+        QVERIFY(q->next());
+        QCOMPARE(q->stringValue(0), QStringLiteral("Brucely Lafayette"));
+
+        QVERIFY(!_db.cachedQuery("SELECT * FROM doesnotexist"));
+    }
+
+    void testStatistics()
+    {
+        _db.resetStatistics();
+        const QByteArray sql = "SELECT id FROM addresses WHERE id < ?1";
+        for (int i = 0; i < 3; ++i) {
+            auto q = _db.cachedQuery(sql);
+            QVERIFY(q);
+            q->bindValue(1, 3);
+            QVERIFY(q->exec());
+            while (q->next()) {
+            }
+        }
+        // An execution that is stopped early still counts
+        auto q = _db.cachedQuery(sql);
+        q->bindValue(1, 3);
+        QVERIFY(q->next());
+        q->reset_and_clear_bindings();
+
+        auto stats = _db.statistics();
+        QCOMPARE(stats.size(), 1);
+        QCOMPARE(stats[0].sql, sql);
+        QCOMPARE(stats[0].executions, quint64(4));
+        QCOMPARE(stats[0].rows, quint64(7));
+        QVERIFY(stats[0].maxNsecs <= stats[0].totalNsecs);
+
+        // Long statements that only differ in the end are separate entries,
+        // statements that only differ in a generated list of values are not
+        _db.resetStatistics();
+        const QByteArray longSelect = "SELECT id, name, address, entered FROM addresses WHERE "
+                                      "name IS NOT NULL AND address IS NOT NULL AND entered IS NOT NULL "
+                                      "AND length(name) < 4096 AND length(address) < 4096 AND entered > 0 "
+                                      "AND length(name) > 0 AND length(address) > 0 AND ";
+        for (const QByteArray &sql : {
+                 QByteArray(longSelect + "id = ?1"),
+                 QByteArray(longSelect + "id > ?1"),
+                 QByteArray("SELECT id FROM addresses WHERE id IN (1, 2)"),
+                 QByteArray("SELECT id FROM addresses WHERE id IN (3, 4, 5)"),
+                 QByteArray("SELECT id FROM addresses WHERE id IN (SELECT id FROM addresses)") }) {
+            SqlQuery q(_db);
+            QCOMPARE(q.prepare(sql), 0);
+            if (sql.contains("?1"))
+                q.bindValue(1, 1);
+            QVERIFY(q.exec());
+            q.next();
+        }
+        QByteArrayList keys;
+        for (const auto &stats : _db.statistics())
+            keys.append(stats.sql);
+        std::sort(keys.begin(), keys.end());
+        QCOMPARE(keys, QByteArrayList()
+                << "SELECT id FROM addresses WHERE id IN (...)"
+                << "SELECT id FROM addresses WHERE id IN (SELECT id FROM addresses)"
+                << QByteArray(longSelect + "id = ?1")
+                << QByteArray(longSelect + "id > ?1"));
+    }
+
     void testDestructor()
     {
         // This test make sure that the destructor of SqlQuery works even if the SqlDatabase
@@ -423,6 +423,358 @@ private slots:
         QVERIFY(fakeFolder.syncOnce());
     }
 
+    /**
+     * Remote discovery lists several directories at the same time
+     */
+    void testParallelRemoteDiscovery()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        QObject parent;
+
+        int inFlight = 0, maxInFlight = 0, nPROPFIND = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (request.attribute(QNetworkRequest::CustomVerbAttribute) == "PROPFIND") {
+                auto reply = new FakePropfindReply(fakeFolder.remoteModifier(), op, request, &parent);
+                ++nPROPFIND;
+                maxInFlight = qMax(maxInFlight, ++inFlight);
+                QObject::connect(reply, &QNetworkReply::finished, [&] { --inFlight; });
+                return reply;
+            }
+            return nullptr;
+        });
+
+        auto createTree = [&](const QString &root) {
+            fakeFolder.remoteModifier().mkdir(root);
+            for (int i = 0; i < 8; ++i) {
+                const QString dir = root + "/sub" + QString::number(i);
+                fakeFolder.remoteModifier().mkdir(dir);
+                fakeFolder.remoteModifier().mkdir(dir + "/deep");
+                fakeFolder.remoteModifier().insert(dir + "/deep/file");
+            }
+        };
+
+        createTree("parallel");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(maxInFlight > 1);
+        QCOMPARE(inFlight, 0);
+
+        // Unchanged directories are read from the db and not listed again
+        nPROPFIND = 0;
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(nPROPFIND, 1);
+
+        // Only one listing at a time when the prefetching is disabled
+        SyncOptions syncOptions;
+        syncOptions._parallelDiscoveryJobs = 1;
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+        maxInFlight = 0;
+        createTree("sequential");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(maxInFlight, 1);
+
+        // Excluded directories are not listed ahead of the sync thread
+        syncOptions._parallelDiscoveryJobs = 0;
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+        fakeFolder.syncEngine().excludedFiles().addManualExclude("excluded*");
+        for (int i = 0; i < 100; ++i) {
+            const QString dir = "parallel/excluded" + QString::number(i);
+            fakeFolder.remoteModifier().mkdir(dir);
+            fakeFolder.remoteModifier().insert(dir + "/file");
+        }
+        fakeFolder.remoteModifier().insert("parallel/sub7/deep/file2");
+        nPROPFIND = 0;
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(nPROPFIND, 4); // the root, parallel, sub7 and deep
+        QVERIFY(fakeFolder.currentLocalState().find("parallel/sub7/deep/file2"));
+        QVERIFY(!fakeFolder.currentLocalState().find("parallel/excluded0"));
+    }
+
+    /**
+     * Remote subtrees are reconciled while the discovery is running, renames
+     * are still detected across subtrees
+     */
+    void testReconcileDuringDiscovery()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        SyncOptions syncOptions;
+        syncOptions._reconcileDuringDiscovery = true;
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+
+        int nPUT = 0, nMOVE = 0, nDELETE = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PutOperation)
+                ++nPUT;
+            if (op == QNetworkAccessManager::DeleteOperation)
+                ++nDELETE;
+            if (request.attribute(QNetworkRequest::CustomVerbAttribute) == "MOVE")
+                ++nMOVE;
+            return nullptr;
+        });
+
+        fakeFolder.remoteModifier().mkdir("new");
+        fakeFolder.remoteModifier().mkdir("new/sub");
+        fakeFolder.remoteModifier().insert("new/sub/file");
+        fakeFolder.remoteModifier().appendByte("A/a1");
+        fakeFolder.remoteModifier().rename("A", "A2");
+        fakeFolder.remoteModifier().appendByte("B/b2");
+        fakeFolder.remoteModifier().remove("C/c2");
+        fakeFolder.localModifier().rename("B/b1", "C/b1m");
+        fakeFolder.localModifier().insert("S/s3");
+        fakeFolder.localModifier().remove("S/s1");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(nPUT, 1);
+        QCOMPARE(nMOVE, 1);
+        QCOMPARE(nDELETE, 1);
+
+        // Nothing left to do
+        nPUT = nMOVE = nDELETE = 0;
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(nPUT + nMOVE + nDELETE, 0);
+    }
+
+    /**
+     * A file that was moved on the server and recreated at its old path: the
+     * local file is the origin of the rename, which is only found later. The
+     * outcome is the same as without reconciling during the discovery.
+     */
+    void testReconcileDuringDiscoveryMoveAndRecreate()
+    {
+        auto syncMovedAndRecreated = [](bool reconcileDuringDiscovery, FileInfo *localState) {
+            FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+            SyncOptions syncOptions;
+            syncOptions._reconcileDuringDiscovery = reconcileDuringDiscovery;
+            fakeFolder.syncEngine().setSyncOptions(syncOptions);
+
+            int nGET = 0;
+            fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &, QIODevice *) -> QNetworkReply * {
+                if (op == QNetworkAccessManager::GetOperation)
+                    ++nGET;
+                return nullptr;
+            });
+
+            fakeFolder.remoteModifier().rename("A/a1", "B/a1m");
+            fakeFolder.remoteModifier().insert("A/a1", 12);
+            fakeFolder.syncOnce();
+            *localState = fakeFolder.currentLocalState();
+            return nGET;
+        };
+
+        // Conflict files would have a different name, compare the rest
+        FileInfo expectedState, localState;
+        const int expectedGets = syncMovedAndRecreated(false, &expectedState);
+        QCOMPARE(syncMovedAndRecreated(true, &localState), expectedGets);
+        QCOMPARE(localState.find("A")->children.size(), expectedState.find("A")->children.size());
+        QCOMPARE(localState.find("A/a1")->size, expectedState.find("A/a1")->size);
+        QCOMPARE(bool(localState.find("B/a1m")), bool(expectedState.find("B/a1m")));
+    }
+
+    void testPropagateDuringDiscovery()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        SyncOptions syncOptions;
+        syncOptions._propagateDuringDiscovery = true;
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+
+        int nGET = 0, nDELETE = 0;
+        bool failGet = true;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation) {
+                ++nGET;
+                if (failGet && request.url().path().endsWith("A/a3"))
+                    return new FakeErrorReply(op, request, this, 500);
+            }
+            if (op == QNetworkAccessManager::DeleteOperation)
+                ++nDELETE;
+            return nullptr;
+        });
+
+        // Count the items that are done before the discovery is
+        bool discoveryDone = false;
+        int nEarlyCompleted = 0;
+        connect(&fakeFolder.syncEngine(), &SyncEngine::aboutToPropagate, [&](SyncFileItemVector &) {
+            discoveryDone = true;
+        });
+        connect(&fakeFolder.syncEngine(), &SyncEngine::itemCompleted, [&](const SyncFileItemPtr &) {
+            if (!discoveryDone)
+                ++nEarlyCompleted;
+        });
+
+        fakeFolder.remoteModifier().mkdir("new");
+        fakeFolder.remoteModifier().mkdir("new/sub");
+        fakeFolder.remoteModifier().insert("new/f1");
+        fakeFolder.remoteModifier().insert("new/sub/f2");
+        fakeFolder.remoteModifier().insert("A/a3");
+        fakeFolder.remoteModifier().insert("B/b3");
+        fakeFolder.remoteModifier().rename("C", "C2");
+        fakeFolder.localModifier().remove("S/s1");
+        QVERIFY(!fakeFolder.syncOnce());
+        QVERIFY(nEarlyCompleted > 0);
+        QCOMPARE(nGET, 4);
+        QCOMPARE(nDELETE, 1);
+        QVERIFY(fakeFolder.currentLocalState().find("new/sub/f2"));
+        QVERIFY(fakeFolder.currentLocalState().find("B/b3"));
+        QVERIFY(fakeFolder.currentLocalState().find("C2/c1"));
+        QVERIFY(!fakeFolder.currentLocalState().find("A/a3"));
+
+        // The etag of A wasn't stored, so a3 is found again
+        failGet = false;
+        nGET = nDELETE = 0;
+        fakeFolder.syncJournal().wipeErrorBlacklist();
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(nGET, 1);
+
+        // Nothing left to do
+        nGET = 0;
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(nGET + nDELETE, 0);
+    }
+
+    void testPropagateDuringDiscoveryBlacklistedChild()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        SyncOptions syncOptions;
+        syncOptions._propagateDuringDiscovery = true;
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+
+        fakeFolder.remoteModifier().mkdir("new");
+        fakeFolder.remoteModifier().insert("new/f1");
+        fakeFolder.remoteModifier().insert("new/f2");
+
+        SyncJournalErrorBlacklistRecord entry;
+        entry._file = "new/f2";
+        entry._errorString = "error";
+        entry._retryCount = 1;
+        entry._lastTryEtag = fakeFolder.remoteModifier().find("new/f2")->etag.toUtf8();
+        entry._lastTryTime = Utility::qDateTimeToTime_t(QDateTime::currentDateTimeUtc());
+        entry._ignoreDuration = 3600;
+        fakeFolder.syncJournal().setErrorBlacklistEntry(entry);
+
+        fakeFolder.syncOnce();
+        QVERIFY(fakeFolder.currentLocalState().find("new/f1"));
+        QVERIFY(!fakeFolder.currentLocalState().find("new/f2"));
+
+        // The etag of the new directory wasn't stored, so f2 is found again
+        fakeFolder.syncJournal().wipeErrorBlacklist();
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testPropagateDuringDiscoveryMoveIntoNewDirectory()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        SyncOptions syncOptions;
+        syncOptions._propagateDuringDiscovery = true;
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+
+        int nGET = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation)
+                ++nGET;
+            return nullptr;
+        });
+
+        fakeFolder.remoteModifier().mkdir("new");
+        fakeFolder.remoteModifier().insert("new/f1");
+        fakeFolder.remoteModifier().rename("A/a1", "new/a1");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(nGET, 1);
+
+        // The rename was done after the new directory was: its etag is only stored now
+        SyncJournalFileRecord record;
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArray("new"), &record));
+        QVERIFY(!record.isValid());
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArray("new/a1"), &record));
+        QVERIFY(record.isValid());
+
+        nGET = 0;
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(nGET, 0);
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArray("new"), &record));
+        QVERIFY(record.isValid());
+    }
+
+    void testAsyncJournalWrites()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        SyncOptions syncOptions;
+        syncOptions._asyncJournalWrites = true;
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+
+        int nGET = 0, nPUT = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation)
+                ++nGET;
+            if (op == QNetworkAccessManager::PutOperation)
+                ++nPUT;
+            return nullptr;
+        });
+
+        fakeFolder.remoteModifier().mkdir("new");
+        for (int i = 0; i < 50; ++i)
+            fakeFolder.remoteModifier().insert("new/f" + QString::number(i));
+        fakeFolder.remoteModifier().appendByte("A/a1");
+        fakeFolder.localModifier().insert("B/b3");
+        fakeFolder.localModifier().rename("C/c1", "C/c3");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(nGET, 51);
+        QCOMPARE(nPUT, 1);
+
+        // All records were written when the sync finished
+        SyncJournalFileRecord record;
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArrayLiteral("new/f49"), &record));
+        QVERIFY(record.isValid());
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArrayLiteral("C/c3"), &record));
+        QVERIFY(record.isValid());
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArrayLiteral("C/c1"), &record));
+        QVERIFY(!record.isValid());
+
+        // Nothing left to do
+        nGET = nPUT = 0;
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(nGET + nPUT, 0);
+    }
+
+    void testJournalBulkLoad()
+    {
+        FakeFolder fakeFolder{ FileInfo{} };
+        SyncOptions syncOptions;
+        syncOptions._journalBulkLoad = true;
+        syncOptions._asyncJournalWrites = true;
+        fakeFolder.syncEngine().setSyncOptions(syncOptions);
+
+        fakeFolder.remoteModifier().mkdir("A");
+        for (int i = 0; i < 20; ++i)
+            fakeFolder.remoteModifier().insert("A/a" + QString::number(i));
+        fakeFolder.localModifier().mkdir("B");
+        fakeFolder.localModifier().insert("B/b1");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        SyncJournalFileRecord record;
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArrayLiteral("A/a19"), &record));
+        QVERIFY(record.isValid());
+        QVERIFY(fakeFolder.syncJournal().getFileRecordByInode(record._inode, &record));
+        QCOMPARE(record._path, QByteArray("A/a19"));
+
+        // The second sync uses the records and doesn't bulk load
+        fakeFolder.remoteModifier().appendByte("A/a1");
+        fakeFolder.localModifier().rename("B/b1", "B/b2");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArrayLiteral("B/b2"), &record));
+        QVERIFY(record.isValid());
+    }
+
     /**
      * Checks whether subsequent large uploads are skipped after a 507 error
      */
@@ -648,6 +1000,83 @@ private slots:
         QTextCodec::setCodecForLocale(utf8Locale);
 #endif
     }
+
+    void testProgressThrottling()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        SyncEngine::minimumProgressInterval = 60 * 60 * 1000;
+        // Many small files: the progress of the completed items dominates
+        for (int i = 0; i < 100; ++i)
+            fakeFolder.localModifier().insert(QString("A/upload%1").arg(i), 10);
+
+        int propagationProgress = 0;
+        int completedItems = 0;
+        ProgressInfo lastProgress;
+        connect(&fakeFolder.syncEngine(), &SyncEngine::transmissionProgress, [&](const ProgressInfo &progress) {
+            if (progress._status == ProgressInfo::Propagation)
+                ++propagationProgress;
+            lastProgress = progress;
+        });
+        connect(&fakeFolder.syncEngine(), &SyncEngine::itemCompleted, [&](const SyncFileItemPtr &item) {
+            if (item->_instruction == CSYNC_INSTRUCTION_NEW)
+                ++completedItems;
+        });
+        QVERIFY(fakeFolder.syncOnce());
+        SyncEngine::minimumProgressInterval = 0;
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        // Only the first progress of the propagation got through, every completed item is reported
+        QCOMPARE(propagationProgress, 1);
+        QCOMPARE(completedItems, 100);
+        QCOMPARE(lastProgress._status, ProgressInfo::Done);
+        QCOMPARE(lastProgress.completedSize(), lastProgress.totalSize());
+    }
+
+    // Checks that an upload stops sending when the file changes while it is read
+    void testModifyLocalFileWhileSending()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        const int size = 100 * 1000;
+        fakeFolder.localModifier().insert("A/stream", size);
+
+        int nPUT = 0;
+        QByteArray sent;
+        QString deviceError;
+        auto parent = new QObject;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *outgoingData) -> QNetworkReply * {
+            if (op != QNetworkAccessManager::PutOperation || nPUT++ > 0)
+                return nullptr;
+            // The data is read from the file while it is sent
+            sent = outgoingData->read(1000);
+            fakeFolder.localModifier().appendByte("A/stream");
+            sent += outgoingData->readAll();
+            deviceError = outgoingData->errorString();
+            return new FakeErrorReply(op, request, parent, 0);
+        });
+
+        SyncFileItem::Status status = SyncFileItem::NoStatus;
+        QString errorString;
+        connect(&fakeFolder.syncEngine(), &SyncEngine::itemCompleted, [&](const SyncFileItemPtr &item) {
+            if (item->_file == "A/stream") {
+                status = item->_status;
+                errorString = item->_errorString;
+            }
+        });
+
+        QVERIFY(!fakeFolder.syncOnce());
+        QCOMPARE(nPUT, 1);
+        QVERIFY(sent.size() < size);
+        QVERIFY(!deviceError.isEmpty());
+        QCOMPARE(status, SyncFileItem::SoftError);
+        QCOMPARE(errorString, QStringLiteral("Local file changed during sync."));
+        QCOMPARE(fakeFolder.syncEngine().isAnotherSyncNeeded(), ImmediateFollowUp);
+        QVERIFY(!fakeFolder.currentRemoteState().find("A/stream"));
+
+        // The next sync uploads the new content
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(fakeFolder.currentRemoteState().find("A/stream")->size, size + 1);
+    }
 };
 
 QTEST_GUILESS_MAIN(TestSyncEngine)
@@ -323,6 +323,411 @@ private slots:
         QVERIFY(checkElements());
     }
 
+    void testFilesInDirectory()
+    {
+        auto makeEntry = [&](const QByteArray &path) {
+            SyncJournalFileRecord record;
+            record._path = path;
+            _db.setFileRecord(record);
+        };
+
+        QByteArrayList elements;
+        elements
+            << "list"
+            << "list/a"
+            << "list/b"
+            << "list/b/c"
+            << "list/b/c/d"
+            << "list/%_"
+            << "list-2"
+            << "list-2/a"
+            << "list bar/a";
+        for (auto elem : elements)
+            makeEntry(elem);
+
+        auto filesIn = [&](const QByteArray &path) {
+            QByteArrayList result;
+            _db.getFilesInDirectory(path, [&](const SyncJournalFileRecord &rec) {
+                result.append(rec._path);
+            });
+            std::sort(result.begin(), result.end());
+            return result;
+        };
+
+        QCOMPARE(filesIn("list"), QByteArrayList() << "list/%_" << "list/a" << "list/b");
+        QCOMPARE(filesIn("list/b"), QByteArrayList() << "list/b/c");
+        QCOMPARE(filesIn("list/b/c"), QByteArrayList() << "list/b/c/d");
+        QCOMPARE(filesIn("list/a"), QByteArrayList());
+        QCOMPARE(filesIn("list-2"), QByteArrayList() << "list-2/a");
+
+        auto root = filesIn("");
+        QVERIFY(root.contains("list"));
+        QVERIFY(root.contains("list-2"));
+        for (const auto &path : root)
+            QVERIFY(!path.contains('/'));
+    }
+
+    void testMetadataSnapshot()
+    {
+        auto makeEntry = [&](const QByteArray &path, quint64 inode, const QByteArray &fileId) {
+            SyncJournalFileRecord record;
+            record._path = path;
+            record._inode = inode;
+            record._fileId = fileId;
+            record._etag = "etag" + path;
+            record._type = ItemTypeFile;
+            record._remotePerm = RemotePermissions("RW");
+            record._checksumHeader = "MD5:mychecksum";
+            record._modtime = 1234;
+            record._fileSize = 42;
+            _db.setFileRecord(record);
+        };
+        makeEntry("snap", 1001, "snapid");
+        makeEntry("snap/a", 1002, "snapida");
+        makeEntry("snap/a/b", 1003, "snapidb");
+        makeEntry("snap/c", 1004, "snapidc");
+        makeEntry("snap-2", 1005, "snapidc");
+        makeEntry("snap-2/d", 1006, "snapidd");
+
+        auto belowPath = [&](const QByteArray &path) {
+            QByteArrayList result;
+            _db.getFilesBelowPath(path, [&](const SyncJournalFileRecord &rec) { result.append(rec._path); });
+            return result;
+        };
+        auto inDirectory = [&](const QByteArray &path) {
+            QByteArrayList result;
+            _db.getFilesInDirectory(path, [&](const SyncJournalFileRecord &rec) { result.append(rec._path); });
+            std::sort(result.begin(), result.end());
+            return result;
+        };
+        auto withFileId = [&](const QByteArray &fileId) {
+            QByteArrayList result;
+            _db.getFileRecordsByFileId(fileId, [&](const SyncJournalFileRecord &rec) { result.append(rec._path); });
+            std::sort(result.begin(), result.end());
+            return result;
+        };
+
+        SyncJournalFileRecord sqlRecord;
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("snap/a"), &sqlRecord));
+        auto sqlBelow = belowPath("snap");
+        auto sqlAll = belowPath("");
+        auto sqlInRoot = inDirectory("");
+
+        QVERIFY(_db.createMetadataSnapshot());
+
+        SyncJournalFileRecord record;
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("snap/a"), &record));
+        QVERIFY(record.isValid());
+        QVERIFY(record == sqlRecord);
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("snap/x"), &record));
+        QVERIFY(!record.isValid());
+
+        QVERIFY(_db.getFileRecordByInode(1003, &record));
+        QCOMPARE(record._path, QByteArray("snap/a/b"));
+        QVERIFY(_db.getFileRecordByInode(999999, &record));
+        QVERIFY(!record.isValid());
+
+        QCOMPARE(withFileId("snapidc"), QByteArrayList() << "snap-2" << "snap/c");
+        QCOMPARE(withFileId("nonexistant"), QByteArrayList());
+
+        QCOMPARE(belowPath("snap"), sqlBelow);
+        QCOMPARE(belowPath("snap"), QByteArrayList() << "snap/a" << "snap/a/b" << "snap/c");
+        QCOMPARE(belowPath("snap/a"), QByteArrayList() << "snap/a/b");
+        QCOMPARE(belowPath(""), sqlAll);
+        QCOMPARE(inDirectory("snap"), QByteArrayList() << "snap/a" << "snap/c");
+        QCOMPARE(inDirectory(""), sqlInRoot);
+
+        // Modifications drop the snapshot
+        makeEntry("snap/e", 1007, "snapide");
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("snap/e"), &record));
+        QVERIFY(record.isValid());
+        QCOMPARE(inDirectory("snap"), QByteArrayList() << "snap/a" << "snap/c" << "snap/e");
+
+        QVERIFY(_db.createMetadataSnapshot());
+        _db.deleteFileRecord("snap", true);
+        QVERIFY(_db.getFileRecordByInode(1003, &record));
+        QVERIFY(!record.isValid());
+        _db.dropMetadataSnapshot();
+    }
+
+    void testAsyncWrites()
+    {
+        _db.setAsyncWritesEnabled(true);
+
+        for (int i = 0; i < 100; ++i) {
+            SyncJournalFileRecord record;
+            record._path = "async/" + QByteArray::number(i);
+            record._type = ItemTypeFile;
+            record._etag = "etag";
+            record._inode = 2000 + i;
+            QVERIFY(_db.setFileRecord(record));
+        }
+        SyncJournalDb::DownloadInfo downloadInfo;
+        downloadInfo._tmpfile = "async.part";
+        downloadInfo._etag = "etag";
+        downloadInfo._valid = true;
+        _db.setDownloadInfo("async/0", downloadInfo);
+        _db.commit("async test");
+
+        // Reads see the queued writes
+        SyncJournalFileRecord record;
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("async/42"), &record));
+        QVERIFY(record.isValid());
+        QCOMPARE(record._inode, quint64(2042));
+        QCOMPARE(_db.getDownloadInfo("async/0")._tmpfile, QString("async.part"));
+
+        // Later writes win over earlier ones
+        record._etag = "etag2";
+        QVERIFY(_db.setFileRecord(record));
+        QVERIFY(_db.deleteFileRecord("async/43"));
+        _db.setDownloadInfo("async/0", SyncJournalDb::DownloadInfo());
+        QVERIFY(_db.flushWrites());
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("async/42"), &record));
+        QCOMPARE(record._etag, QByteArray("etag2"));
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("async/43"), &record));
+        QVERIFY(!record.isValid());
+        QVERIFY(!_db.getDownloadInfo("async/0")._valid);
+
+        // Writes queued when the writer stops are applied
+        record._path = "async/last";
+        record._inode = 2999;
+        QVERIFY(_db.setFileRecord(record));
+        _db.setAsyncWritesEnabled(false);
+        QVERIFY(_db.getFileRecordByInode(2999, &record));
+        QCOMPARE(record._path, QByteArray("async/last"));
+
+        QVERIFY(_db.deleteFileRecord("async", true));
+    }
+
+    void testFileRecordErrorWithAsyncWrites()
+    {
+        const QString file = _tempDir.path() + "/asyncerror.db";
+        SyncJournalDb db(file);
+
+        for (int round = 0; round < 5; ++round) {
+            db.setAsyncWritesEnabled(true);
+            SyncJournalFileRecord record;
+            record._path = "asyncerror/file";
+            record._type = ItemTypeFile;
+            record._inode = 3000;
+            QVERIFY(db.setFileRecord(record));
+            db.flushWrites();
+            QVERIFY(db.getFileRecord(QByteArrayLiteral("asyncerror/file"), &record));
+            QVERIFY(record.isValid());
+            db.flushWrites();
+
+            // The prepared query fails once the table is gone
+            {
+                SqlDatabase sqlDb;
+                QVERIFY(sqlDb.openOrCreateReadWrite(file));
+                SqlQuery query(sqlDb);
+                query.prepare("ALTER TABLE metadata RENAME TO metadata_old" + QByteArray::number(round) + ";");
+                QVERIFY(query.exec());
+            }
+
+            // The read waits for the writer to apply a full batch, then
+            // fails and closes the database, which stops the writer
+            for (int i = 0; i < 1000; ++i) {
+                record._path = "asyncerror/" + QByteArray::number(i);
+                record._inode = 4000 + i;
+                QVERIFY(db.setFileRecord(record));
+            }
+            QVERIFY(db.getFileRecord(QByteArrayLiteral("asyncerror/file"), &record));
+            QVERIFY(!record.isValid());
+        }
+
+        // The journal is opened again
+        db.setAsyncWritesEnabled(false);
+        SyncJournalFileRecord record;
+        record._path = "asyncerror/after";
+        record._type = ItemTypeFile;
+        record._inode = 3001;
+        QVERIFY(db.setFileRecord(record));
+        QVERIFY(db.getFileRecord(QByteArrayLiteral("asyncerror/after"), &record));
+        QCOMPARE(record._inode, quint64(3001));
+    }
+
+    void testCommittedFileRecord()
+    {
+        SyncJournalFileRecord record;
+        record._path = "committed";
+        record._type = ItemTypeFile;
+        record._etag = "etag1";
+        QVERIFY(_db.setFileRecord(record));
+        _db.commit("committed record");
+
+        // Changes in the running transaction are not visible yet
+        record._etag = "etag2";
+        QVERIFY(_db.setFileRecord(record));
+        SyncJournalFileRecord committed;
+        QVERIFY(_db.getCommittedFileRecord(QByteArrayLiteral("committed"), &committed));
+        QCOMPARE(committed._etag, QByteArray("etag1"));
+        QVERIFY(_db.getCommittedFileRecord(QByteArrayLiteral("nonexistant"), &committed));
+        QVERIFY(!committed.isValid());
+
+        _db.commit("committed record");
+        QVERIFY(_db.getCommittedFileRecord(QByteArrayLiteral("committed"), &committed));
+        QCOMPARE(committed._etag, QByteArray("etag2"));
+
+        // Reads still work after the journal was closed
+        _db.close();
+        QVERIFY(_db.getCommittedFileRecord(QByteArrayLiteral("committed"), &committed));
+        QCOMPARE(committed._etag, QByteArray("etag2"));
+        QVERIFY(_db.getCommittedFileRecord(QByteArrayLiteral("committed"), &committed));
+        QCOMPARE(committed._etag, QByteArray("etag2"));
+
+        QVERIFY(_db.deleteFileRecord("committed"));
+        _db.commit("committed record");
+    }
+
+    void testBulkLoad()
+    {
+        SyncJournalDb db(_tempDir.path() + "/bulkload.db");
+        auto metadataIndexCount = [&] {
+            SqlDatabase sqlDb;
+            if (!sqlDb.openReadOnly(db.databaseFilePath()))
+                return -1;
+            SqlQuery query("SELECT count(*) FROM sqlite_master WHERE type='index'"
+                           " AND name IN ('metadata_inode', 'metadata_path', 'metadata_file_id')", sqlDb);
+            return query.next() ? query.intValue(0) : -1;
+        };
+
+        QVERIFY(db.startBulkLoad());
+        QCOMPARE(metadataIndexCount(), 0);
+
+        for (int i = 0; i < 10; ++i) {
+            SyncJournalFileRecord record;
+            record._path = "bulk/" + QByteArray::number(i);
+            record._type = ItemTypeFile;
+            record._inode = 3000 + i;
+            record._fileId = "bulkid" + QByteArray::number(i);
+            QVERIFY(db.setFileRecord(record));
+        }
+        // Not committed before a large number of records was written
+        db.commit("bulk load");
+        SyncJournalFileRecord record;
+        QVERIFY(db.getCommittedFileRecord(QByteArrayLiteral("bulk/5"), &record));
+        QVERIFY(!record.isValid());
+
+        // Lookups work without the indexes
+        QVERIFY(db.getFileRecordByInode(3005, &record));
+        QCOMPARE(record._path, QByteArray("bulk/5"));
+        int count = 0;
+        QVERIFY(db.getFilesBelowPath("bulk", [&](const SyncJournalFileRecord &) { ++count; }));
+        QCOMPARE(count, 10);
+
+        QVERIFY(db.finishBulkLoad());
+        QCOMPARE(metadataIndexCount(), 3);
+        QVERIFY(db.getCommittedFileRecord(QByteArrayLiteral("bulk/5"), &record));
+        QCOMPARE(record._fileId, QByteArray("bulkid5"));
+
+        // Only a journal without records is bulk loaded
+        db.close();
+        QVERIFY(!db.startBulkLoad());
+        QCOMPARE(metadataIndexCount(), 3);
+    }
+
+    void testDeleteStaleEntries()
+    {
+        SyncJournalDb db(_tempDir.path() + "/stale.db");
+        SyncJournalDb::DownloadInfo download;
+        download._tmpfile = "tmpfile";
+        download._etag = "etag";
+        download._valid = true;
+        SyncJournalDb::UploadInfo upload;
+        upload._chunk = 1;
+        upload._transferid = 42;
+        upload._valid = true;
+        for (const auto &path : { QStringLiteral("stale/keep"), QStringLiteral("stale/drop") }) {
+            db.setDownloadInfo(path, download);
+            db.setUploadInfo(path, upload);
+            SyncJournalErrorBlacklistRecord entry;
+            entry._file = path;
+            entry._retryCount = 1;
+            entry._errorString = "error";
+            entry._lastTryEtag = "etag";
+            entry._lastTryTime = 1000;
+            db.setErrorBlacklistEntry(entry);
+        }
+
+        const QVector<QString> keep = { QStringLiteral("stale/keep"), QStringLiteral("stale/other") };
+        auto deletedDownloads = db.getAndDeleteStaleDownloadInfos(keep);
+        QCOMPARE(deletedDownloads.size(), 1);
+        QCOMPARE(deletedDownloads[0]._tmpfile, QStringLiteral("tmpfile"));
+        QVERIFY(db.getDownloadInfo("stale/keep")._valid);
+        QVERIFY(!db.getDownloadInfo("stale/drop")._valid);
+
+        QCOMPARE(db.deleteStaleUploadInfos(keep), QVector<uint>{ 42 });
+        QVERIFY(db.getUploadInfo("stale/keep")._valid);
+        QVERIFY(!db.getUploadInfo("stale/drop")._valid);
+
+        QVERIFY(db.deleteStaleErrorBlacklistEntries(keep));
+        QVERIFY(db.errorBlacklistEntry("stale/keep").isValid());
+        QVERIFY(!db.errorBlacklistEntry("stale/drop").isValid());
+
+        // Keeping nothing
+        QCOMPARE(db.getAndDeleteStaleDownloadInfos(QVector<QString>()).size(), 1);
+        QCOMPARE(db.downloadInfoCount(), 0);
+    }
+
+    void testMaintenance()
+    {
+        const QString file = _tempDir.path() + "/maintenance.db";
+        auto pragmaValue = [&](const char *pragma) {
+            SqlDatabase sqlDb;
+            if (!sqlDb.openReadOnly(file))
+                return qint64(-1);
+            SqlQuery query(pragma, sqlDb);
+            return query.next() ? query.int64Value(0) : qint64(-1);
+        };
+
+        // A database of an old client, without auto-vacuum and mostly unused
+        {
+            SqlDatabase sqlDb;
+            QVERIFY(sqlDb.openOrCreateReadWrite(file));
+            SqlQuery query("CREATE TABLE filler(data BLOB);", sqlDb);
+            QVERIFY(query.exec());
+            query.prepare("WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < 2000)"
+                          " INSERT INTO filler SELECT zeroblob(4096) FROM n;");
+            QVERIFY(query.exec());
+            query.prepare("DROP TABLE filler;");
+            QVERIFY(query.exec());
+        }
+        QCOMPARE(pragmaValue("PRAGMA auto_vacuum;"), qint64(0));
+        QVERIFY(pragmaValue("PRAGMA freelist_count;") > 1024);
+
+        // Rebuilt when opened, before any maintenance step
+        SyncJournalDb db(file);
+        QVERIFY(db.isConnected());
+        QCOMPARE(pragmaValue("PRAGMA auto_vacuum;"), qint64(2));
+        QCOMPARE(pragmaValue("PRAGMA freelist_count;"), qint64(0));
+        for (int i = 0; i < 10 && db.performMaintenance(std::chrono::seconds(10)); ++i) {
+        }
+        QVERIFY(QFileInfo(file).size() < 1024 * 1024);
+        QCOMPARE(QFileInfo(file + "-wal").size(), qint64(0));
+
+        // The pages of deleted records are returned incrementally
+        for (int i = 0; i < 2000; ++i) {
+            SyncJournalFileRecord record;
+            record._path = "maintenance/" + QByteArray(200, 'x') + QByteArray::number(i);
+            record._type = ItemTypeFile;
+            record._inode = 5000 + i;
+            QVERIFY(db.setFileRecord(record));
+        }
+        db.commit("records");
+        QVERIFY(db.deleteFileRecord("maintenance", true));
+        db.commit("deleted");
+        QVERIFY(pragmaValue("PRAGMA freelist_count;") > 0);
+
+        // No progress without budget
+        QVERIFY(db.performMaintenance(std::chrono::milliseconds(0)));
+        QVERIFY(pragmaValue("PRAGMA freelist_count;") > 0);
+
+        for (int i = 0; i < 10 && db.performMaintenance(std::chrono::seconds(10)); ++i) {
+        }
+        QCOMPARE(pragmaValue("PRAGMA freelist_count;"), qint64(0));
+    }
+
 private:
     SyncJournalDb _db;
 };